@@ -0,0 +1,105 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <math.h>
+#include "FloatingPoint.h"
+
+//#define TANH_OUTPUT
+#define SIGMOID_OUTPUT
+
+namespace FastNets
+{
+	/* Activation policies, passed as template parameters to Layer and Net. Each one has:
+		Type							- the ActivationType, which selects the vectorized kernels
+		ApplySlow(values, count)		- plain C++ implementation, used by ProcessInputSlow
+		Apply(values, count)			- vectorized implementation
+		ApplyDerivative(outputs, deltas, count) - multiplies the deltas by the derivative of the
+										  activation, calculated from the outputs
+	The vectorized functions require _CRT_ALIGN(32) pointers. */
+
+	//Implements the functions of an element-wise activation from the scalar Derived::Output:
+	template<class Derived, ActivationType TYPE>
+	struct ElementwiseActivation
+	{
+		const static ActivationType Type = TYPE;
+
+		template<class T>
+		static void ApplySlow(T* values, unsigned count)
+		{
+			for (unsigned i = 0; i < count; ++i)
+			{
+				values[i] = (T)Derived::Output(values[i]);
+			}
+		}
+
+		template<class T>
+		static void Apply(T* values, unsigned count)
+		{
+			ApplyActivation(TYPE, values, count);
+		}
+
+		template<class T>
+		static void ApplyDerivative(const T* outputs, T* deltas, unsigned count)
+		{
+			ApplyActivationDerivative(TYPE, outputs, deltas, count);
+		}
+	};
+
+	struct Identity : public ElementwiseActivation<Identity, ActivationIdentity>
+	{
+		static double Output(double input) { return input; }
+	};
+
+	struct ReLU : public ElementwiseActivation<ReLU, ActivationReLU>
+	{
+		static double Output(double input) { return (input > 0) ? input : 0; }
+	};
+
+	struct LeakyReLU : public ElementwiseActivation<LeakyReLU, ActivationLeakyReLU>
+	{
+		static double Output(double input) { return (input > 0) ? input : LeakyReLUSlope*input; }
+	};
+
+	struct Sigmoid : public ElementwiseActivation<Sigmoid, ActivationSigmoid>
+	{
+		static double Output(double input) { return 1/(1 + exp(-input)); }
+	};
+
+	struct Tanh : public ElementwiseActivation<Tanh, ActivationTanh>
+	{
+		static double Output(double input) { return 1 - (2.0 / (1.0 + exp(2*input))); }
+	};
+
+	/* Normalizes the outputs to probabilities. Use it only on the last layer, with the expected
+	outputs being 0 or 1. */
+	struct Softmax : public ElementwiseActivation<Softmax, ActivationSoftmax>
+	{
+		template<class T>
+		static void ApplySlow(T* values, unsigned count)
+		{
+			T maxValue = values[0];
+			for (unsigned i = 1; i < count; ++i)
+			{
+				if (maxValue < values[i])
+					maxValue = values[i];
+			}
+			double sum = 0;
+			for (unsigned i = 0; i < count; ++i)
+			{
+				values[i] = (T)exp(values[i] - maxValue);
+				sum += values[i];
+			}
+			for (unsigned i = 0; i < count; ++i)
+			{
+				values[i] = (T)(values[i]/sum);
+			}
+		}
+	};
+
+#ifdef TANH_OUTPUT
+	typedef Tanh DefaultActivation;
+#elif defined(SIGMOID_OUTPUT)
+	typedef Sigmoid DefaultActivation;
+#else
+	#error Please add other output methods here
+#endif
+}
@@ -18,6 +18,7 @@ class AlignedMatrix
 public:
 	FloatingPointType* mpMatrix;
 	unsigned		   mNumRows;
+	bool			   mOwnsBuffer;//False for the memory of the caller
 	const static unsigned AlignedRowSize = AVXAlignType(ROWSIZE, sizeof(FloatingPointType));
 private:
 	AlignedMatrix(const AlignedMatrix&){}//No copy
@@ -29,6 +30,21 @@ public:
 		AllocateBuffer();
 	}
 
+	//Uses the 32 byte aligned "pBuffer" of the caller (e.g. from an Arena) and doesn't free it. Allocates if it is NULL:
+	AlignedMatrix(unsigned rowCount, FloatingPointType* pBuffer)
+		:mNumRows(rowCount)
+	{
+		if (pBuffer)
+		{
+			mpMatrix = pBuffer;
+			mOwnsBuffer = false;
+		}
+		else
+		{
+			AllocateBuffer();
+		}
+	}
+
 	AlignedMatrix(const FloatingPointType* pNonAlignedBuffer, unsigned rowCount)
 		:mNumRows(rowCount)
 	{
@@ -90,11 +106,12 @@ public:
 	void AllocateBuffer()
 	{
 		mpMatrix = (FloatingPointType*)_aligned_malloc(mNumRows*AlignedRowSize*sizeof(FloatingPointType), 32);
+		mOwnsBuffer = true;
 	}
 
 	void FreeBuffer()
 	{
-		if (mpMatrix)
+		if (mpMatrix && mOwnsBuffer)
 			_aligned_free(mpMatrix);
 	}
 };
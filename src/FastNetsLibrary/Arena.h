@@ -0,0 +1,56 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <malloc.h>
+#include <string.h>
+#include <string>
+
+namespace FastNets
+{
+/* A single aligned block of memory for the parameters of many nets, e.g. the individuals of a Population,
+so they are next to each other instead of scattered over the heap. The nets take their memory from the
+arena one after the other (see Net::ArenaSize) and don't free it. The arena frees all of it at once, so it
+must outlive the nets:
+	Arena arena(100*Net<167, Net<112, Net<9>>>::ArenaSize);
+	Net<167, Net<112, Net<9>>>* pNet = new Net<167, Net<112, Net<9>>>(InitializeForGenetic, &arena);
+*/
+class Arena
+{
+protected:
+	char*	mpBlock;
+	size_t	mSize;
+	size_t	mUsed;
+private:
+	Arena(const Arena&){}//No copy
+public:
+	//The memory is zeroed:
+	Arena(size_t size)
+		:mSize(size), mUsed(0)
+	{
+		mpBlock = (char*)_aligned_malloc(size ? size : 1, 32);
+		if (!mpBlock)
+			throw std::string("Not enough memory for the arena");
+		memset(mpBlock, 0, size);
+	}
+
+	~Arena()
+	{
+		_aligned_free(mpBlock);
+	}
+
+	//Returns the next "bytes", 32 byte aligned:
+	void* Allocate(size_t bytes)
+	{
+		bytes = (bytes + 31) & ~(size_t)31;
+		if (mUsed + bytes > mSize)
+			throw std::string("The arena is full");
+		void* pResult = mpBlock + mUsed;
+		mUsed += bytes;
+		return pResult;
+	}
+
+	size_t Size() const { return mSize; }
+	size_t Used() const { return mUsed; }
+	bool Contains(const void* p) const { return p >= mpBlock && p < mpBlock + mSize; }
+};
+
+}//FastNets namespace
@@ -0,0 +1,119 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <omp.h>
+#include "Layer.h"
+
+namespace FastNets
+{
+/* Contrastive divergence (CD-k) training of a layer as a restricted Boltzmann machine: the inputs are the
+visible units and the outputs the hidden ones. The reconstruction of the visible units uses the reverse
+(transposed) weights and the output bias mC. The rows are processed "batchRows" at a time: each of the k
+Gibbs steps is a batch kernel over all the rows, and the sampling of the hidden states is split between the
+threads by rows. Each row has its own blocks of the random stream, so the states don't depend on the threads.
+Each batch ends with a single update from the positive and the negative statistics:
+	Layer<167, 112> layer(InitializeForBackProp);
+	ContrastiveDivergence<Layer<167, 112>> cd(layer, 1, 32);
+	for (int i = 0; i < 10; ++i)
+		error = cd.Train(input, 0.1);
+Only the probabilities of the sigmoid can be sampled, the layers with other activations use them as they
+are (mean field). See also Net::Pretrain for the greedy layer-wise pretraining of a whole net.
+*/
+template<class LayerType>
+class ContrastiveDivergence
+{
+public:
+	typedef typename LayerType::FloatingPointType FloatingPointType;
+	const static unsigned Input = LayerType::Input;
+	const static unsigned Output = LayerType::Output;
+	const static bool Sampled = (LayerType::ActivationPolicy::Type == ActivationSigmoid);
+protected:
+	LayerType&								mLayer;
+	unsigned								mSteps;//k
+	unsigned								mBatchRows;
+	AlignedMatrix<Output, FloatingPointType>	mHidden;//The probabilities at the start of the chain
+	AlignedMatrix<Output, FloatingPointType>	mStates;//The sampled states
+	AlignedMatrix<Output, FloatingPointType>	mReconstructionHidden;//The probabilities at the end of the chain
+	AlignedMatrix<Input, FloatingPointType>		mReconstruction;
+	AlignedMatrix<Input, FloatingPointType>		mVisibleDelta;
+	Randomizer								mRandom;
+private:
+	ContrastiveDivergence(const ContrastiveDivergence&){}//No copy
+public:
+	ContrastiveDivergence(LayerType& layer, unsigned steps = 1, unsigned batchRows = 32)
+		:mLayer(layer), mSteps(steps), mBatchRows(batchRows), mHidden(batchRows), mStates(batchRows),
+		mReconstructionHidden(batchRows), mReconstruction(batchRows), mVisibleDelta(batchRows)
+	{
+		if (!steps || !batchRows)
+			throw std::string("The steps and the batch size must be positive");
+	}
+
+	/* One pass over the rows. Returns the average squared error of the reconstructions (as Net::BackPropagation
+	does for the outputs), before the updates. */
+	double Train(const AlignedMatrix<Input, FloatingPointType>& input, double learningRate)
+	{
+		double error = 0;
+		for (unsigned i = 0; i < input.NumRows(); i += mBatchRows)
+		{
+			unsigned rowCount = (input.NumRows() - i < mBatchRows) ? input.NumRows() - i : mBatchRows;
+			error += TrainBatch(input.GetRow(i), rowCount, learningRate);
+		}
+		return error/input.NumRows();
+	}
+
+	/* CD-k on "rowCount" (up to batchRows) rows, laid out as in AlignedMatrix. Returns the sum of the errors of the rows.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	double TrainBatch(const FloatingPointType* input, unsigned rowCount, double learningRate)
+	{
+		if (!rowCount || rowCount > mBatchRows)
+			throw std::string("The batch size must be between 1 and batchRows");
+		mLayer.ProcessBatchFast(input, mHidden.GetBuffer(), rowCount);
+		const FloatingPointType* pHidden = mHidden.GetBuffer();
+		for (unsigned step = 0; step < mSteps; ++step)
+		{
+			const FloatingPointType* pStates = pHidden;
+			if (Sampled)
+			{
+				Sample(pHidden, mStates.GetBuffer(), rowCount);
+				pStates = mStates.GetBuffer();
+			}
+			mLayer.ProcessReverseBatchFast(pStates, mReconstruction.GetBuffer(), rowCount);
+			//The hidden units of the last step keep their probabilities:
+			mLayer.ProcessBatchFast(mReconstruction.GetBuffer(), mReconstructionHidden.GetBuffer(), rowCount);
+			pHidden = mReconstructionHidden.GetBuffer();
+		}
+
+		double error = 0;
+		for (unsigned s = 0; s < rowCount; ++s)
+		{
+			error += CalculateOutputDeltas(mReconstruction.GetRow(s), input + s*AlignedMatrix<Input, FloatingPointType>::AlignedRowSize,
+										   mVisibleDelta.GetRow(s), Input);
+		}
+		mLayer.UpdateContrastiveDivergence(input, mHidden.GetBuffer(), mReconstruction.GetBuffer(), mReconstructionHidden.GetBuffer(),
+										   mVisibleDelta.GetBuffer(), rowCount, learningRate);
+		return error/Input;
+	}
+
+protected:
+	//Binary states with the "probabilities" of each hidden unit:
+	void Sample(const FloatingPointType* probabilities, FloatingPointType* states, unsigned rowCount)
+	{
+		const unsigned stride = AlignedMatrix<Output, FloatingPointType>::AlignedRowSize;
+		const unsigned rowBlocks = PhiloxBlocks(Output);
+		const int threads = ParallelThreads((double)rowCount*Output, rowCount);
+		#pragma omp parallel for num_threads(threads) if (threads > 1)
+		for (int i = 0; i < (int)rowCount; ++i)
+		{
+			const FloatingPointType* pProbability = probabilities + i*stride;
+			FloatingPointType* pState = states + i*stride;
+			//The uniform numbers go to the states and are replaced in place:
+			mRandom.FillUniformAt(i*rowBlocks, pState, Output);
+			for (unsigned j = 0; j < Output; ++j)
+			{
+				pState[j] = (pState[j] <= pProbability[j]) ? (FloatingPointType)1 : (FloatingPointType)0;
+			}
+		}
+		mRandom.Skip(rowCount*rowBlocks);
+	}
+};
+
+}//FastNets namespace
@@ -0,0 +1,327 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <vector>
+#include <algorithm>
+#include <malloc.h>
+#include "File.h"
+#include "AlignedMatrix.h"
+#include "Activation.h"
+
+namespace FastNets
+{
+//Layers with up to that many inputs and outputs use the compile-time unrolled kernels (see UnrolledLayer):
+const unsigned DynamicSmallSize = 8;
+
+/* The unrolled kernels of a small layer, instantiated for each of the DynamicSmallSize x DynamicSmallSize sizes. */
+template<class T>
+struct SmallLayerKernels
+{
+	void (*ProcessInput)(const T*, T*, const T*, const T*);
+	void (*ProcessBatch)(const T*, T*, unsigned, const T*, const T*);
+};
+
+//Finds the kernels of the small layer with index N - 1, where index = (input - 1)*DynamicSmallSize + output - 1.
+//The search is unrolled at compile time and runs only while loading a net:
+template<class T, unsigned N>
+struct SmallLayerKernelSelector
+{
+	enum
+	{
+		InputSize = (N - 1)/DynamicSmallSize + 1,
+		OutputSize = (N - 1)%DynamicSmallSize + 1,
+		Stride = AlignedMatrix<InputSize, T>::AlignedRowSize
+	};
+
+	static bool Select(unsigned index, SmallLayerKernels<T>& rKernels)
+	{
+		if (index == N - 1)
+		{
+			rKernels.ProcessInput = &LayerKernels<true>::ProcessInput<T, InputSize, OutputSize, Stride>;
+			rKernels.ProcessBatch = &LayerKernels<true>::ProcessBatch<T, InputSize, OutputSize, Stride>;
+			return true;
+		}
+		return SmallLayerKernelSelector<T, N - 1>::Select(index, rKernels);
+	}
+};
+
+template<class T>
+struct SmallLayerKernelSelector<T, 0>
+{
+	static bool Select(unsigned index, SmallLayerKernels<T>& rKernels) { return false; }
+};
+
+/* A layer, which sizes are known only at runtime. Reads the format of Layer::WriteToFile. */
+template<class FloatingPoint>
+class DynamicLayer
+{
+protected:
+	unsigned		mInput;
+	unsigned		mOutput;
+	unsigned		mAlignedInput;
+	FloatingPoint*	mpWeights;//mOutput rows of mAlignedInput elements, as in AlignedMatrix
+	FloatingPoint*	mB;
+	FloatingPoint*	mC;
+	ActivationType	mActivation;
+	bool			mSmall;
+	SmallLayerKernels<FloatingPoint> mSmallKernels;
+private:
+	DynamicLayer(const DynamicLayer&){}//No copy
+public:
+	DynamicLayer(File& rFile, ActivationType activation)
+		:mpWeights(NULL), mB(NULL), mC(NULL), mActivation(activation), mSmall(false)
+	{
+		uint32_t input, output, floatingPointSize;
+		rFile.ReadOne(input);
+		rFile.ReadOne(output);
+		rFile.ReadOne(floatingPointSize);
+		if (!input || !output)
+			throw std::string("Empty layer");
+		if (floatingPointSize != sizeof(FloatingPoint))
+			throw std::string("Wrong floating point file");
+		mInput = input;
+		mOutput = output;
+		mAlignedInput = AVXAlign<FloatingPoint>(mInput);
+
+		mpWeights = (FloatingPoint*)_aligned_malloc(mOutput*mAlignedInput*sizeof(FloatingPoint), 32);
+		mB = (FloatingPoint*)_aligned_malloc(mOutput*sizeof(FloatingPoint), 32);
+		mC = (FloatingPoint*)_aligned_malloc(mInput*sizeof(FloatingPoint), 32);
+		try
+		{
+			if (!mpWeights || !mB || !mC)
+				throw std::string("Not enough memory for the layer");
+			//The weights are stored as AlignedMatrix::WriteToFile does:
+			rFile.ReadAndVerifySize(mOutput, "Wrong number of rows");
+			rFile.ReadAndVerifySize(sizeof(FloatingPoint), "Wrong floating point type");
+			rFile.ReadAndVerifySize(mInput, "Wrong row size");
+			for (unsigned i = 0; i < mOutput; ++i)
+			{
+				rFile.ReadMany(mpWeights + i*mAlignedInput, mInput);
+			}
+			rFile.ReadMany(mB, mOutput);
+			rFile.ReadMany(mC, mInput);
+		}
+		catch (...)
+		{
+			FreeMemory();
+			throw;
+		}
+
+		if (mInput <= DynamicSmallSize && mOutput <= DynamicSmallSize)
+		{
+			mSmall = SmallLayerKernelSelector<FloatingPoint, DynamicSmallSize*DynamicSmallSize>::Select(
+				(mInput - 1)*DynamicSmallSize + mOutput - 1, mSmallKernels);
+		}
+	}
+
+	~DynamicLayer()
+	{
+		FreeMemory();
+	}
+
+	unsigned Input() const { return mInput; }
+	unsigned Output() const { return mOutput; }
+	ActivationType GetActivation() const { return mActivation; }
+	void SetActivation(ActivationType activation) { mActivation = activation; }
+
+	/*IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ProcessInput(const FloatingPoint* input, FloatingPoint* output) const
+	{
+		if (mSmall)
+			mSmallKernels.ProcessInput(input, output, mpWeights, mB);
+		else
+			ProcessInputAVX(input, output, mInput, mOutput, mpWeights, mB);
+		ApplyActivation(mActivation, output, mOutput);
+	}
+
+	/* Processes "rowCount" consecutive samples, which rows are laid out as in AlignedMatrix.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ProcessBatch(const FloatingPoint* input, FloatingPoint* output, unsigned rowCount) const
+	{
+		if (mSmall)
+			mSmallKernels.ProcessBatch(input, output, rowCount, mpWeights, mB);
+		else
+			ProcessBatchAVX(input, output, rowCount, mInput, mOutput, mpWeights, mB);
+		const unsigned outputStride = AVXAlign<FloatingPoint>(mOutput);
+		for (unsigned i = 0; i < rowCount; ++i)
+		{
+			ApplyActivation(mActivation, output + i*outputStride, mOutput);
+		}
+	}
+
+protected:
+	void FreeMemory()
+	{
+		_aligned_free(mpWeights);
+		_aligned_free(mB);
+		_aligned_free(mC);
+	}
+};
+
+/* A network, which topology is read from a file at runtime, e.g. by a binary that was built before the
+model was trained. The file is the one written by Net::WriteToFile (the layers one after the other):
+	Net<167, Net<112, Net<9>>> n(InitializeForBackProp);
+	//... train the net
+	n.WriteToFile("model.bin");
+	//Potentially in another binary:
+	DynamicNet<> dynamic("model.bin");
+The file doesn't keep the activations. All layers use DefaultActivation, unless specified otherwise with
+SetActivation. The forward calculation uses the same kernels as Net: the AVX ones and the unrolled ones
+for layers of up to DynamicSmallSize inputs and outputs. */
+template<class FloatingPoint = double>
+class DynamicNet
+{
+public:
+	typedef FloatingPoint FloatingPointType;
+	//Number of rows that BatchProcessInput pushes through the network one layer at a time:
+	const static unsigned TileRows = 64;
+
+	/* Per-thread scratch memory of the forward calculation. Not thread safe, allocate one per thread. */
+	class Workspace
+	{
+	protected:
+		FloatingPoint* mpBuffer;
+		unsigned	   mScratchSize;
+	private:
+		Workspace(const Workspace&){}//No copy
+	public:
+		Workspace(const DynamicNet& net)
+		{
+			mScratchSize = TileRows*AVXAlign<FloatingPoint>(net.MaxHidden());
+			//A single layer net has no hidden outputs, and _aligned_malloc of 0 bytes may return NULL:
+			mpBuffer = (FloatingPoint*)_aligned_malloc((2*mScratchSize + 1)*sizeof(FloatingPoint), 32);
+			if (!mpBuffer)
+				throw std::string("Not enough memory for the workspace");
+		}
+		~Workspace() { _aligned_free(mpBuffer); }
+		FloatingPoint* GetScratch() { return mpBuffer; }
+		FloatingPoint* GetNextScratch() { return mpBuffer + mScratchSize; }
+	};
+protected:
+	std::vector<DynamicLayer<FloatingPoint>*> mLayers;
+	unsigned mMaxHidden;
+private:
+	DynamicNet(const DynamicNet&){}//No copy
+public:
+	DynamicNet(const char* szFile, ActivationType activation = DefaultActivation::Type)
+	{
+		File f(szFile, "rb");
+		ReadFromFile(f, activation);
+	}
+
+	DynamicNet(File& rFile, ActivationType activation = DefaultActivation::Type)
+	{
+		ReadFromFile(rFile, activation);
+	}
+
+	~DynamicNet()
+	{
+		Clear();
+	}
+
+	unsigned NumLayers() const { return (unsigned)mLayers.size(); }
+	unsigned Input() const { return mLayers.front()->Input(); }
+	unsigned Output() const { return mLayers.back()->Output(); }
+	//The widest hidden layer (the input and the output are not counted):
+	unsigned MaxHidden() const { return mMaxHidden; }
+
+	void SetActivation(unsigned layer, ActivationType activation)
+	{
+		if (layer >= mLayers.size())
+			throw std::string("layer parameter is too big");
+		mLayers[layer]->SetActivation(activation);
+	}
+
+	/* Forward calculation of a single sample. IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ProcessInput(const FloatingPoint* input, FloatingPoint* output, Workspace& rWorkspace) const
+	{
+		const FloatingPoint* pInput = input;
+		FloatingPoint* pScratch = rWorkspace.GetScratch();
+		FloatingPoint* pNextScratch = rWorkspace.GetNextScratch();
+		for (unsigned i = 0; i < mLayers.size(); ++i)
+		{
+			FloatingPoint* pOutput = (i + 1 == mLayers.size()) ? output : pScratch;
+			mLayers[i]->ProcessInput(pInput, pOutput);
+			pInput = pOutput;
+			std::swap(pScratch, pNextScratch);
+		}
+	}
+
+	/* Processes "rowCount" rows, laid out as in AlignedMatrix (e.g. AlignedMatrix<167>::GetBuffer()),
+	one tile of rows and one layer at a time. */
+	void BatchProcessInput(const FloatingPoint* input, FloatingPoint* output, unsigned rowCount) const
+	{
+		const unsigned inputStride = AVXAlign<FloatingPoint>(Input());
+		const unsigned outputStride = AVXAlign<FloatingPoint>(Output());
+		const int numTiles = (int)((rowCount + TileRows - 1)/TileRows);
+		double weights = 0;
+		for (unsigned i = 0; i < mLayers.size(); ++i)
+		{
+			weights += (double)mLayers[i]->Input()*mLayers[i]->Output();
+		}
+		const int threads = ParallelThreads(rowCount*weights, numTiles);
+		#pragma omp parallel num_threads(threads) if (threads > 1)
+		{
+			//Allocated once per thread:
+			Workspace workspace(*this);
+			#pragma omp for
+			for (int i = 0; i < numTiles; ++i)
+			{
+				unsigned startRow = i*TileRows;
+				unsigned tileRows = (rowCount - startRow < TileRows) ? rowCount - startRow : TileRows;
+				ProcessTile(input + startRow*inputStride, output + startRow*outputStride, tileRows, workspace);
+			}
+		}
+	}
+
+protected:
+	void ProcessTile(const FloatingPoint* input, FloatingPoint* output, unsigned rowCount, Workspace& rWorkspace) const
+	{
+		const FloatingPoint* pInput = input;
+		FloatingPoint* pScratch = rWorkspace.GetScratch();
+		FloatingPoint* pNextScratch = rWorkspace.GetNextScratch();
+		for (unsigned i = 0; i < mLayers.size(); ++i)
+		{
+			FloatingPoint* pOutput = (i + 1 == mLayers.size()) ? output : pScratch;
+			mLayers[i]->ProcessBatch(pInput, pOutput, rowCount);
+			pInput = pOutput;
+			std::swap(pScratch, pNextScratch);
+		}
+	}
+
+	void ReadFromFile(File& rFile, ActivationType activation)
+	{
+		try
+		{
+			while (!rFile.IsEnd())
+			{
+				mLayers.push_back(new DynamicLayer<FloatingPoint>(rFile, activation));
+			}
+			if (mLayers.empty())
+				throw std::string("No layers in the file");
+			mMaxHidden = 0;
+			for (unsigned i = 1; i < mLayers.size(); ++i)
+			{
+				if (mLayers[i]->Input() != mLayers[i - 1]->Output())
+					throw std::string("The layers in the file don't match");
+				if (mMaxHidden < mLayers[i]->Input())
+					mMaxHidden = mLayers[i]->Input();
+			}
+		}
+		catch (...)
+		{
+			Clear();
+			throw;
+		}
+	}
+
+	void Clear()
+	{
+		for (unsigned i = 0; i < mLayers.size(); ++i)
+		{
+			delete mLayers[i];
+		}
+		mLayers.clear();
+	}
+};
+
+}//FastNets namespace
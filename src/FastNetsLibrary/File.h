@@ -96,6 +96,16 @@ public:
 
 	FILE* GetFP(){ return mpFILE; }
 
+	//Whether everything in the file is already read:
+	bool IsEnd()
+	{
+		int c = fgetc(mpFILE);
+		if (c == EOF)
+			return true;
+		ungetc(c, mpFILE);
+		return false;
+	}
+
 protected:
 	void Write(const void* buffer, const unsigned elSize, const unsigned numElements)
 	{
@@ -2,62 +2,411 @@
 // Published under Apache 2.0 licence
 
 #include "stdafx.h"
-#include "FloatingPoint.h"
+#include "Kernels.h"
 #include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <intrin.h>
 
 //TODO: Add non-inline calculation methods here
 
 namespace FastNets
 {
 
-void ProcessInputAVX(const double* input, double* output, unsigned inputSize, unsigned outputSize, const double* weights, const double* bias)
+namespace
 {
-	unsigned alignedInputSize = AVXAlign<double>(inputSize);
-	for (int i = 0; i < (int)outputSize; ++i)
+	/* The parallel versions of the kernels, as chosen by the cost model (see ChooseParallelism). The single sample
+	kernels split the outputs in blocks of NeuronBlock rows, the batch ones the rows in blocks of SampleBlock. */
+	//A multiple of the 4 row blocks of the kernels, which also keeps the split outputs aligned:
+	const unsigned NeuronBlock = 16;
+	const unsigned SampleBlock = 8;
+
+	template<class T>
+	void ProcessInputParallel(void (*kernel)(const T*, T*, unsigned, unsigned, const T*, const T*), const T* input, T* output, 
+							  unsigned inputSize, unsigned outputSize, const T* weights, const T* bias)
+	{
+		const int blocks = (int)((outputSize + NeuronBlock - 1)/NeuronBlock);
+		const ParallelPlan plan = ChooseParallelism((double)inputSize*outputSize, 0, blocks);
+		if (plan.Strategy == ParallelSerial)
+		{
+			kernel(input, output, inputSize, outputSize, weights, bias);
+			return;
+		}
+		const unsigned inputStride = AVXAlign<T>(inputSize);
+		#pragma omp parallel for num_threads(plan.Threads)
+		for (int b = 0; b < blocks; ++b)
+		{
+			const unsigned first = b*NeuronBlock;
+			const unsigned count = (outputSize - first < NeuronBlock) ? outputSize - first : NeuronBlock;
+			kernel(input, output + first, inputSize, count, weights + first*inputStride, bias ? bias + first : NULL);
+		}
+	}
+
+	//The input deltas split the columns of the weights in blocks of ColumnBlock. A multiple of the 4 vector blocks of the kernel:
+	const unsigned ColumnBlock = 64;
+
+	template<class T>
+	void InputDeltasParallel(void (*kernel)(const T*, T*, unsigned, unsigned, const T*, unsigned), const T* outputDelta, T* inputDelta,
+							 unsigned inputSize, unsigned outputSize, const T* weights)
+	{
+		const unsigned stride = AVXAlign<T>(inputSize);
+		const int blocks = (int)((inputSize + ColumnBlock - 1)/ColumnBlock);
+		const ParallelPlan plan = ChooseParallelism((double)inputSize*outputSize, 0, blocks);
+		if (plan.Strategy == ParallelSerial)
+		{
+			kernel(outputDelta, inputDelta, inputSize, outputSize, weights, stride);
+			return;
+		}
+		#pragma omp parallel for num_threads(plan.Threads)
+		for (int b = 0; b < blocks; ++b)
+		{
+			const unsigned first = b*ColumnBlock;
+			const unsigned count = (inputSize - first < ColumnBlock) ? inputSize - first : ColumnBlock;
+			kernel(outputDelta, inputDelta + first, count, outputSize, weights + first, stride);
+		}
+	}
+
+	template<class T>
+	void ProcessBatchParallel(void (*kernel)(const T*, T*, unsigned, unsigned, unsigned, const T*, const T*), const T* input, T* output,
+							  unsigned rowCount, unsigned inputSize, unsigned outputSize, const T* weights, const T* bias)
+	{
+		const int blocks = (int)((rowCount + SampleBlock - 1)/SampleBlock);
+		const ParallelPlan plan = ChooseParallelism((double)rowCount*inputSize*outputSize, blocks, 0);
+		if (plan.Strategy == ParallelSerial)
+		{
+			kernel(input, output, rowCount, inputSize, outputSize, weights, bias);
+			return;
+		}
+		const unsigned inputStride = AVXAlign<T>(inputSize);
+		const unsigned outputStride = AVXAlign<T>(outputSize);
+		#pragma omp parallel for num_threads(plan.Threads)
+		for (int b = 0; b < blocks; ++b)
+		{
+			const unsigned first = b*SampleBlock;
+			const unsigned count = (rowCount - first < SampleBlock) ? rowCount - first : SampleBlock;
+			kernel(input + first*inputStride, output + first*outputStride, count, inputSize, outputSize, weights, bias);
+		}
+	}
+
+	//The state of the outputs from "first" on:
+	template<class T>
+	OptimizerState<T> OffsetState(const OptimizerState<T>& state, unsigned first, unsigned inputStride)
+	{
+		OptimizerState<T> result = 
+		{
+			state.Velocity ? state.Velocity + first*inputStride : NULL,
+			state.Squares ? state.Squares + first*inputStride : NULL,
+			state.BiasVelocity ? state.BiasVelocity + first : NULL,
+			state.BiasSquares ? state.BiasSquares + first : NULL
+		};
+		return result;
+	}
+
+	template<class T>
+	void UpdateWeightsParallel(void (*kernel)(const T*, const T*, unsigned, unsigned, T*, T*, const OptimizerState<T>&, const Optimizer&, double),
+							   const T* input, const T* outputDelta, unsigned inputSize, unsigned outputSize, T* weights, T* bias,
+							   const OptimizerState<T>& state, const Optimizer& optimizer, double learningRate)
+	{
+		const int blocks = (int)((outputSize + NeuronBlock - 1)/NeuronBlock);
+		const ParallelPlan plan = ChooseParallelism((double)inputSize*outputSize, 0, blocks);
+		if (plan.Strategy == ParallelSerial)
+		{
+			kernel(input, outputDelta, inputSize, outputSize, weights, bias, state, optimizer, learningRate);
+			return;
+		}
+		const unsigned inputStride = AVXAlign<T>(inputSize);
+		#pragma omp parallel for num_threads(plan.Threads)
+		for (int b = 0; b < blocks; ++b)
+		{
+			const unsigned first = b*NeuronBlock;
+			const unsigned count = (outputSize - first < NeuronBlock) ? outputSize - first : NeuronBlock;
+			kernel(input, outputDelta + first, inputSize, count, weights + first*inputStride, bias + first, 
+				   OffsetState(state, first, inputStride), optimizer, learningRate);
+		}
+	}
+
+	//The active kernels. SSE2 (what the project is compiled for) until the CPU detection below runs. Both are dynamic
+	//initializations, in this order, before main:
+	KernelTier	sKernelTier = KernelSSE2;
+	KernelTable	sKernels = MakeKernels<Simd::SSE2Double, Simd::SSE2Float, Int8Scalar, PhiloxSSE2>();
+
+	inline void StoreUniform(unsigned word, double* value) { *value = PhiloxUniform(word); }
+	inline void StoreUniform(unsigned word, float* value) { *value = PhiloxUniformFloat(word); }
+
+	//The SIMD kernel generates the full groups of blocks, the rest are scalar:
+	template<class T>
+	void GenerateUniformParallel(unsigned (*kernel)(const unsigned*, const unsigned*, T*, unsigned), const unsigned* key, const unsigned* counter, 
+								 T* values, unsigned count)
 	{
-		const double* pWeights = &weights[i*alignedInputSize];
-		const double* pInput = input;
-		unsigned size8 = inputSize/8;
-		register __m256d res = _mm256_set_pd(bias[i], 0, 0, 0);
+		const unsigned countGroups = kernel(key, counter, values, count);
+		unsigned block[PhiloxCounterWords];
+		unsigned blockCounter[PhiloxCounterWords] = { counter[0] + countGroups/PhiloxCounterWords, counter[1], counter[2], counter[3] };
+		for (unsigned i = countGroups; i < count; ++i)
+		{
+			if (i % PhiloxCounterWords == 0)
+			{
+				PhiloxBlock(blockCounter, key, block);
+				++blockCounter[0];
+			}
+			StoreUniform(block[i % PhiloxCounterWords], values + i);
+		}
+	}
 
-		for (unsigned j = 0; j < size8; ++j)
+	KernelTier DetectKernelTier()
+	{
+		int info[4];
+		__cpuid(info, 0);
+		const int maxLeaf = info[0];
+		__cpuid(info, 1);
+		const bool fma = (info[2] & (1 << 12)) != 0;
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool avx = (info[2] & (1 << 28)) != 0;
+		//The OS has to save the YMM (and ZMM) registers on context switches:
+		const unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		const bool osAVX = (xcr0 & 0x6) == 0x6;
+		const bool osAVX512 = (xcr0 & 0xE6) == 0xE6;
+		bool avx2 = false, avx512 = false;
+		if (maxLeaf >= 7)
 		{
-			register __m256d m4d1 = _mm256_load_pd(pInput);
-			register __m256d m4d2 = _mm256_load_pd(pInput + 4);
-			register __m256d weights1 = _mm256_load_pd(pWeights);
-			register __m256d weights2 = _mm256_load_pd(&pWeights[4]);
-			m4d1 = _mm256_mul_pd(m4d1, weights1);
-			m4d2 = _mm256_mul_pd(m4d2, weights2);
-			res = _mm256_add_pd(res, m4d1);
-			res = _mm256_add_pd(res, m4d2);
-			pWeights += 8;
-			pInput += 8;
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+			avx512 = (info[1] & (1 << 16)) != 0;
 		}
 
-		res = _mm256_hadd_pd(res, res);//{r0 + r1, r0 + r1, r2 + r3, r2 + r3}
-		register __m256d tmp = _mm256_permute2f128_pd(res, res, 1);//{r2 + r3, r2 + r3, r0 + r1, r0 + r1}
-		res = _mm256_add_pd(res, tmp);//{r0 + r1 + r2 + r3, ....}
-		double result = res.m256d_f64[0];
-		//Now deal with the rest:
-		unsigned reminder = inputSize % 8;
-		for (unsigned j = 0; j < reminder; ++j)
+		if (!avx || !osAVX)
+			return KernelSSE2;
+		if (!avx2 || !fma)
+			return KernelAVX;
+#ifdef FASTNETS_AVX512
+		if (avx512 && osAVX512)
+			return KernelAVX512;
+#endif
+		return KernelAVX2FMA;
+	}
+
+	bool ParseKernelTier(const char* szName, KernelTier& tier)
+	{
+		for (int i = KernelSSE2; i <= KernelAVX512; ++i)
 		{
-			result += (*(pWeights++))*(*(pInput++));
+			if (!_stricmp(szName, KernelTierName((KernelTier)i)))
+			{
+				tier = (KernelTier)i;
+				return true;
+			}
 		}
-		output[i] = OutputFunction(result);
+		return false;
 	}
+
+	const KernelTier sSupportedKernelTier = DetectKernelTier();
+
+	//Runs once at startup:
+	bool InitializeKernels()
+	{
+		KernelTier tier = sSupportedKernelTier;
+		char* szOverride = NULL;
+		size_t length = 0;
+		if (!_dupenv_s(&szOverride, &length, "FASTNETS_KERNEL_TIER") && szOverride)
+		{
+			KernelTier requested;
+			if (!ParseKernelTier(szOverride, requested))
+				fprintf(stderr, "FASTNETS_KERNEL_TIER: Unknown tier %s. Using %s.\n", szOverride, KernelTierName(tier));
+			else if (requested > sSupportedKernelTier)
+				fprintf(stderr, "FASTNETS_KERNEL_TIER: %s is not supported. Using %s.\n", szOverride, KernelTierName(tier));
+			else
+				tier = requested;
+			free(szOverride);
+		}
+		SetKernelTier(tier);
+		return true;
+	}
+
+	const bool sKernelsInitialized = InitializeKernels();
 }
 
-double CalculateOutputError(const double* actualOutput, const double* expectedOutput, unsigned outputNum)
+const char* KernelTierName(KernelTier tier)
 {
-	double squaresSum = 0;
-	for (unsigned j = 0; j < outputNum; ++j)
+	switch (tier)
 	{
-		double delta = expectedOutput[j] - actualOutput[j];
-		squaresSum += delta*delta;
+	case KernelSSE2:	return "SSE2";
+	case KernelAVX:		return "AVX";
+	case KernelAVX2FMA:	return "AVX2";
+	case KernelAVX512:	return "AVX512";
 	}
-	squaresSum /= outputNum;
-	return squaresSum;
+	return "Unknown";
+}
+
+KernelTier GetSupportedKernelTier()
+{
+	return sSupportedKernelTier;
+}
+
+KernelTier GetKernelTier()
+{
+	return sKernelTier;
+}
+
+void SetKernelTier(KernelTier tier)
+{
+	if (tier > sSupportedKernelTier)
+		throw std::string("The kernel tier is not supported: ") + KernelTierName(tier);
+	if (tier == KernelSSE2)
+		sKernels = MakeKernels<Simd::SSE2Double, Simd::SSE2Float, Int8Scalar, PhiloxSSE2>();
+	else if (!MakeAVXKernels(tier, sKernels))
+		throw std::string("Unknown kernel tier");
+	sKernelTier = tier;
+}
+
+void ProcessInputAVX(const double* input, double* output, unsigned inputSize, unsigned outputSize, const double* weights, const double* bias)
+{
+	ProcessInputParallel(sKernels.DoubleForward.ProcessInput, input, output, inputSize, outputSize, weights, bias);
+}
+
+void ProcessInputAVX(const float* input, float* output, unsigned inputSize, unsigned outputSize, const float* weights, const float* bias)
+{
+	ProcessInputParallel(sKernels.FloatForward.ProcessInput, input, output, inputSize, outputSize, weights, bias);
+}
+
+void ProcessBatchAVX(const double* input, double* output, unsigned rowCount, unsigned inputSize, unsigned outputSize, const double* weights, const double* bias)
+{
+	ProcessBatchParallel(sKernels.DoubleForward.ProcessBatch, input, output, rowCount, inputSize, outputSize, weights, bias);
+}
+
+void ProcessBatchAVX(const float* input, float* output, unsigned rowCount, unsigned inputSize, unsigned outputSize, const float* weights, const float* bias)
+{
+	ProcessBatchParallel(sKernels.FloatForward.ProcessBatch, input, output, rowCount, inputSize, outputSize, weights, bias);
+}
+
+void ApplyActivation(ActivationType activation, double* values, unsigned count)
+{
+	sKernels.DoubleActivation.Apply[activation](values, count);
+}
+
+void ApplyActivation(ActivationType activation, float* values, unsigned count)
+{
+	sKernels.FloatActivation.Apply[activation](values, count);
+}
+
+void ApplyActivationDerivative(ActivationType activation, const double* outputs, double* deltas, unsigned count)
+{
+	sKernels.DoubleActivation.ApplyDerivative[activation](outputs, deltas, count);
+}
+
+void ApplyActivationDerivative(ActivationType activation, const float* outputs, float* deltas, unsigned count)
+{
+	sKernels.FloatActivation.ApplyDerivative[activation](outputs, deltas, count);
+}
+
+void ApplyExp(double* values, unsigned count)
+{
+	sKernels.DoubleActivation.Exp(values, count);
+}
+
+void ApplyExp(float* values, unsigned count)
+{
+	sKernels.FloatActivation.Exp(values, count);
+}
+
+void Crossover(const double* first, const double* second, double* target, unsigned count, const unsigned long long* masks)
+{
+	sKernels.DoubleCrossover(first, second, target, count, masks);
+}
+
+void Crossover(const float* first, const float* second, float* target, unsigned count, const unsigned long long* masks)
+{
+	sKernels.FloatCrossover(first, second, target, count, masks);
+}
+
+void GenerateUniform(const unsigned* key, const unsigned* counter, double* values, unsigned count)
+{
+	GenerateUniformParallel(sKernels.DoubleUniform, key, counter, values, count);
+}
+
+void GenerateUniform(const unsigned* key, const unsigned* counter, float* values, unsigned count)
+{
+	GenerateUniformParallel(sKernels.FloatUniform, key, counter, values, count);
+}
+
+void BackPropagateDeltas(const double* outputDelta, double* inputDelta, unsigned inputSize, unsigned outputSize, const double* reverseWeights)
+{
+	//With the transposed weights the deltas are the same dot products as the forward pass, without the bias:
+	ProcessInputParallel(sKernels.DoubleForward.ProcessInput, outputDelta, inputDelta, outputSize, inputSize, reverseWeights, (const double*)NULL);
+}
+
+void BackPropagateDeltas(const float* outputDelta, float* inputDelta, unsigned inputSize, unsigned outputSize, const float* reverseWeights)
+{
+	//With the transposed weights the deltas are the same dot products as the forward pass, without the bias:
+	ProcessInputParallel(sKernels.FloatForward.ProcessInput, outputDelta, inputDelta, outputSize, inputSize, reverseWeights, (const float*)NULL);
+}
+
+void BackPropagateDeltasByRows(const double* outputDelta, double* inputDelta, unsigned inputSize, unsigned outputSize, const double* weights)
+{
+	InputDeltasParallel(sKernels.DoubleBackward.InputDeltas, outputDelta, inputDelta, inputSize, outputSize, weights);
+}
+
+void BackPropagateDeltasByRows(const float* outputDelta, float* inputDelta, unsigned inputSize, unsigned outputSize, const float* weights)
+{
+	InputDeltasParallel(sKernels.FloatBackward.InputDeltas, outputDelta, inputDelta, inputSize, outputSize, weights);
+}
+
+void UpdateWeights(const double* input, const double* outputDelta, unsigned inputSize, unsigned outputSize, double* weights, double* bias,
+				   const OptimizerState<double>& state, const Optimizer& optimizer, double learningRate)
+{
+	UpdateWeightsParallel(sKernels.DoubleOptimizer.UpdateWeights[optimizer.Type], input, outputDelta, inputSize, outputSize, weights, bias, state, optimizer, learningRate);
+}
+
+void UpdateWeights(const float* input, const float* outputDelta, unsigned inputSize, unsigned outputSize, float* weights, float* bias,
+				   const OptimizerState<float>& state, const Optimizer& optimizer, double learningRate)
+{
+	UpdateWeightsParallel(sKernels.FloatOptimizer.UpdateWeights[optimizer.Type], input, outputDelta, inputSize, outputSize, weights, bias, state, optimizer, learningRate);
+}
+
+void ApplyGradients(const float* gradients, const float* biasGradients, unsigned inputSize, unsigned outputSize, double* weights, double* bias,
+					const OptimizerState<double>& state, const Optimizer& optimizer, double learningRate, float* floatWeights, float* floatBias)
+{
+	const int threads = ChooseParallelism((double)outputSize*inputSize, 0, outputSize).Threads;
+	sKernels.MixedPrecision.ApplyGradients[optimizer.Type](gradients, biasGradients, inputSize, outputSize, weights, bias, state, optimizer, learningRate, 
+												   floatWeights, floatBias, threads);
+}
+
+double CalculateOutputDeltas(const double* output, const double* expected, double* deltas, unsigned count)
+{
+	return sKernels.DoubleBackward.OutputDeltas(output, expected, deltas, count);
+}
+
+double CalculateOutputDeltas(const float* output, const float* expected, float* deltas, unsigned count)
+{
+	return sKernels.FloatBackward.OutputDeltas(output, expected, deltas, count);
+}
+
+void UpdateWeightsBatch(const double* input, const double* outputDelta, unsigned rowCount, unsigned inputSize, unsigned outputSize,
+						double* weights, double* bias, const OptimizerState<double>& state, const Optimizer& optimizer, double learningRate)
+{
+	const int threads = ChooseParallelism((double)outputSize*inputSize*rowCount, 0, outputSize).Threads;
+	sKernels.DoubleOptimizer.UpdateWeightsBatch[optimizer.Type](input, outputDelta, rowCount, inputSize, outputSize, weights, bias, state, optimizer, learningRate,
+														  threads);
+}
+
+void UpdateWeightsBatch(const float* input, const float* outputDelta, unsigned rowCount, unsigned inputSize, unsigned outputSize,
+						float* weights, float* bias, const OptimizerState<float>& state, const Optimizer& optimizer, double learningRate)
+{
+	const int threads = ChooseParallelism((double)outputSize*inputSize*rowCount, 0, outputSize).Threads;
+	sKernels.FloatOptimizer.UpdateWeightsBatch[optimizer.Type](input, outputDelta, rowCount, inputSize, outputSize, weights, bias, state, optimizer, learningRate,
+														  threads);
+}
+
+void ProcessInputInt8(const unsigned char* input, int* output, unsigned alignedInputSize, unsigned outputSize, const signed char* weights)
+{
+	sKernels.Int8DotProducts(input, output, alignedInputSize, outputSize, weights);
+}
+
+double CalculateOutputError(const double* actualOutput, const double* expectedOutput, unsigned outputNum)
+{
+	return OutputError(actualOutput, expectedOutput, outputNum);
+}
+
+double CalculateOutputError(const float* actualOutput, const float* expectedOutput, unsigned outputNum)
+{
+	return OutputError(actualOutput, expectedOutput, outputNum);
 }
 
 
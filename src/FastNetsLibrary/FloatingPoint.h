@@ -3,9 +3,7 @@
 #pragma once
 #include <string>
 #include <sstream>
-
-//#define TANH_OUTPUT
-#define SIGMOID_OUTPUT
+#include "Parallelism.h"
 
 namespace FastNets
 {
@@ -34,41 +32,54 @@ namespace FastNets
 
 	//Calculate the errors of a single output. TODO: Optimize with AVX
 	double CalculateOutputError(const double* actualOutput, const double* expectedOutput, unsigned outputNum);
+	double CalculateOutputError(const float* actualOutput, const float* expectedOutput, unsigned outputNum);
 
-#ifdef TANH_OUTPUT
-	template <class T>
-	inline static T OutputFunction(T input)
-	{
-		//Hyperbolic tangent:
-		return 1 - (2.0 / (1.0 + exp(2*input)));
-	}
-
-	/* calculates the derivative as a function of the regular output */
-	template <class T>
-	inline static T DerivativeFunction(T output)
+	/* The activation functions of the layers (see Activation.h for the template policies).
+	Softmax normalizes the whole output vector and is meant for the last layer. */
+	enum ActivationType
 	{
-		return (1 - output)*(1 + output);
-	}
+		ActivationIdentity,
+		ActivationReLU,
+		ActivationLeakyReLU,
+		ActivationSigmoid,
+		ActivationTanh,
+		ActivationSoftmax,
+		ActivationCount
+	};
 
-#elif defined(SIGMOID_OUTPUT)
+	//The slope of the leaky ReLU for negative inputs:
+	const double LeakyReLUSlope = 0.01;
 
-		template <class T>
-	inline static T OutputFunction(T input)
+	/* The update rules of the back propagation (see Optimizer.h for the defaults of the parameters). */
+	enum OptimizerType
 	{
-		//Hyperbolic tangent:
-		return 1/(1 + exp(-input));
-	}
+		OptimizerSGD,
+		OptimizerMomentum,
+		OptimizerNesterov,
+		OptimizerRMSProp,
+		OptimizerAdam,
+		OptimizerCount
+	};
 
-	/* calculates the derivative as a function of the regular output */
-	template <class T>
-	inline static T DerivativeFunction(T output)
+	struct Optimizer
 	{
-		return output*(1-output);
-	}
+		OptimizerType Type;
+		double Momentum;//Momentum and Nesterov: the fraction of the previous change. Adam: the decay of the mean gradients
+		double Decay;//RMSProp and Adam: the decay of the mean squares of the gradients
+		double Epsilon;//RMSProp and Adam: added to the root mean squares, so that they are never 0
+	};
 
-#else
-	#error Please add other output methods here
-#endif
+	/* The per-weight state of an optimizer. The buffers have the layouts of the weights and the biases.
+	"Velocity" is the last change (Momentum, Nesterov) or the mean gradient (Adam). "Squares" is the mean
+	square of the gradients (RMSProp, Adam). The buffers, which the optimizer doesn't use, can be NULL. */
+	template<class T>
+	struct OptimizerState
+	{
+		T* Velocity;
+		T* Squares;
+		T* BiasVelocity;
+		T* BiasSquares;
+	};
 
 //Given an integer, returns the closest >= one that is 32 byte aligned.
 #define AVXAlignBytes(X) ((X + 31) & ~31);
@@ -93,6 +104,279 @@ namespace FastNets
 		}
 	}
 
-	/* Calculates the output of a layer. */
+	/* The instruction sets of the SIMD kernels below. By default the best one supported by the CPU
+	is used. The environment variable FASTNETS_KERNEL_TIER (SSE2, AVX, AVX2 or AVX512) overrides it at startup. */
+	enum KernelTier
+	{
+		KernelSSE2,
+		KernelAVX,
+		KernelAVX2FMA,
+		KernelAVX512,
+	};
+
+	//The best tier supported by both the CPU and the compiler. CPUID is checked only once, at startup.
+	KernelTier GetSupportedKernelTier();
+	KernelTier GetKernelTier();
+	//Forces the kernels of a given tier, e.g. for benchmarking. Throws if the tier is not supported.
+	//Not thread safe, call it before starting any calculations.
+	void SetKernelTier(KernelTier tier);
+	const char* KernelTierName(KernelTier tier);
+
+	/* Calculates the weighted sums of a layer (the activation is applied separately, see ApplyActivation).
+	All the "AVX" kernels below dispatch to the active KernelTier. */
 	void ProcessInputAVX(const double* input, double* output, unsigned inputSize, unsigned outputSize, const double* weights, const double* bias);
+	void ProcessInputAVX(const float* input, float* output, unsigned inputSize, unsigned outputSize, const float* weights, const float* bias);
+
+	/* Calculates the weighted sums of a layer for "rowCount" consecutive samples at once. Both "input" and "output"
+	are row-major with 32 byte aligned rows (the layout of AlignedMatrix). The weights are loaded once per
+	block of samples instead of once per sample. */
+	void ProcessBatchAVX(const double* input, double* output, unsigned rowCount, unsigned inputSize, unsigned outputSize, const double* weights, const double* bias);
+	void ProcessBatchAVX(const float* input, float* output, unsigned rowCount, unsigned inputSize, unsigned outputSize, const float* weights, const float* bias);
+
+	/* Compile-time unrolled kernels for small layers (e.g. the XOR nets), where the loop setup, the tails and
+	the horizontal sums of the AVX kernels cost more than the calculation itself. */
+	//Layers with up to that many weights use the unrolled kernels:
+	const unsigned UnrolledLayerWeights = 64;
+
+	//Dot product of N elements. The recursion is resolved at compile time:
+	template<class T, unsigned N>
+	struct UnrolledDot
+	{
+		static T Calculate(const T* input, const T* weights)
+		{
+			return UnrolledDot<T, N - 1>::Calculate(input, weights) + input[N - 1]*weights[N - 1];
+		}
+	};
+
+	template<class T>
+	struct UnrolledDot<T, 1>
+	{
+		static T Calculate(const T* input, const T* weights) { return input[0]*weights[0]; }
+	};
+
+	//Calculates the weighted sums of the first ROWS outputs. The rows of weights are STRIDE elements apart:
+	template<class T, unsigned INPUT, unsigned STRIDE, unsigned ROWS>
+	struct UnrolledLayer
+	{
+		static void ProcessInput(const T* input, T* output, const T* weights, const T* bias)
+		{
+			UnrolledLayer<T, INPUT, STRIDE, ROWS - 1>::ProcessInput(input, output, weights, bias);
+			output[ROWS - 1] = bias[ROWS - 1] + UnrolledDot<T, INPUT>::Calculate(input, weights + (ROWS - 1)*STRIDE);
+		}
+	};
+
+	template<class T, unsigned INPUT, unsigned STRIDE>
+	struct UnrolledLayer<T, INPUT, STRIDE, 0>
+	{
+		static void ProcessInput(const T* input, T* output, const T* weights, const T* bias){}
+	};
+
+	/* Selects between the unrolled and the AVX kernels at compile time. The unrolled templates are
+	instantiated only for the small layers. "STRIDE" is the aligned row size of the weights. */
+	template<bool UNROLLED>
+	struct LayerKernels
+	{
+		template<class T, unsigned INPUT, unsigned OUTPUT, unsigned STRIDE>
+		static void ProcessInput(const T* input, T* output, const T* weights, const T* bias)
+		{
+			UnrolledLayer<T, INPUT, STRIDE, OUTPUT>::ProcessInput(input, output, weights, bias);
+		}
+
+		template<class T, unsigned INPUT, unsigned OUTPUT, unsigned STRIDE>
+		static void ProcessBatch(const T* input, T* output, unsigned rowCount, const T* weights, const T* bias)
+		{
+			//Local copies, so that the compiler can keep them in registers for all the rows:
+			T localWeights[INPUT*OUTPUT];
+			T localBias[OUTPUT];
+			for (unsigned i = 0; i < OUTPUT; ++i)
+			{
+				for (unsigned j = 0; j < INPUT; ++j)
+				{
+					localWeights[i*INPUT + j] = weights[i*STRIDE + j];
+				}
+				localBias[i] = bias[i];
+			}
+			const unsigned inputStride = AVXAlign<T>(INPUT);
+			const unsigned outputStride = AVXAlign<T>(OUTPUT);
+			for (unsigned i = 0; i < rowCount; ++i)
+			{
+				UnrolledLayer<T, INPUT, INPUT, OUTPUT>::ProcessInput(input + i*inputStride, output + i*outputStride, localWeights, localBias);
+			}
+		}
+	};
+
+	template<>
+	struct LayerKernels<false>
+	{
+		template<class T, unsigned INPUT, unsigned OUTPUT, unsigned STRIDE>
+		static void ProcessInput(const T* input, T* output, const T* weights, const T* bias)
+		{
+			ProcessInputAVX(input, output, INPUT, OUTPUT, weights, bias);
+		}
+
+		template<class T, unsigned INPUT, unsigned OUTPUT, unsigned STRIDE>
+		static void ProcessBatch(const T* input, T* output, unsigned rowCount, const T* weights, const T* bias)
+		{
+			ProcessBatchAVX(input, output, rowCount, INPUT, OUTPUT, weights, bias);
+		}
+	};
+
+	/* Calculates the dot products of a quantized input with each of the "outputSize" int8 weight rows (see Quantized.h).
+	The input values are 0..127. "alignedInputSize" is a multiple of 32 and the padding of both the input and the 
+	weights is 0. Uses _mm256_maddubs_epi16 and _mm256_madd_epi16 on AVX2. IMPORTANT: requires _CRT_ALIGN(32) pointers */
+	void ProcessInputInt8(const unsigned char* input, int* output, unsigned alignedInputSize, unsigned outputSize, const signed char* weights);
+
+	/* Turns "count" weighted sums into outputs in place, a SIMD vector at a time. The exp is approximated
+	with a polynomial, see Simd::Exp for the errors. IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ApplyActivation(ActivationType activation, double* values, unsigned count);
+	void ApplyActivation(ActivationType activation, float* values, unsigned count);
+
+	/* Turns the deltas of the outputs into deltas of the weighted sums, using the derivative of the
+	activation as a function of the outputs. IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ApplyActivationDerivative(ActivationType activation, const double* outputs, double* deltas, unsigned count);
+	void ApplyActivationDerivative(ActivationType activation, const float* outputs, float* deltas, unsigned count);
+
+	/* exp of "count" values in place, with the same polynomial as the activations (see Simd::Exp for the errors).
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ApplyExp(double* values, unsigned count);
+	void ApplyExp(float* values, unsigned count);
+
+	/* The crossover of the genetic algorithms: target[j] is second[j] if bit j of the "masks" (bit j%64 of masks[j/64])
+	is set and first[j] otherwise, a SIMD blend at a time. IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void Crossover(const double* first, const double* second, double* target, unsigned count, const unsigned long long* masks);
+	void Crossover(const float* first, const float* second, float* target, unsigned count, const unsigned long long* masks);
+
+	/* The counter-based Philox4x32-10 generator (Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"): 10
+	rounds of multiplications and xors of a 128 bit counter with a 64 bit key give 4 random 32 bit words. There is no
+	state besides the counter, so any block of a stream can be generated on its own (see Randomizer). */
+	const unsigned PhiloxCounterWords = 4;
+	const unsigned PhiloxRounds = 10;
+	const unsigned PhiloxMultiplier0 = 0xD2511F53;
+	const unsigned PhiloxMultiplier1 = 0xCD9E8D57;
+	const unsigned PhiloxWeyl0 = 0x9E3779B9;
+	const unsigned PhiloxWeyl1 = 0xBB67AE85;
+
+	//The scalar version of the SIMD kernels behind GenerateUniform:
+	inline void PhiloxBlock(const unsigned* counter, const unsigned* key, unsigned* result)
+	{
+		unsigned c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+		unsigned k0 = key[0], k1 = key[1];
+		for (unsigned round = 0; round < PhiloxRounds; ++round)
+		{
+			const unsigned long long product0 = (unsigned long long)PhiloxMultiplier0*c0;
+			const unsigned long long product1 = (unsigned long long)PhiloxMultiplier1*c2;
+			c0 = (unsigned)(product1 >> 32) ^ c1 ^ k0;
+			c1 = (unsigned)product1;
+			c2 = (unsigned)(product0 >> 32) ^ c3 ^ k1;
+			c3 = (unsigned)product0;
+			k0 += PhiloxWeyl0;
+			k1 += PhiloxWeyl1;
+		}
+		result[0] = c0;
+		result[1] = c1;
+		result[2] = c2;
+		result[3] = c3;
+	}
+
+	//A random word as a uniform number in (0, 1). All the 32 bits are used for double and the top 23 for float, so both are exact:
+	inline double PhiloxUniform(unsigned word) { return (word + 0.5)*(1.0/4294967296.0); }
+	inline float PhiloxUniformFloat(unsigned word) { return ((float)(word >> 9) + 0.5f)*(1.0f/8388608.0f); }
+
+	//The blocks of 4 words, which "count" numbers take:
+	inline unsigned PhiloxBlocks(unsigned count) { return (count + PhiloxCounterWords - 1)/PhiloxCounterWords; }
+
+	/* Fills "values" with "count" uniform numbers in (0, 1) (see PhiloxUniform) from the Philox blocks of the "counter",
+	"counter" + 1, ... (only the first word is incremented) and the "key". values[i] is word i%4 of block i/4, the last
+	block may be used partly. The SIMD kernels run 4 or 8 blocks at a time in the lanes of the integer vectors and give
+	the same numbers as PhiloxBlock on all the tiers. The pointers don't need to be aligned. */
+	void GenerateUniform(const unsigned* key, const unsigned* counter, double* values, unsigned count);
+	void GenerateUniform(const unsigned* key, const unsigned* counter, float* values, unsigned count);
+
+	/* Transposes the columns [columnBegin, columnEnd) of a (rows x columns) matrix, which rows are "sourceStride"
+	elements apart, into rows of a (columns x rows) one with "targetStride". Walks both matrices in blocks, so that
+	neither is read with a cache-missing stride. The padding at the end of the target rows is set to 0. */
+	template <class T>
+	void TransposeColumns(const T* source, T* target, unsigned rows, unsigned columnBegin, unsigned columnEnd, 
+						  unsigned sourceStride, unsigned targetStride)
+	{
+		const unsigned Block = 16;
+		for (unsigned rowBlock = 0; rowBlock < rows; rowBlock += Block)
+		{
+			const unsigned rowEnd = (rowBlock + Block < rows) ? rowBlock + Block : rows;
+			for (unsigned i = columnBegin; i < columnEnd; ++i)
+			{
+				T* pTarget = target + i*targetStride;
+				for (unsigned j = rowBlock; j < rowEnd; ++j)
+				{
+					pTarget[j] = source[j*sourceStride + i];
+				}
+			}
+		}
+		for (unsigned i = columnBegin; i < columnEnd; ++i)
+		{
+			for (unsigned j = rows; j < targetStride; ++j)
+			{
+				target[i*targetStride + j] = 0;
+			}
+		}
+	}
+
+	template <class T>
+	void TransposeMatrix(const T* source, T* target, unsigned rows, unsigned columns, unsigned sourceStride, unsigned targetStride)
+	{
+		const int Block = 16;
+		//Small layers (e.g. in the XOR nets) are transposed faster than the threads start:
+		const int threads = ParallelThreads((double)rows*columns, (columns + Block - 1)/Block);
+		if (threads < 2)
+		{
+			TransposeColumns(source, target, rows, 0, columns, sourceStride, targetStride);
+			return;
+		}
+		#pragma omp parallel for num_threads(threads)
+		for (int columnBlock = 0; columnBlock < (int)columns; columnBlock += Block)
+		{
+			const unsigned columnEnd = (columnBlock + Block < (int)columns) ? columnBlock + Block : columns;
+			TransposeColumns(source, target, rows, columnBlock, columnEnd, sourceStride, targetStride);
+		}
+	}
+
+	/* Calculates the deltas of the input of a layer from the deltas of its weighted sums. "reverseWeights" is
+	the transposed (INPUT x aligned OUTPUT) matrix of the layer, so that each delta is a contiguous dot product.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void BackPropagateDeltas(const double* outputDelta, double* inputDelta, unsigned inputSize, unsigned outputSize, const double* reverseWeights);
+	void BackPropagateDeltas(const float* outputDelta, float* inputDelta, unsigned inputSize, unsigned outputSize, const float* reverseWeights);
+
+	/* Same as above, but from the (OUTPUT x aligned INPUT) weights of the layer: the input deltas are the sum of the rows
+	of the weights, scaled by the output deltas. Saves the transposition, when the weights change after every sample.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void BackPropagateDeltasByRows(const double* outputDelta, double* inputDelta, unsigned inputSize, unsigned outputSize, const double* weights);
+	void BackPropagateDeltasByRows(const float* outputDelta, float* inputDelta, unsigned inputSize, unsigned outputSize, const float* weights);
+
+	/* Updates the weights and the biases of a layer with the "optimizer" rule, in a single pass over the weights,
+	the gradients (outputDelta*input) and the "state". For Adam "learningRate" includes the bias correction
+	(see StepLearningRate). IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void UpdateWeights(const double* input, const double* outputDelta, unsigned inputSize, unsigned outputSize, double* weights, double* bias,
+					   const OptimizerState<double>& state, const Optimizer& optimizer, double learningRate);
+	void UpdateWeights(const float* input, const float* outputDelta, unsigned inputSize, unsigned outputSize, float* weights, float* bias,
+					   const OptimizerState<float>& state, const Optimizer& optimizer, double learningRate);
+
+	/* Mixed precision update: applies the averaged "gradients", calculated in single precision, to the double precision
+	master weights with the "optimizer" and writes the single precision copy of the results to "floatWeights" and
+	"floatBias", in a single pass. The rows of "gradients" and "floatWeights" are laid out as in AlignedMatrix<inputSize, float>.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ApplyGradients(const float* gradients, const float* biasGradients, unsigned inputSize, unsigned outputSize, double* weights, double* bias,
+						const OptimizerState<double>& state, const Optimizer& optimizer, double learningRate, float* floatWeights, float* floatBias);
+
+	/* The deltas of the output layer: deltas = expected - output. Returns the sum of the squares of the deltas.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	double CalculateOutputDeltas(const double* output, const double* expected, double* deltas, unsigned count);
+	double CalculateOutputDeltas(const float* output, const float* expected, float* deltas, unsigned count);
+
+	/* Mini-batch version of UpdateWeights: applies one update from "rowCount" rows of inputs and output deltas,
+	laid out as in AlignedMatrix. The gradients (transpose(outputDelta)*input) are accumulated with a register-blocked
+	GEMM kernel and averaged over the rows. IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void UpdateWeightsBatch(const double* input, const double* outputDelta, unsigned rowCount, unsigned inputSize, unsigned outputSize,
+							double* weights, double* bias, const OptimizerState<double>& state, const Optimizer& optimizer, double learningRate);
+	void UpdateWeightsBatch(const float* input, const float* outputDelta, unsigned rowCount, unsigned inputSize, unsigned outputSize,
+							float* weights, float* bias, const OptimizerState<float>& state, const Optimizer& optimizer, double learningRate);
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+// Published under Apache 2.0 licence.
+
+/* The kernels of the AVX, AVX2+FMA and AVX-512 tiers. Unlike the rest of the library, this file is compiled with
+/arch:AVX, so that the compiler doesn't mix the legacy SSE instructions with the AVX ones. Nothing here runs before
+FloatingPoint.cpp checks that the CPU supports the tier. No precompiled header, as it is compiled for SSE2. */
+#include "Kernels.h"
+
+namespace FastNets
+{
+
+bool MakeAVXKernels(KernelTier tier, KernelTable& kernels)
+{
+	switch (tier)
+	{
+	case KernelAVX:		kernels = MakeKernels<Simd::AVXDouble, Simd::AVXFloat, Int8SSSE3, PhiloxSSE2>(); return true;
+	case KernelAVX2FMA:	kernels = MakeKernels<Simd::FMADouble, Simd::FMAFloat, Int8AVX2, PhiloxAVX2>(); return true;
+#ifdef FASTNETS_AVX512
+	case KernelAVX512:	kernels = MakeKernels<Simd::AVX512Double, Simd::AVX512Float, Int8AVX2, PhiloxAVX2>(); return true;
+#endif
+	default:			break;
+	}
+	return false;
+}
+
+}
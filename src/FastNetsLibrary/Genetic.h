@@ -4,10 +4,44 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <math.h>
+#include <string.h>
 #include <omp.h>
 
 namespace FastNets
 {
+	//The weights of a group of individuals, which Population::Evaluate passes through each tile of the input together:
+	const unsigned EvaluationGroupBytes = 256*1024;
+
+	//The forward passes of the last racing evaluation (see Population::SetRacing):
+	struct RacingReport
+	{
+		unsigned Individuals;//Evaluated
+		unsigned Terminated;//Stopped before the last row
+		double Rows;//Rows passed through the individuals
+		double TotalRows;//The rows of a full evaluation of the same individuals
+	};
+
+	//The throughput of the last Population::TrainSteadyState:
+	struct SteadyStateReport
+	{
+		int Threads;
+		unsigned Children;
+		double Generations;//Children per the children of a generation of Train
+		double Seconds;
+		double GenerationsPerSecond;
+		double Utilization;//The time of the threads in breeding and evaluation, relative to Threads*Seconds
+		double Error;//Of the best individual
+	};
+
+	/* The quantile of the standard normal distribution for "p" in [0.5, 1), e.g. 2.33 for 0.99. Rational approximation
+	of Abramowitz and Stegun (26.2.23), the absolute error is below 4.5e-4. */
+	inline double NormalQuantile(double p)
+	{
+		const double t = sqrt(-2*log(1 - p));
+		return t - (2.515517 + t*(0.802853 + t*0.010328))/(1 + t*(1.432788 + t*(0.189269 + t*0.001308)));
+	}
+
 	/* Implements the genetic algorithm learning. This algorithm handles negative error values
 	and works well, even if the error function is not continuous. The algorithm can be used easily
 	to cases where we measure discrete success, buy just adding a "-" sign in front of the success
@@ -22,31 +56,77 @@ namespace FastNets
 	}
 	while (error > 0.01);
 	*/
-	template<class Individual, class FloatingPoint = double>
+	template<class Individual, class FloatingPoint = typename Individual::FloatingPointType>
 	class Population
 	{
 	protected:
 		struct IndividualStorage
 		{
-			IndividualStorage():mError(1e10), mpIndividual(NULL){}
+			IndividualStorage():mError(1e10), mpIndividual(NULL), mOrder(0){}
 			FloatingPoint	mError;
 			Individual*		mpIndividual;
-			bool operator < (const IndividualStorage& other) const { return mError < other.mError; }
+			unsigned		mOrder;//The position before Select: the equal errors keep their order
+			bool operator < (const IndividualStorage& other) const 
+			{ 
+				return mError < other.mError || (mError == other.mError && mOrder < other.mOrder); 
+			}
 		};
 		unsigned		mMaxCount;
 		double			mSurvivalRate;
 		IndividualStorage* mpPopulation;
+		Arena*			mpArena;//The weights of all the individuals, in a single block
 		bool		    mSelected;//Wheter a first selection has happened
+		//The scratch memory of the evaluation, one per thread. Kept between the generations:
+		std::vector<Workspace<Individual>*> mWorkspaces;
+		//The random streams of the reproduction, one per thread. Each child sets the stream of its slot (see Populate):
+		std::vector<Randomizer*> mRandomizers;
+		unsigned long long	mSeed;
+		unsigned			mGeneration;
+		unsigned			mChildSteps;//The children bred by TrainSteadyState so far
+		//Racing evaluation (see SetRacing):
+		unsigned			mRacingTiles;//0 if disabled
+		double				mRacingConfidence;
+		double				mCutoff;//The SelectCount()-th error of the last selection
+		RacingReport		mLastRacingReport;
+		//Minibatch fitness (see SetMinibatch):
+		unsigned			mMinibatchRows;//0 if disabled
+		double				mSmoothing;
+		AlignedMatrix<Individual::Input, FloatingPoint>*	mpMinibatchInput;
+		AlignedMatrix<Individual::Output, FloatingPoint>*	mpMinibatchExpected;
+		std::vector<unsigned>	mRowOrder;//A random permutation of the rows, its start is the minibatch
+		//The random streams of the minibatches and the tournaments. The individuals use the streams of their slots:
+		const static unsigned MinibatchStream = 0xFFFFFFFF;
+		const static unsigned TournamentStream = 0xFFFFFFFE;
+		//The steps of the streams of the steady-state children are apart from the ones of the generations:
+		const static unsigned SteadyStateSteps = 0x80000000;
+		SteadyStateReport	mLastSteadyStateReport;
 	private:
 		Population(const Population& other){}//No copy
 	public:
-		Population(unsigned maxCount, double survivalRate)
-			:mMaxCount(maxCount), mSurvivalRate(survivalRate), mSelected(false)
+		/* The random numbers of the initialization, the crossover and the mutation of each individual are a function
+		of the "seed", its slot in the population and the generation (see Randomizer), so the training is reproducible
+		with any number of threads. A "seed" of 0 is replaced with a random one. */
+		Population(unsigned maxCount, double survivalRate, unsigned long long seed = 0)
+			:mMaxCount(maxCount), mSurvivalRate(survivalRate), mSelected(false), mSeed(seed), mGeneration(0), mChildSteps(0),
+			mRacingTiles(0), mRacingConfidence(1), mCutoff(1e100), mMinibatchRows(0), mSmoothing(1), 
+			mpMinibatchInput(NULL), mpMinibatchExpected(NULL)
 		{
+			RacingReport noRacing = { 0, 0, 0, 0 };
+			mLastRacingReport = noRacing;
+			SteadyStateReport noSteadyState = { 0, 0, 0, 0, 0, 0, 0 };
+			mLastSteadyStateReport = noSteadyState;
+			if (!mSeed)
+			{
+				Randomizer seeds;
+				mSeed = seeds.NextMask();
+			}
 			mpPopulation = new IndividualStorage[mMaxCount];
+			mpArena = new Arena((size_t)mMaxCount*Individual::ArenaSize);
+			Randomizer rand(mSeed, 0);
 			for (unsigned i = 0; i < mMaxCount; ++i)
 			{
-				mpPopulation[i].mpIndividual = new Individual(InitializeForBackProp);
+				rand.SetStream(i, 0);
+				mpPopulation[i].mpIndividual = new Individual(InitializeForBackProp, mpArena, &rand);
 			}
 		}
 
@@ -57,6 +137,17 @@ namespace FastNets
 				delete mpPopulation[i].mpIndividual;
 			}
 			delete [] mpPopulation;
+			delete mpArena;
+			for (unsigned i = 0; i < mWorkspaces.size(); ++i)
+			{
+				delete mWorkspaces[i];
+			}
+			for (unsigned i = 0; i < mRandomizers.size(); ++i)
+			{
+				delete mRandomizers[i];
+			}
+			delete mpMinibatchInput;
+			delete mpMinibatchExpected;
 		}
 
 		//Returns whether this is the initial population
@@ -89,16 +180,15 @@ namespace FastNets
 			double totalSuccess = selectionCount*maxError - totalError;//Reverse error into success
 			double totalPairsSuccess = (selectionCount - 1)*totalSuccess;
 
-			unsigned currentPlace = selectionCount;
-			Randomizer<> rand;
+			//The parents of each child are assigned first, then the children are created in parallel:
+			std::vector<std::pair<unsigned, unsigned> > parents;
+			parents.reserve(populationToSet);
 			double reminder = 0;
 			for (unsigned int i = 0; i < selectionCount - 1; ++i)
 			{
 				for (unsigned int j = i + 1; j < selectionCount; ++j)
 				{
-					const IndividualStorage& first = mpPopulation[i];
-					const IndividualStorage& second = mpPopulation[j]; 
-					double combinedSuccess = 2*maxError - first.mError - second.mError;
+					double combinedSuccess = 2*maxError - mpPopulation[i].mError - mpPopulation[j].mError;
 					double dNumChildren = ((combinedSuccess/totalPairsSuccess)*populationToSet);
 					int numChildren = (int)dNumChildren;
 					reminder += dNumChildren - numChildren;
@@ -109,11 +199,9 @@ namespace FastNets
 					}
 					for (int k = 0; k < numChildren; ++k)
 					{
-						if (currentPlace < mMaxCount)
+						if (parents.size() < populationToSet)
 						{
-							Individual& rToChange = *mpPopulation[currentPlace++].mpIndividual;
-							rToChange.SetFromMergedParents(*first.mpIndividual, *second.mpIndividual, rand);
-							rToChange.Mutate(mutationRate, rand);
+							parents.push_back(std::make_pair(i, j));
 						}
 						else
 						{
@@ -126,20 +214,184 @@ namespace FastNets
 				}
 			}
 
+			//The step 0 of the streams is the initialization. Each generation takes two more: crossover and mutation:
+			++mGeneration;
+			const int children = (int)parents.size();
+			const int threads = ParallelThreads((double)children*Individual::Weights, children);
+			EnsureRandomizers(threads);
+			#pragma omp parallel for num_threads(threads) if (threads > 1)
+			for (int k = 0; k < children; ++k)
+			{
+				Randomizer& rand = *mRandomizers[omp_get_thread_num()];
+				const unsigned slot = selectionCount + k;
+				Individual& rToChange = *mpPopulation[slot].mpIndividual;
+				rand.SetStream(slot, 0, 2*mGeneration - 1);
+				rToChange.SetFromMergedParents(*mpPopulation[parents[k].first].mpIndividual, *mpPopulation[parents[k].second].mpIndividual, rand);
+				rand.SetStream(slot, 0, 2*mGeneration);
+				rToChange.Mutate(mutationRate, rand);
+			}
+
 			return false;
 		}
 
 		unsigned SelectCount() const { return (unsigned)(mMaxCount*mSurvivalRate); }
+		unsigned long long Seed() const { return mSeed; }
+
+		/* Racing evaluation: the individuals go through the rows "chunkRows" at a time (rounded up to whole tiles) and
+		each stops, once it can't get an error below the cutoff: the SelectCount()-th error of the previous selection.
+		With a "confidence" of 1 an individual stops only when the sum of its errors so far is at least the cutoff times
+		all the rows, so the survivors and their errors are the same as without racing. With a lower one, e.g. 0.99,
+		the errors of the tiles done are a sample of the errors of all of them: the individual stops, when its mean 
+		error is above the cutoff with that confidence (one-sided normal bound, after 2 or more tiles). The error of a 
+		stopped individual is the mean of its rows so far, which is at or above the cutoff. 0 "chunkRows" disables it.
+		Only the new individuals race (Train with a static input): the cutoff comes from the rows of the previous
+		selection, so the evaluations of the whole population (e.g. Train with a changing input) don't use it. */
+		void SetRacing(unsigned chunkRows, double confidence = 1.0)
+		{
+			if (confidence <= 0.5 || confidence > 1)
+				throw std::string("The confidence must be in (0.5, 1]");
+			mRacingTiles = (chunkRows + Individual::TileRows - 1)/Individual::TileRows;
+			mRacingConfidence = confidence;
+		}
+
+		const RacingReport& GetLastRacingReport() const { return mLastRacingReport; }
+
+		/* Minibatch fitness for large data sets: each generation of Train evaluates all the individuals on "rows" random
+		rows (without repetitions), instead of on all of them, and "staticInput" is ignored. The error of a child is its
+		error on the minibatch. The error of a survivor is smoothed over the generations: 
+			error = smoothing*(minibatch error) + (1 - smoothing)*(previous error)
+		so the survivors are not replaced because of a single hard minibatch. The cost of a generation depends on "rows",
+		not on the size of the data set. The minibatches don't use racing (see SetRacing): the cutoff of the previous
+		generation comes from a different minibatch and is smoothed. 0 "rows" disables it. */
+		void SetMinibatch(unsigned rows, double smoothing = 0.3)
+		{
+			if (smoothing <= 0 || smoothing > 1)
+				throw std::string("The smoothing must be in (0, 1]");
+			mMinibatchRows = rows;
+			mSmoothing = smoothing;
+		}
 
 		//Returns the error rate of the best element. In the current implementation
 		//selects does not clear the memory (in order to avoid constant reallocations)
+		//Only the survivors are sorted, the rest are replaced by Populate: O(n) partition and O(k log k) sort of the
+		//k survivors. The order of the equal errors is kept, as in a stable sort of all of them.
 		double Select()
 		{
 			mSelected = true;
-			std::stable_sort(mpPopulation, mpPopulation + mMaxCount);
+			for (unsigned i = 0; i < mMaxCount; ++i)
+			{
+				mpPopulation[i].mOrder = i;
+			}
+			const unsigned top = SelectCount() ? SelectCount() : 1;
+			if (top < mMaxCount)
+				std::nth_element(mpPopulation, mpPopulation + top - 1, mpPopulation + mMaxCount);
+			std::sort(mpPopulation, mpPopulation + top);
+			if (SelectCount())
+				mCutoff = mpPopulation[SelectCount() - 1].mError;
 			return mpPopulation[0].mError;
 		}
 
+		/* Steady-state training: instead of the Populate, Evaluate and Select steps of Train, each thread breeds and
+		evaluates one child at a time, without waiting for the others. The parents are the winners of tournaments of
+		"tournamentSize" random individuals and the child replaces the loser (the worst) of another one, so the best
+		individual is never replaced. Only the choice of the slots is under a lock: the slots being written are left
+		out of the tournaments and the parents being read are not replaced. Runs the children of "generations" 
+		generations of Train and returns the error of the best individual. The order, in which the threads finish
+		their children, changes the result, so unlike Train it is not reproducible with more than one thread. */
+		double TrainSteadyState(const AlignedMatrix<Individual::Input, FloatingPoint>& inputMatrix, 
+								const AlignedMatrix<Individual::Output, FloatingPoint>& expectedMatrix, double mutationRate,
+								double generations, unsigned tournamentSize = 3)
+		{
+			if (inputMatrix.NumRows() != expectedMatrix.NumRows())
+				throw std::string("Different number of rows in the input and expected output marices");
+			if (tournamentSize < 2 || tournamentSize + 2 > mMaxCount)
+				throw std::string("The tournament must have 2 or more individuals, fewer than the population");
+			if (!mSelected)
+			{
+				Evaluate(inputMatrix, expectedMatrix);
+				Select();
+			}
+
+			const unsigned childrenPerGeneration = (SelectCount() < mMaxCount) ? mMaxCount - SelectCount() : mMaxCount;
+			const unsigned children = (unsigned)(generations*childrenPerGeneration);
+			const double rows = inputMatrix.NumRows();
+			//Each child holds up to 3 slots, so with that many threads at least half of the slots are free and
+			//the tournaments always find their candidates, without waiting for the other threads:
+			const int maxThreads = (mMaxCount/6 > 1) ? (int)(mMaxCount/6) : 1;
+			const int threads = ParallelThreads((double)children*rows*Individual::Weights, (children < (unsigned)maxThreads) ? children : maxThreads);
+			EnsureWorkspaces(threads);
+			EnsureRandomizers(threads);
+			Randomizer tournamentRandom(mSeed, TournamentStream, 0, mMaxCount);
+			tournamentRandom.SetStream(TournamentStream, 0, SteadyStateSteps | mChildSteps);
+			std::vector<unsigned> readers(mMaxCount, 0);//The children being bred from each slot
+			std::vector<char> writing(mMaxCount, 0);//The slots of the children being bred
+			unsigned started = 0;
+			double busy = 0;
+			const double start = omp_get_wtime();
+
+			#pragma omp parallel num_threads(threads) if (threads > 1)
+			{
+				Randomizer& rand = *mRandomizers[omp_get_thread_num()];
+				Workspace<Individual>& rWorkspace = *mWorkspaces[omp_get_thread_num()];
+				double threadBusy = 0;
+				for (;;)
+				{
+					unsigned slots[3];//The parents and the child
+					unsigned step = 0;
+					bool done = false;
+					#pragma omp critical(PopulationSlots)
+					{
+						done = started >= children;
+						if (!done)
+						{
+							ChooseSlots(tournamentRandom, tournamentSize, readers, writing, slots);
+							++started;
+							step = ++mChildSteps;
+							++readers[slots[0]];
+							++readers[slots[1]];
+							writing[slots[2]] = 1;
+						}
+					}
+					if (done)
+						break;
+
+					const double childStart = omp_get_wtime();
+					Individual* pChild = mpPopulation[slots[2]].mpIndividual;
+					rand.SetStream(slots[2], 0, SteadyStateSteps | (2*step - 1));
+					pChild->SetFromMergedParents(*mpPopulation[slots[0]].mpIndividual, *mpPopulation[slots[1]].mpIndividual, rand);
+					rand.SetStream(slots[2], 0, SteadyStateSteps | (2*step));
+					pChild->Mutate(mutationRate, rand);
+					double error = 0;
+					Individual::SumBatchErrors(&pChild, 1, inputMatrix, expectedMatrix, rWorkspace, &error);
+					threadBusy += omp_get_wtime() - childStart;
+
+					#pragma omp critical(PopulationSlots)
+					{
+						--readers[slots[0]];
+						--readers[slots[1]];
+						writing[slots[2]] = 0;
+						mpPopulation[slots[2]].mError = (FloatingPoint)(error/rows);
+					}
+				}
+				#pragma omp critical(PopulationSlots)
+				busy += threadBusy;
+			}
+
+			const double seconds = omp_get_wtime() - start;
+			SteadyStateReport report;
+			report.Threads = threads;
+			report.Children = children;
+			report.Generations = (double)children/childrenPerGeneration;
+			report.Seconds = seconds;
+			report.GenerationsPerSecond = (seconds > 0) ? report.Generations/seconds : 0;
+			report.Utilization = (seconds > 0) ? busy/(threads*seconds) : 0;
+			report.Error = Select();
+			mLastSteadyStateReport = report;
+			return report.Error;
+		}
+
+		const SteadyStateReport& GetLastSteadyStateReport() const { return mLastSteadyStateReport; }
+
 		//Static input parameter means that the Train method will be called always with
 		//the same input. Returns the error of the best individual.
 		double Train(const AlignedMatrix<Individual::Input, FloatingPoint>& inputMatrix, 
@@ -148,6 +400,11 @@ namespace FastNets
 			if (inputMatrix.NumRows() != expectedMatrix.NumRows())
 				throw std::string("Different number of rows in the input and expected output marices");
 			bool initial = Populate(mutationRate);
+			if (mMinibatchRows)
+			{
+				EvaluateMinibatch(inputMatrix, expectedMatrix, initial);
+				return Select();
+			}
 			//The first time we evaluate all elements. Beyond that we only evaluate the new ones, if the input is static:
 			int startElement = (initial || !staticInput) ? 0 : (int)(mMaxCount*mSurvivalRate);
 			Evaluate(inputMatrix, expectedMatrix, startElement);
@@ -158,32 +415,257 @@ namespace FastNets
 		{
 			if (inputMatrix.NumRows() != expectedMatrix.NumRows())
 				throw std::string("Different number of rows in the input and expected output marices");
+			if (skipElements >= (int)mMaxCount)
+				return;
+			if (mRacingTiles && mSelected && skipElements > 0)
+			{
+				EvaluateRacing(inputMatrix, expectedMatrix, skipElements);
+				return;
+			}
+			EvaluateAll(inputMatrix, expectedMatrix, skipElements);
+		}
+
+		Individual& Best() { return *mpPopulation[0].mpIndividual; }
+	protected:
+		//Evaluate without racing:
+		void EvaluateAll(const AlignedMatrix<Individual::Input, FloatingPoint>& inputMatrix, const AlignedMatrix<Individual::Output, FloatingPoint>& expectedMatrix, int skipElements)
+		{
+			//The individuals are evaluated in groups, which weights fit in the cache: each tile of the input goes through
+			//all the individuals of a group (see Net::SumBatchErrors). The groups go to the threads, unless there are 
+			//fewer of them than the tiles of the input. Then the threads split the tiles (see ChooseParallelism):
+			const unsigned count = mMaxCount - skipElements;
+			const unsigned groupSize = (Individual::ArenaSize < EvaluationGroupBytes) ? EvaluationGroupBytes/Individual::ArenaSize : 1;
+			const unsigned numGroups = (count + groupSize - 1)/groupSize;
+			const unsigned numTiles = (inputMatrix.NumRows() + Individual::TileRows - 1)/Individual::TileRows;
+			const ParallelPlan plan = ChooseParallelism((double)count*inputMatrix.NumRows()*Individual::Weights, numGroups, numTiles);
+			const int threads = plan.Threads;
+			EnsureWorkspaces(threads);
+			std::vector<const Individual*> individuals(count);
+			std::vector<double> errors(count, 0.0);
+			for (unsigned i = 0; i < count; ++i)
+			{
+				individuals[i] = mpPopulation[skipElements + i].mpIndividual;
+			}
+
+			if (plan.Strategy == ParallelOverNeurons)
+			{
+				//Each (tile, group) item has its own slots of the errors, summed in the order of the tiles, as in the serial case:
+				const int items = (int)(numGroups*numTiles);
+				std::vector<double> tileErrors((size_t)numTiles*count, 0.0);
+				#pragma omp parallel for num_threads(threads)
+				for (int item = 0; item < items; ++item)
+				{
+					const unsigned tile = item % numTiles;
+					const unsigned first = (item/numTiles)*groupSize;
+					Individual::SumBatchErrors(&individuals[first], (count - first < groupSize) ? count - first : groupSize, inputMatrix, expectedMatrix, 
+						*mWorkspaces[omp_get_thread_num()], &tileErrors[tile*count + first], tile, numTiles);
+				}
+				for (unsigned t = 0; t < numTiles; ++t)
+				{
+					for (unsigned i = 0; i < count; ++i)
+					{
+						errors[i] += tileErrors[t*count + i];
+					}
+				}
+			}
+			else
+			{
+				#pragma omp parallel for num_threads(threads) if (threads > 1)
+				for (int g = 0; g < (int)numGroups; ++g)
+				{
+					const unsigned first = g*groupSize;
+					Individual::SumBatchErrors(&individuals[first], (count - first < groupSize) ? count - first : groupSize, inputMatrix, expectedMatrix, 
+						*mWorkspaces[omp_get_thread_num()], &errors[first]);
+				}
+			}
+
+			for (unsigned i = 0; i < count; ++i)
+			{
+				mpPopulation[skipElements + i].mError = (FloatingPoint)(errors[i]/inputMatrix.NumRows());
+			}
+		}
+
+		/* The tournaments of TrainSteadyState, under its lock: slots[0] and slots[1] are the parents, the winners of
+		two tournaments, slots[2] the loser of a third one, which is not read or written. The draws, which are in use,
+		are skipped. TrainSteadyState keeps enough slots free (see its number of threads), so the tournaments end. */
+		void ChooseSlots(Randomizer& rand, unsigned tournamentSize, const std::vector<unsigned>& readers, 
+						 const std::vector<char>& writing, unsigned* slots)
+		{
+			for (unsigned k = 0; k < 3; ++k)
+			{
+				const bool loser = (k == 2);
+				unsigned chosen = mMaxCount;
+				unsigned candidates = 0;
+				while (candidates < tournamentSize)
+				{
+					const unsigned slot = (unsigned)rand.Next() - 1;
+					if (writing[slot] || (k == 1 && slot == slots[0]) || (loser && (readers[slot] || slot == slots[0] || slot == slots[1])))
+						continue;
+					//The loser is the worst of two or more distinct slots, so never the best individual:
+					if (loser && slot == chosen)
+						continue;
+					++candidates;
+					if (chosen == mMaxCount || (loser ? mpPopulation[chosen] < mpPopulation[slot] : mpPopulation[slot] < mpPopulation[chosen]))
+						chosen = slot;
+				}
+				slots[k] = chosen;
+			}
+		}
 
-			//Preinitialize the temporary matrices: one per OMP thread, to avoid large number of allocations:
-			int maxTreads = omp_get_max_threads();
-			AlignedMatrix<Individual::Output, FloatingPoint>** pMatrices = new AlignedMatrix<Individual::Output, FloatingPoint>*[maxTreads];
-			for (int i = 0; i < maxTreads; ++i)
+		/* See SetMinibatch. The minibatch is the start of mRowOrder after a partial Fisher-Yates shuffle, which continues 
+		from the permutation of the previous generation, so drawing it is O(rows) too. */
+		void EvaluateMinibatch(const AlignedMatrix<Individual::Input, FloatingPoint>& inputMatrix, 
+							   const AlignedMatrix<Individual::Output, FloatingPoint>& expectedMatrix, bool initial)
+		{
+			const unsigned rows = (mMinibatchRows < inputMatrix.NumRows()) ? mMinibatchRows : inputMatrix.NumRows();
+			if (!mpMinibatchInput || mpMinibatchInput->NumRows() != rows)
 			{
-				pMatrices[i] = new AlignedMatrix<Individual::Output, FloatingPoint>(inputMatrix.NumRows());
+				delete mpMinibatchInput;
+				delete mpMinibatchExpected;
+				mpMinibatchInput = new AlignedMatrix<Individual::Input, FloatingPoint>(rows);
+				mpMinibatchExpected = new AlignedMatrix<Individual::Output, FloatingPoint>(rows);
 			}
-			#pragma omp parallel for
-			for (int i = skipElements; i < (int)mMaxCount; ++i)
+			if (mRowOrder.size() != inputMatrix.NumRows())
 			{
-				int threadNum = omp_get_thread_num();
-				AlignedMatrix<Individual::Output, FloatingPoint>* pOutputMtrx = pMatrices[omp_get_thread_num()];
-				mpPopulation[i].mpIndividual->BatchProcessInputFast(inputMatrix, *pOutputMtrx);
-				mpPopulation[i].mError = mpPopulation[i].mpIndividual->CalculateError(*pOutputMtrx, expectedMatrix);
+				mRowOrder.resize(inputMatrix.NumRows());
+				for (unsigned i = 0; i < mRowOrder.size(); ++i)
+				{
+					mRowOrder[i] = i;
+				}
 			}
 
-			for (int i = 0; i < maxTreads; ++i)
+			Randomizer rand(mSeed, MinibatchStream, 0);
+			rand.SetStream(MinibatchStream, 0, mGeneration);
+			const unsigned totalRows = (unsigned)mRowOrder.size();
+			for (unsigned i = 0; i < rows; ++i)
 			{
-				delete pMatrices[i];
+				unsigned j = i + (unsigned)(rand.BiasNext()*(totalRows - i));
+				if (j >= totalRows)
+					j = totalRows - 1;
+				std::swap(mRowOrder[i], mRowOrder[j]);
+				memcpy(mpMinibatchInput->GetRow(i), inputMatrix.GetRow(mRowOrder[i]), 
+					AlignedMatrix<Individual::Input, FloatingPoint>::AlignedRowSize*sizeof(FloatingPoint));
+				memcpy(mpMinibatchExpected->GetRow(i), expectedMatrix.GetRow(mRowOrder[i]), 
+					AlignedMatrix<Individual::Output, FloatingPoint>::AlignedRowSize*sizeof(FloatingPoint));
+			}
+
+			//After Populate the survivors are at the start:
+			const unsigned survivors = initial ? 0 : SelectCount();
+			std::vector<FloatingPoint> previous(survivors);
+			for (unsigned i = 0; i < survivors; ++i)
+			{
+				previous[i] = mpPopulation[i].mError;
+			}
+			EvaluateAll(*mpMinibatchInput, *mpMinibatchExpected, 0);
+			for (unsigned i = 0; i < survivors; ++i)
+			{
+				mpPopulation[i].mError = (FloatingPoint)(mSmoothing*mpPopulation[i].mError + (1 - mSmoothing)*previous[i]);
 			}
-			delete [] pMatrices;
 		}
 
-		Individual& Best() { return *mpPopulation[0].mpIndividual; }
-	protected:
+		/* See SetRacing. Each chunk is split into work items of a group of the remaining individuals and a tile of rows,
+		so that every item has its own slots of the errors and the threads need no reduction. The errors of the
+		individuals, which run to the end, are summed in the order of the tiles, the same as in Evaluate. */
+		void EvaluateRacing(const AlignedMatrix<Individual::Input, FloatingPoint>& inputMatrix, 
+							const AlignedMatrix<Individual::Output, FloatingPoint>& expectedMatrix, int skipElements)
+		{
+			const unsigned count = mMaxCount - skipElements;
+			const unsigned rows = inputMatrix.NumRows();
+			const unsigned numTiles = (rows + Individual::TileRows - 1)/Individual::TileRows;
+			const unsigned groupSize = (Individual::ArenaSize < EvaluationGroupBytes) ? EvaluationGroupBytes/Individual::ArenaSize : 1;
+			const bool statistical = mRacingConfidence < 1;
+			const double z = statistical ? NormalQuantile(mRacingConfidence) : 0;
+			std::vector<unsigned> active(count);//Indexes of the individuals still running
+			std::vector<const Individual*> individuals(count);
+			std::vector<double> sums(count, 0.0), squares(count, 0.0), chunkErrors;
+			for (unsigned i = 0; i < count; ++i)
+			{
+				active[i] = i;
+			}
+			RacingReport report = { count, 0, 0, (double)count*rows };
+
+			for (unsigned firstTile = 0; firstTile < numTiles && !active.empty(); firstTile += mRacingTiles)
+			{
+				const unsigned activeCount = (unsigned)active.size();
+				const unsigned endTile = (firstTile + mRacingTiles < numTiles) ? firstTile + mRacingTiles : numTiles;
+				const unsigned chunkTiles = endTile - firstTile;
+				const unsigned numGroups = (activeCount + groupSize - 1)/groupSize;
+				const int items = (int)(numGroups*chunkTiles);
+				for (unsigned i = 0; i < activeCount; ++i)
+				{
+					individuals[i] = mpPopulation[skipElements + active[i]].mpIndividual;
+				}
+				chunkErrors.assign((size_t)chunkTiles*activeCount, 0.0);
+				const unsigned chunkRows = ((endTile*Individual::TileRows < rows) ? endTile*Individual::TileRows : rows) - firstTile*Individual::TileRows;
+				const int threads = ParallelThreads((double)activeCount*chunkRows*Individual::Weights, items);
+				EnsureWorkspaces(threads);
+				#pragma omp parallel for num_threads(threads) if (threads > 1)
+				for (int item = 0; item < items; ++item)
+				{
+					const unsigned tile = item % chunkTiles;
+					const unsigned first = (item/chunkTiles)*groupSize;
+					Individual::SumBatchErrors(&individuals[first], (activeCount - first < groupSize) ? activeCount - first : groupSize, inputMatrix, 
+						expectedMatrix, *mWorkspaces[omp_get_thread_num()], &chunkErrors[tile*activeCount + first], firstTile + tile, numTiles);
+				}
+				report.Rows += (double)activeCount*chunkRows;
+
+				const unsigned rowsDone = firstTile*Individual::TileRows + chunkRows;
+				unsigned kept = 0;
+				for (unsigned i = 0; i < activeCount; ++i)
+				{
+					double& sum = sums[active[i]];
+					double& square = squares[active[i]];
+					for (unsigned t = 0; t < chunkTiles; ++t)
+					{
+						const unsigned tileStart = (firstTile + t)*Individual::TileRows;
+						const unsigned tileRows = (rows - tileStart < Individual::TileRows) ? rows - tileStart : Individual::TileRows;
+						const double error = chunkErrors[t*activeCount + i];
+						sum += error;
+						square += (error/tileRows)*(error/tileRows);
+					}
+					bool hopeless = sum >= mCutoff*rows;
+					if (!hopeless && statistical && endTile >= 2 && rowsDone < rows)
+					{
+						//The tiles so far are the sample:
+						const double mean = sum/rowsDone;
+						const double variance = (square/endTile - mean*mean)*endTile/(endTile - 1);
+						hopeless = mean - z*sqrt((variance > 0) ? variance/endTile : 0) > mCutoff;
+					}
+					if (hopeless && rowsDone < rows)
+					{
+						mpPopulation[skipElements + active[i]].mError = (FloatingPoint)(sum/rowsDone);
+						++report.Terminated;
+					}
+					else
+					{
+						active[kept++] = active[i];
+					}
+				}
+				active.resize(kept);
+			}
+
+			for (unsigned i = 0; i < active.size(); ++i)
+			{
+				mpPopulation[skipElements + active[i]].mError = (FloatingPoint)(sums[active[i]]/rows);
+			}
+			mLastRacingReport = report;
+		}
+
+		void EnsureRandomizers(int threads)
+		{
+			while (mRandomizers.size() < (size_t)threads)
+			{
+				mRandomizers.push_back(new Randomizer(mSeed, 0));
+			}
+		}
+
+		void EnsureWorkspaces(int threads)
+		{
+			while (mWorkspaces.size() < (size_t)threads)
+			{
+				mWorkspaces.push_back(new Workspace<Individual>());
+			}
+		}
 
 	};
 }
\ No newline at end of file
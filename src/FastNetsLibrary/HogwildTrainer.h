@@ -0,0 +1,149 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <omp.h>
+#include <vector>
+#include "Net.h"
+
+namespace FastNets
+{
+/* Lock-free data-parallel training (Hogwild). Each thread trains on its own shard of the rows with
+Net::HogwildBackPropagation and writes to the shared weights without locks. The occasional lost update
+doesn't hurt the convergence, while the threads never wait for each other between the synchronization
+points. At these the threads meet and the reverse weights (used for the deltas) are refreshed:
+	Net<167, Net<112, Net<9>>> net(InitializeForBackProp);
+	HogwildTrainer<Net<167, Net<112, Net<9>>>> trainer(net, 8, 256);
+	for (int i = 0; i < 100; ++i)
+		error = trainer.Train(input, expected, 0.1);
+	printf("%.0f samples/s\n", trainer.GetLastReport().SamplesPerSecond);
+*/
+
+//The throughput of a training run:
+struct HogwildReport
+{
+	unsigned Threads;//The number of threads, which actually ran
+	unsigned Samples;//Number of trained rows
+	double Seconds;
+	double SamplesPerSecond;
+	double Speedup;//SamplesPerSecond relative to the first run of MeasureScaling (1 for Train)
+	double Error;//The average error before the updates
+};
+
+template<class NetType>
+class HogwildTrainer
+{
+public:
+	typedef typename NetType::FloatingPointType FloatingPointType;
+protected:
+	NetType&		mNet;
+	unsigned		mThreads;
+	unsigned		mSyncInterval;
+	HogwildReport	mLastReport;
+private:
+	HogwildTrainer(const HogwildTrainer&){}//No copy
+public:
+	/* "threads" of 0 uses all the OMP threads. Each thread trains on "syncInterval" rows between
+	the synchronization points, 0 synchronizes only at the end of Train. */
+	HogwildTrainer(NetType& net, unsigned threads = 0, unsigned syncInterval = 256)
+		:mNet(net), mThreads(threads), mSyncInterval(syncInterval)
+	{
+		HogwildReport empty = {0, 0, 0, 0, 0, 0};
+		mLastReport = empty;
+	}
+
+	void SetThreads(unsigned threads) { mThreads = threads; }
+	void SetSyncInterval(unsigned syncInterval) { mSyncInterval = syncInterval; }
+	const HogwildReport& GetLastReport() const { return mLastReport; }
+
+	/* One pass over the rows, split in contiguous shards between the threads. Returns the average error. */
+	double Train(const AlignedMatrix<NetType::Input, FloatingPointType>& input, const AlignedMatrix<NetType::Output, FloatingPointType>& expected,
+				 double learningRate)
+	{
+		if (input.NumRows() != expected.NumRows())
+			throw std::string("Different number of rows between the two matrices.");
+		if (!input.NumRows())
+			throw std::string("No rows to train on");
+
+		const int threads = mThreads ? (int)mThreads : omp_get_max_threads();
+		const unsigned rows = input.NumRows();
+		unsigned actualThreads = 1;
+		double totalError = 0;
+		//The lazy initialization of the layers must not happen in the threads:
+		mNet.PrepareBackPropagation();
+
+		double start = omp_get_wtime();
+		#pragma omp parallel num_threads(threads) reduction(+:totalError)
+		{
+			//Allocated once per thread:
+			Workspace<NetType> workspace;
+			const unsigned thread = (unsigned)omp_get_thread_num();
+			const unsigned numThreads = (unsigned)omp_get_num_threads();
+			const unsigned begin = (unsigned)((unsigned long long)rows*thread/numThreads);
+			const unsigned end = (unsigned)((unsigned long long)rows*(thread + 1)/numThreads);
+			//All the threads have to go through the same number of synchronization points:
+			const unsigned maxShard = (rows + numThreads - 1)/numThreads;
+			const unsigned interval = mSyncInterval ? mSyncInterval : maxShard;
+			const unsigned rounds = (maxShard + interval - 1)/interval;
+			#pragma omp master
+			actualThreads = numThreads;
+
+			unsigned row = begin;
+			for (unsigned round = 0; round < rounds; ++round)
+			{
+				unsigned roundEnd = (end - row < interval) ? end : row + interval;
+				for (; row < roundEnd; ++row)
+				{
+					totalError += mNet.HogwildBackPropagation(input.GetRow(row), expected.GetRow(row), learningRate, workspace);
+				}
+				//Synchronization point:
+				#pragma omp barrier
+				#pragma omp single
+				mNet.PrepareBackPropagation();
+			}
+		}
+		double seconds = omp_get_wtime() - start;
+
+		mLastReport.Threads = actualThreads;
+		mLastReport.Samples = rows;
+		mLastReport.Seconds = seconds;
+		mLastReport.SamplesPerSecond = (seconds > 0) ? rows/seconds : 0;
+		mLastReport.Speedup = 1;
+		mLastReport.Error = totalError/rows;
+		return mLastReport.Error;
+	}
+
+	/* Trains "epochs" passes with 1, 2, 4, ... up to "maxThreads" threads (the last one is "maxThreads"
+	even if not a power of 2) and reports the throughput of each. Note that this keeps training the net. */
+	std::vector<HogwildReport> MeasureScaling(const AlignedMatrix<NetType::Input, FloatingPointType>& input,
+											  const AlignedMatrix<NetType::Output, FloatingPointType>& expected,
+											  double learningRate, unsigned maxThreads, unsigned epochs = 1)
+	{
+		if (!maxThreads || !epochs)
+			throw std::string("maxThreads and epochs must be positive");
+		const unsigned savedThreads = mThreads;
+		std::vector<HogwildReport> reports;
+		for (unsigned threads = 1; ; threads *= 2)
+		{
+			if (threads > maxThreads)
+				threads = maxThreads;
+			mThreads = threads;
+			HogwildReport report = {0, 0, 0, 0, 0, 0};
+			for (unsigned i = 0; i < epochs; ++i)
+			{
+				Train(input, expected, learningRate);
+				report.Threads = mLastReport.Threads;
+				report.Samples += mLastReport.Samples;
+				report.Seconds += mLastReport.Seconds;
+				report.Error = mLastReport.Error;
+			}
+			report.SamplesPerSecond = (report.Seconds > 0) ? report.Samples/report.Seconds : 0;
+			report.Speedup = (!reports.empty() && reports[0].SamplesPerSecond > 0) ? report.SamplesPerSecond/reports[0].SamplesPerSecond : 1;
+			reports.push_back(report);
+			if (threads == maxThreads)
+				break;
+		}
+		mThreads = savedThreads;
+		return reports;
+	}
+};
+
+}//FastNets namespace
@@ -0,0 +1,1020 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include "FloatingPoint.h"
+#include "Simd.h"
+
+/* The SIMD kernels behind FloatingPoint.h, written once for all the instruction sets (see Simd.h). Only FloatingPoint.cpp
+(the SSE2 tier and the dispatch) and FloatingPointAVX.cpp (the AVX tiers, compiled with /arch:AVX) include this file.
+The kernels are in an anonymous namespace, so that the linker never picks a copy compiled for AVX for the SSE2 code.
+For the same reason they don't call the inline functions of the other headers, which do floating point math. */
+
+namespace FastNets
+{
+	//The kernels of a single instruction set:
+	template<class T>
+	struct ForwardKernels
+	{
+		void (*ProcessInput)(const T*, T*, unsigned, unsigned, const T*, const T*);
+		void (*ProcessBatch)(const T*, T*, unsigned, unsigned, unsigned, const T*, const T*);
+	};
+
+	template<class T>
+	struct ActivationKernels
+	{
+		void (*Apply[ActivationCount])(T*, unsigned);
+		void (*ApplyDerivative[ActivationCount])(const T*, T*, unsigned);
+		void (*Exp)(T*, unsigned);
+	};
+
+	//The batch kernels take the number of threads from the cost model (see ChooseParallelism):
+	template<class T>
+	struct OptimizerKernels
+	{
+		void (*UpdateWeights[OptimizerCount])(const T*, const T*, unsigned, unsigned, T*, T*, const OptimizerState<T>&, const Optimizer&, double);
+		void (*UpdateWeightsBatch[OptimizerCount])(const T*, const T*, unsigned, unsigned, unsigned, T*, T*, const OptimizerState<T>&, const Optimizer&, 
+												   double, int);
+	};
+
+	struct MixedPrecisionKernels
+	{
+		void (*ApplyGradients[OptimizerCount])(const float*, const float*, unsigned, unsigned, double*, double*, 
+											   const OptimizerState<double>&, const Optimizer&, double, float*, float*, int);
+	};
+
+	template<class T>
+	struct BackwardKernels
+	{
+		double (*OutputDeltas)(const T*, const T*, T*, unsigned);
+		void (*InputDeltas)(const T*, T*, unsigned, unsigned, const T*, unsigned);
+	};
+
+	struct KernelTable
+	{
+		ForwardKernels<double>		DoubleForward;
+		ForwardKernels<float>		FloatForward;
+		BackwardKernels<double>		DoubleBackward;
+		BackwardKernels<float>		FloatBackward;
+		OptimizerKernels<double>	DoubleOptimizer;
+		OptimizerKernels<float>		FloatOptimizer;
+		MixedPrecisionKernels		MixedPrecision;
+		ActivationKernels<double>	DoubleActivation;
+		ActivationKernels<float>	FloatActivation;
+		void (*Int8DotProducts)(const unsigned char*, int*, unsigned, unsigned, const signed char*);
+		void (*DoubleCrossover)(const double*, const double*, double*, unsigned, const unsigned long long*);
+		void (*FloatCrossover)(const float*, const float*, float*, unsigned, const unsigned long long*);
+		unsigned (*DoubleUniform)(const unsigned*, const unsigned*, double*, unsigned);
+		unsigned (*FloatUniform)(const unsigned*, const unsigned*, float*, unsigned);
+	};
+
+	//The kernels of the AVX tiers (see FloatingPointAVX.cpp). Returns false for the other tiers:
+	bool MakeAVXKernels(KernelTier tier, KernelTable& kernels);
+
+namespace
+{
+	//Vectorized activation functions. "Output" calculates the outputs from the weighted sums and
+	//"Derivative" the derivative of the output by the sum, as a function of the output:
+	template<class V>
+	struct IdentitySimd
+	{
+		static typename V::Vector Output(typename V::Vector input) { return input; }
+		static typename V::Vector Derivative(typename V::Vector output) { return V::Set(1); }
+	};
+
+	template<class V>
+	struct ReLUSimd
+	{
+		static typename V::Vector Output(typename V::Vector input) { return V::Max(input, V::Zero()); }
+		static typename V::Vector Derivative(typename V::Vector output) { return V::Step(output); }
+	};
+
+	template<class V>
+	struct LeakyReLUSimd
+	{
+		static typename V::Vector Output(typename V::Vector input)
+		{
+			return V::Max(input, V::Mul(input, V::Set((typename V::Type)LeakyReLUSlope)));
+		}
+		static typename V::Vector Derivative(typename V::Vector output)
+		{
+			//The output has the sign of the input:
+			return V::MulAdd(V::Step(output), V::Set((typename V::Type)(1 - LeakyReLUSlope)), V::Set((typename V::Type)LeakyReLUSlope));
+		}
+	};
+
+	template<class V>
+	struct SigmoidSimd
+	{
+		static typename V::Vector Output(typename V::Vector input)
+		{
+			typename V::Vector one = V::Set(1);
+			return V::Div(one, V::Add(one, Simd::Exp<V>(V::Sub(V::Zero(), input))));
+		}
+		static typename V::Vector Derivative(typename V::Vector output) { return V::Mul(output, V::Sub(V::Set(1), output)); }
+	};
+
+	template<class V>
+	struct TanhSimd
+	{
+		static typename V::Vector Output(typename V::Vector input)
+		{
+			typename V::Vector one = V::Set(1);
+			return V::Sub(one, V::Div(V::Set(2), V::Add(one, Simd::Exp<V>(V::Add(input, input)))));
+		}
+		static typename V::Vector Derivative(typename V::Vector output)
+		{
+			typename V::Vector one = V::Set(1);
+			return V::Mul(V::Sub(one, output), V::Add(one, output));
+		}
+	};
+
+	//Not an activation, the exp under the sigmoid, tanh and softmax (see ApplyExp):
+	template<class V>
+	struct ExpSimd
+	{
+		static typename V::Vector Output(typename V::Vector input) { return Simd::Exp<V>(input); }
+	};
+
+	//Copies the last count % Width elements in a zero padded vector, so that they go through 
+	//the same vectorized function as the rest:
+	template<class V>
+	unsigned LoadRest(const typename V::Type* values, unsigned count, typename V::Type* rest)
+	{
+		const unsigned countVector = count - count % V::Width;
+		for (unsigned i = 0; i < V::Width; ++i)
+		{
+			rest[i] = (countVector + i < count) ? values[countVector + i] : 0;
+		}
+		return countVector;
+	}
+
+	template<class V>
+	void StoreRest(const typename V::Type* rest, unsigned count, typename V::Type* values)
+	{
+		const unsigned countVector = count - count % V::Width;
+		for (unsigned i = countVector; i < count; ++i)
+		{
+			values[i] = rest[i - countVector];
+		}
+	}
+
+	template<class V, class F>
+	void ApplyActivationSimd(typename V::Type* values, unsigned count)
+	{
+		const unsigned countVector = count - count % V::Width;
+		for (unsigned i = 0; i < countVector; i += V::Width)
+		{
+			V::Store(values + i, F::Output(V::Load(values + i)));
+		}
+		if (countVector < count)
+		{
+			_CRT_ALIGN(64) typename V::Type rest[V::Width];
+			LoadRest<V>(values, count, rest);
+			V::Store(rest, F::Output(V::Load(rest)));
+			StoreRest<V>(rest, count, values);
+		}
+	}
+
+	template<class V, class F>
+	void ApplyDerivativeSimd(const typename V::Type* outputs, typename V::Type* deltas, unsigned count)
+	{
+		const unsigned countVector = count - count % V::Width;
+		for (unsigned i = 0; i < countVector; i += V::Width)
+		{
+			V::Store(deltas + i, V::Mul(V::Load(deltas + i), F::Derivative(V::Load(outputs + i))));
+		}
+		if (countVector < count)
+		{
+			_CRT_ALIGN(64) typename V::Type restOutputs[V::Width];
+			_CRT_ALIGN(64) typename V::Type restDeltas[V::Width];
+			LoadRest<V>(outputs, count, restOutputs);
+			LoadRest<V>(deltas, count, restDeltas);
+			V::Store(restDeltas, V::Mul(V::Load(restDeltas), F::Derivative(V::Load(restOutputs))));
+			StoreRest<V>(restDeltas, count, deltas);
+		}
+	}
+
+	//Softmax is not element-wise: output[i] = exp(input[i])/sum(exp(input)). The maximum is subtracted first,
+	//so that the exp doesn't overflow.
+	template<class V>
+	void ApplySoftmaxSimd(typename V::Type* values, unsigned count)
+	{
+		typedef typename V::Type T;
+		T maxValue = values[0];
+		for (unsigned i = 1; i < count; ++i)
+		{
+			if (maxValue < values[i])
+				maxValue = values[i];
+		}
+		const typename V::Vector vMax = V::Set(maxValue);
+		const unsigned countVector = count - count % V::Width;
+		typename V::Vector vSum = V::Zero();
+		for (unsigned i = 0; i < countVector; i += V::Width)
+		{
+			typename V::Vector e = Simd::Exp<V>(V::Sub(V::Load(values + i), vMax));
+			vSum = V::Add(vSum, e);
+			V::Store(values + i, e);
+		}
+		T sum = V::Sum(vSum);
+		_CRT_ALIGN(64) T rest[V::Width];
+		if (countVector < count)
+		{
+			LoadRest<V>(values, count, rest);
+			V::Store(rest, Simd::Exp<V>(V::Sub(V::Load(rest), vMax)));
+			for (unsigned i = countVector; i < count; ++i)
+			{
+				sum += rest[i - countVector];
+			}
+		}
+		const typename V::Vector vScale = V::Set(1/sum);
+		for (unsigned i = 0; i < countVector; i += V::Width)
+		{
+			V::Store(values + i, V::Mul(V::Load(values + i), vScale));
+		}
+		if (countVector < count)
+		{
+			V::Store(rest, V::Mul(V::Load(rest), vScale));
+			StoreRest<V>(rest, count, values);
+		}
+	}
+
+	//The Jacobian of the softmax is diag(output) - output*transpose(output), so:
+	//delta[i] = output[i]*(delta[i] - sum(delta[j]*output[j]))
+	template<class V>
+	void ApplySoftmaxDerivativeSimd(const typename V::Type* outputs, typename V::Type* deltas, unsigned count)
+	{
+		typedef typename V::Type T;
+		const unsigned countVector = count - count % V::Width;
+		typename V::Vector vDot = V::Zero();
+		for (unsigned i = 0; i < countVector; i += V::Width)
+		{
+			vDot = V::MulAdd(V::Load(deltas + i), V::Load(outputs + i), vDot);
+		}
+		_CRT_ALIGN(64) T restOutputs[V::Width];
+		_CRT_ALIGN(64) T restDeltas[V::Width];
+		if (countVector < count)
+		{
+			//The padding is 0, so it adds nothing to the dot product:
+			LoadRest<V>(outputs, count, restOutputs);
+			LoadRest<V>(deltas, count, restDeltas);
+			vDot = V::MulAdd(V::Load(restDeltas), V::Load(restOutputs), vDot);
+		}
+		const typename V::Vector vSum = V::Set(V::Sum(vDot));
+		for (unsigned i = 0; i < countVector; i += V::Width)
+		{
+			V::Store(deltas + i, V::Mul(V::Load(outputs + i), V::Sub(V::Load(deltas + i), vSum)));
+		}
+		if (countVector < count)
+		{
+			V::Store(restDeltas, V::Mul(V::Load(restOutputs), V::Sub(V::Load(restDeltas), vSum)));
+			StoreRest<V>(restDeltas, count, deltas);
+		}
+	}
+
+	//The "bias" can be NULL:
+	template<class V>
+	void ProcessInput(const typename V::Type* input, typename V::Type* output, unsigned inputSize, unsigned outputSize, 
+					  const typename V::Type* weights, const typename V::Type* bias)
+	{
+		typedef typename V::Type T;
+		const unsigned alignedInputSize = AVXAlign<T>(inputSize);
+		const unsigned sizeUnrolled = inputSize - inputSize % (2*V::Width);
+		const unsigned sizeVector = inputSize - inputSize % V::Width;
+		for (unsigned i = 0; i < outputSize; ++i)
+		{
+			const T* pWeights = &weights[i*alignedInputSize];
+			typename V::Vector res1 = V::Zero();
+			typename V::Vector res2 = V::Zero();
+			unsigned j = 0;
+			for (; j < sizeUnrolled; j += 2*V::Width)
+			{
+				res1 = V::MulAdd(V::Load(input + j), V::Load(pWeights + j), res1);
+				res2 = V::MulAdd(V::Load(input + j + V::Width), V::Load(pWeights + j + V::Width), res2);
+			}
+			if (j < sizeVector)
+			{
+				res1 = V::MulAdd(V::Load(input + j), V::Load(pWeights + j), res1);
+				j += V::Width;
+			}
+			T result = (bias ? bias[i] : 0) + V::Sum(V::Add(res1, res2));
+			//Now deal with the rest:
+			for (; j < inputSize; ++j)
+			{
+				result += pWeights[j]*input[j];
+			}
+			output[i] = result;
+		}
+	}
+
+	//Register-blocked microkernel: calculates NEURONS outputs for 4 consecutive samples.
+	//Each loaded input vector is reused for all NEURONS and each weight vector for all 4 samples.
+	template<class V, unsigned NEURONS>
+	inline void ProcessBlock4(const typename V::Type* input, typename V::Type* output, unsigned inputSize, unsigned inputStride, unsigned outputStride, 
+							  const typename V::Type* weights, const typename V::Type* bias)
+	{
+		typedef typename V::Type T;
+		typename V::Vector accum[NEURONS][4];
+		for (unsigned n = 0; n < NEURONS; ++n)
+		{
+			for (unsigned s = 0; s < 4; ++s)
+				accum[n][s] = V::Zero();
+		}
+
+		const unsigned sizeVector = inputSize - inputSize % V::Width;
+		for (unsigned k = 0; k < sizeVector; k += V::Width)
+		{
+			typename V::Vector in0 = V::Load(input + k);
+			typename V::Vector in1 = V::Load(input + inputStride + k);
+			typename V::Vector in2 = V::Load(input + 2*inputStride + k);
+			typename V::Vector in3 = V::Load(input + 3*inputStride + k);
+			for (unsigned n = 0; n < NEURONS; ++n)
+			{
+				typename V::Vector w = V::Load(weights + n*inputStride + k);
+				accum[n][0] = V::MulAdd(in0, w, accum[n][0]);
+				accum[n][1] = V::MulAdd(in1, w, accum[n][1]);
+				accum[n][2] = V::MulAdd(in2, w, accum[n][2]);
+				accum[n][3] = V::MulAdd(in3, w, accum[n][3]);
+			}
+		}
+
+		for (unsigned n = 0; n < NEURONS; ++n)
+		{
+			_CRT_ALIGN(32) T sums[4];
+			V::Sum4(accum[n][0], accum[n][1], accum[n][2], accum[n][3], sums);
+			const T* pWeights = weights + n*inputStride;
+			for (unsigned s = 0; s < 4; ++s)
+			{
+				//Now deal with the rest:
+				const T* pInput = input + s*inputStride;
+				T result = (bias ? bias[n] : 0) + sums[s];
+				for (unsigned k = sizeVector; k < inputSize; ++k)
+				{
+					result += pWeights[k]*pInput[k];
+				}
+				output[s*outputStride + n] = result;
+			}
+		}
+	}
+
+	//The "bias" can be NULL:
+	template<class V>
+	void ProcessBatch(const typename V::Type* input, typename V::Type* output, unsigned rowCount, unsigned inputSize, unsigned outputSize, 
+					  const typename V::Type* weights, const typename V::Type* bias)
+	{
+		typedef typename V::Type T;
+		const unsigned inputStride = AVXAlign<T>(inputSize);
+		const unsigned outputStride = AVXAlign<T>(outputSize);
+		const unsigned rowCount4 = rowCount & ~3u;
+		const unsigned outputSize2 = outputSize & ~1u;
+		//The weights of two neurons stay in L1, while we sweep over the samples:
+		for (unsigned n = 0; n < outputSize2; n += 2)
+		{
+			for (unsigned s = 0; s < rowCount4; s += 4)
+			{
+				ProcessBlock4<V, 2>(input + s*inputStride, output + s*outputStride + n, inputSize, inputStride, outputStride, weights + n*inputStride, bias ? bias + n : NULL);
+			}
+		}
+		if (outputSize2 != outputSize)
+		{
+			for (unsigned s = 0; s < rowCount4; s += 4)
+			{
+				ProcessBlock4<V, 1>(input + s*inputStride, output + s*outputStride + outputSize2, inputSize, inputStride, outputStride, weights + outputSize2*inputStride, bias ? bias + outputSize2 : NULL);
+			}
+		}
+		//The remaining samples go one by one:
+		for (unsigned s = rowCount4; s < rowCount; ++s)
+		{
+			ProcessInput<V>(input + s*inputStride, output + s*outputStride, inputSize, outputSize, weights, bias);
+		}
+	}
+
+	/* The optimizer rules (see OptimizerType). "Change" calculates the changes of the weights from their gradients
+	and updates the state of the weights at index "j" of "pVelocity" and "pSquares". The buffers, which the
+	rule doesn't use, can be NULL. The kernels below use the Simd::Scalar version for the tails. */
+	template<class V>
+	struct OptimizerRule
+	{
+		typedef typename V::Type T;
+		typedef typename V::Vector Vector;
+		Vector Rate, Momentum, Decay, Epsilon, OneMinusMomentum, OneMinusDecay;
+
+		OptimizerRule(const Optimizer& optimizer, double learningRate)
+			:Rate(V::Set((T)learningRate)), Momentum(V::Set((T)optimizer.Momentum)), Decay(V::Set((T)optimizer.Decay)),
+			Epsilon(V::Set((T)optimizer.Epsilon)), OneMinusMomentum(V::Set((T)(1 - optimizer.Momentum))), 
+			OneMinusDecay(V::Set((T)(1 - optimizer.Decay)))
+		{
+		}
+	};
+
+	template<class V>
+	struct SGDRule : public OptimizerRule<V>
+	{
+		SGDRule(const Optimizer& optimizer, double learningRate):OptimizerRule<V>(optimizer, learningRate){}
+		typename V::Vector Change(typename V::Vector gradient, typename V::Type* pVelocity, typename V::Type* pSquares, unsigned j) const
+		{
+			return V::Mul(this->Rate, gradient);
+		}
+	};
+
+	template<class V>
+	struct MomentumRule : public OptimizerRule<V>
+	{
+		MomentumRule(const Optimizer& optimizer, double learningRate):OptimizerRule<V>(optimizer, learningRate){}
+		typename V::Vector Change(typename V::Vector gradient, typename V::Type* pVelocity, typename V::Type* pSquares, unsigned j) const
+		{
+			typename V::Vector change = V::MulAdd(this->Momentum, V::Load(pVelocity + j), V::Mul(this->Rate, gradient));
+			V::Store(pVelocity + j, change);
+			return change;
+		}
+	};
+
+	//The momentum step is taken from the point, where the current one leads:
+	template<class V>
+	struct NesterovRule : public OptimizerRule<V>
+	{
+		NesterovRule(const Optimizer& optimizer, double learningRate):OptimizerRule<V>(optimizer, learningRate){}
+		typename V::Vector Change(typename V::Vector gradient, typename V::Type* pVelocity, typename V::Type* pSquares, unsigned j) const
+		{
+			typename V::Vector step = V::Mul(this->Rate, gradient);
+			typename V::Vector velocity = V::MulAdd(this->Momentum, V::Load(pVelocity + j), step);
+			V::Store(pVelocity + j, velocity);
+			return V::MulAdd(this->Momentum, velocity, step);
+		}
+	};
+
+	template<class V>
+	struct RMSPropRule : public OptimizerRule<V>
+	{
+		RMSPropRule(const Optimizer& optimizer, double learningRate):OptimizerRule<V>(optimizer, learningRate){}
+		typename V::Vector Change(typename V::Vector gradient, typename V::Type* pVelocity, typename V::Type* pSquares, unsigned j) const
+		{
+			typename V::Vector squares = V::MulAdd(this->Decay, V::Load(pSquares + j), V::Mul(this->OneMinusDecay, V::Mul(gradient, gradient)));
+			V::Store(pSquares + j, squares);
+			return V::Div(V::Mul(this->Rate, gradient), V::Add(V::Sqrt(squares), this->Epsilon));
+		}
+	};
+
+	template<class V>
+	struct AdamRule : public OptimizerRule<V>
+	{
+		AdamRule(const Optimizer& optimizer, double learningRate):OptimizerRule<V>(optimizer, learningRate){}
+		typename V::Vector Change(typename V::Vector gradient, typename V::Type* pVelocity, typename V::Type* pSquares, unsigned j) const
+		{
+			typename V::Vector mean = V::MulAdd(this->Momentum, V::Load(pVelocity + j), V::Mul(this->OneMinusMomentum, gradient));
+			typename V::Vector squares = V::MulAdd(this->Decay, V::Load(pSquares + j), V::Mul(this->OneMinusDecay, V::Mul(gradient, gradient)));
+			V::Store(pVelocity + j, mean);
+			V::Store(pSquares + j, squares);
+			return V::Div(V::Mul(this->Rate, mean), V::Add(V::Sqrt(squares), this->Epsilon));
+		}
+	};
+
+	//The gradient of each weight is outputDelta*input and of each bias the outputDelta:
+	template<class V, template<class> class Rule>
+	void UpdateWeightsSimd(const typename V::Type* input, const typename V::Type* outputDelta, unsigned inputSize, unsigned outputSize,
+						   typename V::Type* weights, typename V::Type* bias, const OptimizerState<typename V::Type>& state, 
+						   const Optimizer& optimizer, double learningRate)
+	{
+		typedef typename V::Type T;
+		const unsigned alignedInputSize = AVXAlign<T>(inputSize);
+		const unsigned sizeVector = inputSize - inputSize % V::Width;
+		const Rule<V> rule(optimizer, learningRate);
+		const Rule<Simd::Scalar<T> > scalarRule(optimizer, learningRate);
+		for (unsigned i = 0; i < outputSize; ++i)
+		{
+			T* pWeights = weights + i*alignedInputSize;
+			T* pVelocity = state.Velocity ? state.Velocity + i*alignedInputSize : NULL;
+			T* pSquares = state.Squares ? state.Squares + i*alignedInputSize : NULL;
+			const typename V::Vector vDelta = V::Set(outputDelta[i]);
+			for (unsigned j = 0; j < sizeVector; j += V::Width)
+			{
+				typename V::Vector change = rule.Change(V::Mul(vDelta, V::Load(input + j)), pVelocity, pSquares, j);
+				V::Store(pWeights + j, V::Add(V::Load(pWeights + j), change));
+			}
+			for (unsigned j = sizeVector; j < inputSize; ++j)
+			{
+				pWeights[j] += scalarRule.Change(outputDelta[i]*input[j], pVelocity, pSquares, j);
+			}
+		}
+
+		const unsigned outputVector = outputSize - outputSize % V::Width;
+		for (unsigned i = 0; i < outputVector; i += V::Width)
+		{
+			typename V::Vector change = rule.Change(V::Load(outputDelta + i), state.BiasVelocity, state.BiasSquares, i);
+			V::Store(bias + i, V::Add(V::Load(bias + i), change));
+		}
+		for (unsigned i = outputVector; i < outputSize; ++i)
+		{
+			bias[i] += scalarRule.Change(outputDelta[i], state.BiasVelocity, state.BiasSquares, i);
+		}
+	}
+
+	//deltas = expected - output. Returns the sum of the squares of the deltas:
+	template<class V>
+	double OutputDeltasSimd(const typename V::Type* output, const typename V::Type* expected, typename V::Type* deltas, unsigned count)
+	{
+		typedef typename V::Type T;
+		const unsigned countVector = count - count % V::Width;
+		typename V::Vector squares = V::Zero();
+		for (unsigned i = 0; i < countVector; i += V::Width)
+		{
+			typename V::Vector delta = V::Sub(V::Load(expected + i), V::Load(output + i));
+			V::Store(deltas + i, delta);
+			squares = V::MulAdd(delta, delta, squares);
+		}
+		double squaresSum = V::Sum(squares);
+		for (unsigned i = countVector; i < count; ++i)
+		{
+			T delta = expected[i] - output[i];
+			deltas[i] = delta;
+			squaresSum += delta*delta;
+		}
+		return squaresSum;
+	}
+
+	/* inputDelta = transpose(weights)*outputDelta, as AXPYs over the rows of the weights, which are "stride" elements
+	apart, so no transposed copy is needed. Each block of 4 input vectors stays in registers over all the rows. */
+	template<class V>
+	void InputDeltasSimd(const typename V::Type* outputDelta, typename V::Type* inputDelta, unsigned inputSize, unsigned outputSize,
+						 const typename V::Type* weights, unsigned stride)
+	{
+		typedef typename V::Type T;
+		const unsigned blockEnd = inputSize - inputSize % (4*V::Width);
+		const unsigned sizeVector = inputSize - inputSize % V::Width;
+		for (unsigned j = 0; j < blockEnd; j += 4*V::Width)
+		{
+			typename V::Vector sum0 = V::Zero(), sum1 = V::Zero(), sum2 = V::Zero(), sum3 = V::Zero();
+			const T* pWeights = weights + j;
+			for (unsigned i = 0; i < outputSize; ++i, pWeights += stride)
+			{
+				const typename V::Vector delta = V::Set(outputDelta[i]);
+				sum0 = V::MulAdd(delta, V::Load(pWeights), sum0);
+				sum1 = V::MulAdd(delta, V::Load(pWeights + V::Width), sum1);
+				sum2 = V::MulAdd(delta, V::Load(pWeights + 2*V::Width), sum2);
+				sum3 = V::MulAdd(delta, V::Load(pWeights + 3*V::Width), sum3);
+			}
+			V::Store(inputDelta + j, sum0);
+			V::Store(inputDelta + j + V::Width, sum1);
+			V::Store(inputDelta + j + 2*V::Width, sum2);
+			V::Store(inputDelta + j + 3*V::Width, sum3);
+		}
+		for (unsigned j = blockEnd; j < sizeVector; j += V::Width)
+		{
+			typename V::Vector sum = V::Zero();
+			for (unsigned i = 0; i < outputSize; ++i)
+			{
+				sum = V::MulAdd(V::Set(outputDelta[i]), V::Load(weights + i*stride + j), sum);
+			}
+			V::Store(inputDelta + j, sum);
+		}
+		for (unsigned j = sizeVector; j < inputSize; ++j)
+		{
+			T sum = 0;
+			for (unsigned i = 0; i < outputSize; ++i)
+			{
+				sum += outputDelta[i]*weights[i*stride + j];
+			}
+			inputDelta[j] = sum;
+		}
+	}
+
+	template<class T>
+	double OutputError(const T* actualOutput, const T* expectedOutput, unsigned outputNum)
+	{
+		double squaresSum = 0;
+		for (unsigned j = 0; j < outputNum; ++j)
+		{
+			double delta = expectedOutput[j] - actualOutput[j];
+			squaresSum += delta*delta;
+		}
+		squaresSum /= outputNum;
+		return squaresSum;
+	}
+
+	/* Mini-batch update: the gradient of each weight is the average over the rows of outputDelta*input, i.e.
+	transpose(outputDelta)*input/rowCount. Each output row accumulates a block of 4 input vectors in registers over all
+	the rows of the batch, while that block of the inputs stays in L1 for all the outputs. The optimizer rule
+	is fused, so the gradients are never stored. */
+	template<class V, template<class> class Rule>
+	void UpdateWeightsBatchSimd(const typename V::Type* input, const typename V::Type* outputDelta, unsigned rowCount, unsigned inputSize, 
+								unsigned outputSize, typename V::Type* weights, typename V::Type* bias, const OptimizerState<typename V::Type>& state, 
+								const Optimizer& optimizer, double learningRate, int threads)
+	{
+		typedef typename V::Type T;
+		typedef typename V::Vector Vector;
+		const unsigned inputStride = AVXAlign<T>(inputSize);
+		const unsigned outputStride = AVXAlign<T>(outputSize);
+		const unsigned sizeBlock = inputSize - inputSize % (4*V::Width);
+		const unsigned sizeVector = inputSize - inputSize % V::Width;
+		const T inverseRows = (T)(1.0/rowCount);
+		const Vector vInverseRows = V::Set(inverseRows);
+		const Rule<V> rule(optimizer, learningRate);
+		const Rule<Simd::Scalar<T> > scalarRule(optimizer, learningRate);
+		#pragma omp parallel for num_threads(threads) if (threads > 1)
+		for (int i = 0; i < (int)outputSize; ++i)
+		{
+			T* pWeights = weights + i*inputStride;
+			T* pVelocity = state.Velocity ? state.Velocity + i*inputStride : NULL;
+			T* pSquares = state.Squares ? state.Squares + i*inputStride : NULL;
+			unsigned j = 0;
+			for (; j < sizeBlock; j += 4*V::Width)
+			{
+				Vector accum0 = V::Zero(), accum1 = V::Zero(), accum2 = V::Zero(), accum3 = V::Zero();
+				for (unsigned s = 0; s < rowCount; ++s)
+				{
+					const T* pInput = input + s*inputStride + j;
+					const Vector delta = V::Set(outputDelta[s*outputStride + i]);
+					accum0 = V::MulAdd(delta, V::Load(pInput), accum0);
+					accum1 = V::MulAdd(delta, V::Load(pInput + V::Width), accum1);
+					accum2 = V::MulAdd(delta, V::Load(pInput + 2*V::Width), accum2);
+					accum3 = V::MulAdd(delta, V::Load(pInput + 3*V::Width), accum3);
+				}
+				Vector accum[4] = { accum0, accum1, accum2, accum3 };
+				for (unsigned k = 0; k < 4; ++k)
+				{
+					const unsigned index = j + k*V::Width;
+					Vector change = rule.Change(V::Mul(vInverseRows, accum[k]), pVelocity, pSquares, index);
+					V::Store(pWeights + index, V::Add(V::Load(pWeights + index), change));
+				}
+			}
+			for (; j < sizeVector; j += V::Width)
+			{
+				Vector accum = V::Zero();
+				for (unsigned s = 0; s < rowCount; ++s)
+				{
+					accum = V::MulAdd(V::Set(outputDelta[s*outputStride + i]), V::Load(input + s*inputStride + j), accum);
+				}
+				Vector change = rule.Change(V::Mul(vInverseRows, accum), pVelocity, pSquares, j);
+				V::Store(pWeights + j, V::Add(V::Load(pWeights + j), change));
+			}
+			for (; j < inputSize; ++j)
+			{
+				T accum = 0;
+				for (unsigned s = 0; s < rowCount; ++s)
+				{
+					accum += outputDelta[s*outputStride + i]*input[s*inputStride + j];
+				}
+				pWeights[j] += scalarRule.Change(inverseRows*accum, pVelocity, pSquares, j);
+			}
+			T biasGradient = 0;
+			for (unsigned s = 0; s < rowCount; ++s)
+			{
+				biasGradient += outputDelta[s*outputStride + i];
+			}
+			bias[i] += scalarRule.Change(inverseRows*biasGradient, state.BiasVelocity, state.BiasSquares, i);
+		}
+	}
+
+	//The double precision master weights from single precision gradients (see ApplyGradients):
+	template<class V, template<class> class Rule>
+	void ApplyGradientsSimd(const float* gradients, const float* biasGradients, unsigned inputSize, unsigned outputSize, double* weights, double* bias,
+							const OptimizerState<double>& state, const Optimizer& optimizer, double learningRate, float* floatWeights, float* floatBias,
+							int threads)
+	{
+		typedef typename V::Vector Vector;
+		const unsigned doubleStride = AVXAlign<double>(inputSize);
+		const unsigned floatStride = AVXAlign<float>(inputSize);
+		const unsigned sizeVector = inputSize - inputSize % V::Width;
+		const Rule<V> rule(optimizer, learningRate);
+		const Rule<Simd::Scalar<double> > scalarRule(optimizer, learningRate);
+		#pragma omp parallel for num_threads(threads) if (threads > 1)
+		for (int i = 0; i < (int)outputSize; ++i)
+		{
+			double* pWeights = weights + i*doubleStride;
+			double* pVelocity = state.Velocity ? state.Velocity + i*doubleStride : NULL;
+			double* pSquares = state.Squares ? state.Squares + i*doubleStride : NULL;
+			const float* pGradients = gradients + i*floatStride;
+			float* pFloatWeights = floatWeights + i*floatStride;
+			for (unsigned j = 0; j < sizeVector; j += V::Width)
+			{
+				Vector weight = V::Add(V::Load(pWeights + j), rule.Change(V::LoadFloat(pGradients + j), pVelocity, pSquares, j));
+				V::Store(pWeights + j, weight);
+				V::StoreFloat(pFloatWeights + j, weight);
+			}
+			for (unsigned j = sizeVector; j < inputSize; ++j)
+			{
+				pWeights[j] += scalarRule.Change(pGradients[j], pVelocity, pSquares, j);
+				pFloatWeights[j] = (float)pWeights[j];
+			}
+			bias[i] += scalarRule.Change(biasGradients[i], state.BiasVelocity, state.BiasSquares, i);
+			floatBias[i] = (float)bias[i];
+		}
+	}
+
+	/* Int8 dot products (see ProcessInputInt8). The inputs are 0..127, so each pair of products
+	of _mm_maddubs_epi16 fits in 16 bits without saturation. */
+	struct Int8Scalar
+	{
+		static void DotProducts(const unsigned char* input, int* output, unsigned alignedInputSize, unsigned outputSize, const signed char* weights)
+		{
+			for (unsigned i = 0; i < outputSize; ++i)
+			{
+				const signed char* pWeights = weights + i*alignedInputSize;
+				int accum = 0;
+				for (unsigned j = 0; j < alignedInputSize; ++j)
+				{
+					accum += input[j]*pWeights[j];
+				}
+				output[i] = accum;
+			}
+		}
+	};
+
+	//SSSE3 is available on all AVX CPUs:
+	struct Int8SSSE3
+	{
+		static void DotProducts(const unsigned char* input, int* output, unsigned alignedInputSize, unsigned outputSize, const signed char* weights)
+		{
+			const __m128i ones = _mm_set1_epi16(1);
+			for (unsigned i = 0; i < outputSize; ++i)
+			{
+				const signed char* pWeights = weights + i*alignedInputSize;
+				__m128i accum = _mm_setzero_si128();
+				for (unsigned j = 0; j < alignedInputSize; j += 16)
+				{
+					__m128i products = _mm_maddubs_epi16(_mm_load_si128((const __m128i*)(input + j)), _mm_load_si128((const __m128i*)(pWeights + j)));
+					accum = _mm_add_epi32(accum, _mm_madd_epi16(products, ones));
+				}
+				accum = _mm_add_epi32(accum, _mm_shuffle_epi32(accum, _MM_SHUFFLE(1, 0, 3, 2)));
+				accum = _mm_add_epi32(accum, _mm_shuffle_epi32(accum, _MM_SHUFFLE(2, 3, 0, 1)));
+				output[i] = _mm_cvtsi128_si32(accum);
+			}
+		}
+	};
+
+	struct Int8AVX2
+	{
+		static int Sum(__m256i v)
+		{
+			__m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+			sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+			sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_cvtsi128_si32(sum);
+		}
+
+		//4 rows at a time, so that each input load is reused 4 times:
+		static void DotProducts(const unsigned char* input, int* output, unsigned alignedInputSize, unsigned outputSize, const signed char* weights)
+		{
+			const __m256i ones = _mm256_set1_epi16(1);
+			const unsigned outputSize4 = outputSize - outputSize % 4;
+			for (unsigned i = 0; i < outputSize4; i += 4)
+			{
+				const signed char* pWeights = weights + i*alignedInputSize;
+				__m256i accum0 = _mm256_setzero_si256(), accum1 = _mm256_setzero_si256();
+				__m256i accum2 = _mm256_setzero_si256(), accum3 = _mm256_setzero_si256();
+				for (unsigned j = 0; j < alignedInputSize; j += 32)
+				{
+					__m256i in = _mm256_load_si256((const __m256i*)(input + j));
+					accum0 = _mm256_add_epi32(accum0, _mm256_madd_epi16(_mm256_maddubs_epi16(in, 
+						_mm256_load_si256((const __m256i*)(pWeights + j))), ones));
+					accum1 = _mm256_add_epi32(accum1, _mm256_madd_epi16(_mm256_maddubs_epi16(in, 
+						_mm256_load_si256((const __m256i*)(pWeights + alignedInputSize + j))), ones));
+					accum2 = _mm256_add_epi32(accum2, _mm256_madd_epi16(_mm256_maddubs_epi16(in, 
+						_mm256_load_si256((const __m256i*)(pWeights + 2*alignedInputSize + j))), ones));
+					accum3 = _mm256_add_epi32(accum3, _mm256_madd_epi16(_mm256_maddubs_epi16(in, 
+						_mm256_load_si256((const __m256i*)(pWeights + 3*alignedInputSize + j))), ones));
+				}
+				output[i] = Sum(accum0);
+				output[i + 1] = Sum(accum1);
+				output[i + 2] = Sum(accum2);
+				output[i + 3] = Sum(accum3);
+			}
+			for (unsigned i = outputSize4; i < outputSize; ++i)
+			{
+				const signed char* pWeights = weights + i*alignedInputSize;
+				__m256i accum = _mm256_setzero_si256();
+				for (unsigned j = 0; j < alignedInputSize; j += 32)
+				{
+					accum = _mm256_add_epi32(accum, _mm256_madd_epi16(_mm256_maddubs_epi16(_mm256_load_si256((const __m256i*)(input + j)), 
+						_mm256_load_si256((const __m256i*)(pWeights + j))), ones));
+				}
+				output[i] = Sum(accum);
+			}
+		}
+	};
+
+	/* Genetic crossover: bit j of the "masks" selects second[j] over first[j]. The width of the vectors divides 64,
+	so the bits of a vector never span two masks. */
+	template<class V>
+	void CrossoverSimd(const typename V::Type* first, const typename V::Type* second, typename V::Type* target, unsigned count, 
+					   const unsigned long long* masks)
+	{
+		unsigned j = 0;
+		for (; j + V::Width <= count; j += V::Width)
+		{
+			const unsigned bits = (unsigned)(masks[j/64] >> (j % 64));
+			V::Store(target + j, V::Blend(V::Load(first + j), V::Load(second + j), bits));
+		}
+		for (; j < count; ++j)
+		{
+			target[j] = ((masks[j/64] >> (j % 64)) & 1) ? second[j] : first[j];
+		}
+	}
+
+	/* Philox blocks (see PhiloxBlock) in the lanes of the integer vectors: vector j holds word j of P::Lanes consecutive
+	counters. There is no unsigned 32x32 multiply with the high half, so _mm_mul_epu32 multiplies the even lanes and
+	the odd ones separately. SSE2 is used on the AVX tier too, as AVX has no 256 bit integer instructions. */
+	struct PhiloxSSE2
+	{
+		typedef __m128i Vector;
+		static const unsigned Lanes = 4;
+		static Vector Set(unsigned value) { return _mm_set1_epi32((int)value); }
+		static Vector Xor(Vector a, Vector b) { return _mm_xor_si128(a, b); }
+		static Vector Positions(unsigned first) { return _mm_add_epi32(Set(first), _mm_set_epi32(3, 2, 1, 0)); }
+
+		static void MulHiLo(Vector a, unsigned multiplier, Vector& hi, Vector& lo)
+		{
+			const Vector m = Set(multiplier);
+			const Vector even = _mm_mul_epu32(a, m);
+			const Vector odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+			const Vector low = _mm_set_epi32(0, -1, 0, -1);
+			lo = _mm_or_si128(_mm_and_si128(even, low), _mm_slli_epi64(odd, 32));
+			hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(low, odd));
+		}
+
+		//From a word per vector to a block per vector, in the order of the blocks:
+		static void Transpose(Vector* v)
+		{
+			const Vector t0 = _mm_unpacklo_epi32(v[0], v[1]);
+			const Vector t1 = _mm_unpackhi_epi32(v[0], v[1]);
+			const Vector t2 = _mm_unpacklo_epi32(v[2], v[3]);
+			const Vector t3 = _mm_unpackhi_epi32(v[2], v[3]);
+			v[0] = _mm_unpacklo_epi64(t0, t2);
+			v[1] = _mm_unpackhi_epi64(t0, t2);
+			v[2] = _mm_unpacklo_epi64(t1, t3);
+			v[3] = _mm_unpackhi_epi64(t1, t3);
+		}
+
+		//The conversion is signed: the top bit is flipped and added back as 2^31
+		static void Store(Vector words, double* values)
+		{
+			const Vector flipped = Xor(words, Set(0x80000000));
+			const __m128d offset = _mm_set1_pd(2147483648.5);
+			const __m128d scale = _mm_set1_pd(1.0/4294967296.0);
+			_mm_storeu_pd(values, _mm_mul_pd(_mm_add_pd(_mm_cvtepi32_pd(flipped), offset), scale));
+			_mm_storeu_pd(values + 2, _mm_mul_pd(_mm_add_pd(_mm_cvtepi32_pd(_mm_srli_si128(flipped, 8)), offset), scale));
+		}
+
+		static void Store(Vector words, float* values)
+		{
+			_mm_storeu_ps(values, _mm_mul_ps(_mm_add_ps(_mm_cvtepi32_ps(_mm_srli_epi32(words, 9)), _mm_set1_ps(0.5f)), _mm_set1_ps(1.0f/8388608.0f)));
+		}
+	};
+
+	struct PhiloxAVX2
+	{
+		typedef __m256i Vector;
+		static const unsigned Lanes = 8;
+		static Vector Set(unsigned value) { return _mm256_set1_epi32((int)value); }
+		static Vector Xor(Vector a, Vector b) { return _mm256_xor_si256(a, b); }
+		static Vector Positions(unsigned first) { return _mm256_add_epi32(Set(first), _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0)); }
+
+		static void MulHiLo(Vector a, unsigned multiplier, Vector& hi, Vector& lo)
+		{
+			const Vector m = Set(multiplier);
+			const Vector even = _mm256_mul_epu32(a, m);
+			const Vector odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+			lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+			hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+		}
+
+		//The unpacks work within the 128 bit halves, leaving blocks i and i + 4 in v[i]:
+		static void Transpose(Vector* v)
+		{
+			const Vector t0 = _mm256_unpacklo_epi32(v[0], v[1]);
+			const Vector t1 = _mm256_unpackhi_epi32(v[0], v[1]);
+			const Vector t2 = _mm256_unpacklo_epi32(v[2], v[3]);
+			const Vector t3 = _mm256_unpackhi_epi32(v[2], v[3]);
+			const Vector b0 = _mm256_unpacklo_epi64(t0, t2);
+			const Vector b1 = _mm256_unpackhi_epi64(t0, t2);
+			const Vector b2 = _mm256_unpacklo_epi64(t1, t3);
+			const Vector b3 = _mm256_unpackhi_epi64(t1, t3);
+			v[0] = _mm256_permute2x128_si256(b0, b1, 0x20);
+			v[1] = _mm256_permute2x128_si256(b2, b3, 0x20);
+			v[2] = _mm256_permute2x128_si256(b0, b1, 0x31);
+			v[3] = _mm256_permute2x128_si256(b2, b3, 0x31);
+		}
+
+		static void Store(Vector words, double* values)
+		{
+			const Vector flipped = Xor(words, Set(0x80000000));
+			const __m256d offset = _mm256_set1_pd(2147483648.5);
+			const __m256d scale = _mm256_set1_pd(1.0/4294967296.0);
+			_mm256_storeu_pd(values, _mm256_mul_pd(_mm256_add_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(flipped)), offset), scale));
+			_mm256_storeu_pd(values + 4, _mm256_mul_pd(_mm256_add_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(flipped, 1)), offset), scale));
+		}
+
+		static void Store(Vector words, float* values)
+		{
+			_mm256_storeu_ps(values, _mm256_mul_ps(_mm256_add_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(words, 9)), _mm256_set1_ps(0.5f)),
+				_mm256_set1_ps(1.0f/8388608.0f)));
+		}
+	};
+
+
+	//See GenerateUniform. Only the full groups of P::Lanes blocks, returns the number of the values generated. The
+	//rest are scalar (see FloatingPoint.cpp), so that short rows (e.g. of the XOR nets) don't pay for all the lanes:
+	template<class P, class T>
+	unsigned GenerateUniformSimd(const unsigned* key, const unsigned* counter, T* values, unsigned count)
+	{
+		const unsigned GroupSize = P::Lanes*PhiloxCounterWords;
+		const unsigned countGroups = count - count % GroupSize;
+		unsigned position = counter[0];
+		for (unsigned i = 0; i < countGroups; i += GroupSize, position += P::Lanes)
+		{
+			typename P::Vector c[PhiloxCounterWords] = { P::Positions(position), P::Set(counter[1]), P::Set(counter[2]), P::Set(counter[3]) };
+			unsigned k0 = key[0], k1 = key[1];
+			for (unsigned round = 0; round < PhiloxRounds; ++round)
+			{
+				typename P::Vector hi0, lo0, hi1, lo1;
+				P::MulHiLo(c[0], PhiloxMultiplier0, hi0, lo0);
+				P::MulHiLo(c[2], PhiloxMultiplier1, hi1, lo1);
+				c[0] = P::Xor(P::Xor(hi1, c[1]), P::Set(k0));
+				c[1] = lo1;
+				c[2] = P::Xor(P::Xor(hi0, c[3]), P::Set(k1));
+				c[3] = lo0;
+				k0 += PhiloxWeyl0;
+				k1 += PhiloxWeyl1;
+			}
+			P::Transpose(c);
+			for (unsigned j = 0; j < PhiloxCounterWords; ++j)
+			{
+				P::Store(c[j], values + i + j*P::Lanes);
+			}
+		}
+		return countGroups;
+	}
+
+	template<class V>
+	ActivationKernels<typename V::Type> MakeActivationKernels()
+	{
+		ActivationKernels<typename V::Type> kernels = 
+		{
+			{
+				&ApplyActivationSimd<V, IdentitySimd<V> >, &ApplyActivationSimd<V, ReLUSimd<V> >, &ApplyActivationSimd<V, LeakyReLUSimd<V> >,
+				&ApplyActivationSimd<V, SigmoidSimd<V> >, &ApplyActivationSimd<V, TanhSimd<V> >, &ApplySoftmaxSimd<V>
+			},
+			{
+				&ApplyDerivativeSimd<V, IdentitySimd<V> >, &ApplyDerivativeSimd<V, ReLUSimd<V> >, &ApplyDerivativeSimd<V, LeakyReLUSimd<V> >,
+				&ApplyDerivativeSimd<V, SigmoidSimd<V> >, &ApplyDerivativeSimd<V, TanhSimd<V> >, &ApplySoftmaxDerivativeSimd<V>
+			},
+			&ApplyActivationSimd<V, ExpSimd<V> >
+		};
+		return kernels;
+	}
+
+	template<class V>
+	OptimizerKernels<typename V::Type> MakeOptimizerKernels()
+	{
+		OptimizerKernels<typename V::Type> kernels = 
+		{
+			{
+				&UpdateWeightsSimd<V, SGDRule>, &UpdateWeightsSimd<V, MomentumRule>, &UpdateWeightsSimd<V, NesterovRule>,
+				&UpdateWeightsSimd<V, RMSPropRule>, &UpdateWeightsSimd<V, AdamRule>
+			},
+			{
+				&UpdateWeightsBatchSimd<V, SGDRule>, &UpdateWeightsBatchSimd<V, MomentumRule>, &UpdateWeightsBatchSimd<V, NesterovRule>,
+				&UpdateWeightsBatchSimd<V, RMSPropRule>, &UpdateWeightsBatchSimd<V, AdamRule>
+			}
+		};
+		return kernels;
+	}
+
+	template<class V>
+	MixedPrecisionKernels MakeMixedPrecisionKernels()
+	{
+		MixedPrecisionKernels kernels = 
+		{
+			{
+				&ApplyGradientsSimd<V, SGDRule>, &ApplyGradientsSimd<V, MomentumRule>, &ApplyGradientsSimd<V, NesterovRule>,
+				&ApplyGradientsSimd<V, RMSPropRule>, &ApplyGradientsSimd<V, AdamRule>
+			}
+		};
+		return kernels;
+	}
+
+	//All the kernels of the double and float vectors VD and VF, the Int8 dot products VI and the Philox vectors VR:
+	template<class VD, class VF, class VI, class VR>
+	KernelTable MakeKernels()
+	{
+		KernelTable kernels;
+		ForwardKernels<double> doubleForward = { &ProcessInput<VD>, &ProcessBatch<VD> };
+		ForwardKernels<float> floatForward = { &ProcessInput<VF>, &ProcessBatch<VF> };
+		BackwardKernels<double> doubleBackward = { &OutputDeltasSimd<VD>, &InputDeltasSimd<VD> };
+		BackwardKernels<float> floatBackward = { &OutputDeltasSimd<VF>, &InputDeltasSimd<VF> };
+		kernels.DoubleForward = doubleForward;
+		kernels.FloatForward = floatForward;
+		kernels.DoubleBackward = doubleBackward;
+		kernels.FloatBackward = floatBackward;
+		kernels.DoubleOptimizer = MakeOptimizerKernels<VD>();
+		kernels.FloatOptimizer = MakeOptimizerKernels<VF>();
+		kernels.MixedPrecision = MakeMixedPrecisionKernels<VD>();
+		kernels.DoubleActivation = MakeActivationKernels<VD>();
+		kernels.FloatActivation = MakeActivationKernels<VF>();
+		kernels.Int8DotProducts = &VI::DotProducts;
+		kernels.DoubleCrossover = &CrossoverSimd<VD>;
+		kernels.FloatCrossover = &CrossoverSimd<VF>;
+		kernels.DoubleUniform = &GenerateUniformSimd<VR, double>;
+		kernels.FloatUniform = &GenerateUniformSimd<VR, float>;
+		return kernels;
+	}
+}
+}
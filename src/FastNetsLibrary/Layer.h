@@ -1,14 +1,15 @@
 // Created by Boris Vidolov on 02/14/2014
 // Published under Apache 2.0 licence.
 #pragma once
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_int_distribution.hpp>
 #include <time.h>
 #include <sstream>
 #include "File.h"
 #include "FloatingPoint.h"
+#include "Activation.h"
+#include "Optimizer.h"
 #include "Randomizer.h"
 #include "AlignedMatrix.h"
+#include "Arena.h"
 
 namespace FastNets
 {
@@ -21,19 +22,25 @@ enum WeightsInitialize
 };
 
 /* Represents a single layer in the network. Note that the class will
-initialize the OMP threads to achieve maximum performance gain.*/
-template<unsigned INPUT, unsigned OUTPUT, class FloatingPoint = double>
+initialize the OMP threads to achieve maximum performance gain.
+The Activation is one of the policies in Activation.h and is applied to the outputs.*/
+template<unsigned INPUT, unsigned OUTPUT, class FloatingPoint = double, class Activation = DefaultActivation>
 class Layer
 {
 protected:
 	
 	AlignedMatrix<INPUT, FloatingPoint>  mWeights;
-	AlignedMatrix<INPUT, FloatingPoint>*  mpDeltaWeights;//Temporary during training
-	AlignedMatrix<OUTPUT, FloatingPoint> mReverseWeights;//TODO: Use as an optimization and for contrastive divergeance and backprop
+	AlignedMatrix<INPUT, FloatingPoint>*  mpDeltaWeights;//Temporary during training: the velocity or the mean gradients (see OptimizerState)
+	AlignedMatrix<INPUT, FloatingPoint>*  mpSquareWeights;//Temporary during training: the mean squares of the gradients
+	AlignedMatrix<OUTPUT, FloatingPoint>* mpBiasState;//Temporary during training: the velocity and the mean squares of the biases
+	AlignedMatrix<OUTPUT, FloatingPoint>* mpReverseWeights;//Transposed mWeights, for the batch back propagation and the reverse pass. Allocated and updated lazily
 	FloatingPoint* mB;//Input Bias
 	FloatingPoint* mC;//Output Bias (for reverse calculation)
 
+	Arena* mpArena;//The owner of mWeights, mB and mC, unless NULL
 	bool  mReverseWeightsDirty;
+	Optimizer mOptimizer;
+	unsigned  mOptimizerSteps;//The number of updates since the optimizer was set
 private:
 	Layer(const Layer&){}//No copy
 
@@ -42,43 +49,47 @@ public:
 	const static unsigned Input		= INPUT;
 	const static unsigned Output	= OUTPUT;
 	typedef typename FloatingPoint FloatingPointType;
+	typedef Activation ActivationPolicy;
+	//Small layers use the compile-time unrolled kernels (see UnrolledLayerWeights):
+	const static bool Unrolled = (INPUT*OUTPUT <= UnrolledLayerWeights);
+	//The bytes of the weights and the biases in an Arena:
+	const static unsigned ArenaSize = (OUTPUT*AlignedMatrix<INPUT, FloatingPoint>::AlignedRowSize + AlignedMatrix<OUTPUT, FloatingPoint>::AlignedRowSize + 
+		AlignedMatrix<INPUT, FloatingPoint>::AlignedRowSize)*sizeof(FloatingPoint);
 /*Constructors and destructors. */
 public:
 
-	Layer(WeightsInitialize initialize)
-		:mWeights(OUTPUT), mReverseWeights(INPUT), mpDeltaWeights(NULL)
+	/* The weights and the biases go to "pArena" (see Arena.h), if not NULL. The random initial weights come from 
+	"pRandom", if not NULL (see Initialize). */
+	Layer(WeightsInitialize initialize, Arena* pArena = NULL, Randomizer* pRandom = NULL)
+		:mWeights(OUTPUT, pArena ? (FloatingPoint*)pArena->Allocate(OUTPUT*AlignedMatrix<INPUT, FloatingPoint>::AlignedRowSize*sizeof(FloatingPoint)) : NULL), 
+		mpReverseWeights(NULL), mpDeltaWeights(NULL), mpSquareWeights(NULL), mpBiasState(NULL), 
+		mpArena(pArena), mReverseWeightsDirty(true), mOptimizer(MomentumOptimizer()), mOptimizerSteps(0)
 	{
-		Randomizer<> r;
-
 		AllocateMemory();
-		if (initialize != NoWeightsInitialize)
+		if (initialize == NoWeightsInitialize)
+			return;
+		if (pRandom)
 		{
-			for (int i = 0; i < OUTPUT; ++i)
-			{
-				FloatingPoint* pRow = mWeights.GetRow(i);
-				for (int j = 0; j < INPUT; ++j)
-				{ 
-					pRow[j] = GetRandomWeight(r, OUTPUT + 1, initialize);
-				}
-			}
-			for (int i = 0; i < OUTPUT; ++i)
-				mB[i] = GetRandomWeight(r, OUTPUT + 1, initialize);
-			for (int i = 0; i < INPUT; ++i)
-				mC[i] = GetRandomWeight(r, INPUT + 1, initialize);
-			mReverseWeightsDirty = true;	
+			Initialize(initialize, *pRandom);
+		}
+		else
+		{
+			Randomizer r;
+			Initialize(initialize, r);
 		}
 	}
 
 	//Creates a layer by merging the two:
-	Layer(const Layer& merge1, const Layer& merge2, Randomizer<>& r)
-		:mWeights(OUTPUT), mReverseWeights(INPUT), mpDeltaWeights(NULL)
+	Layer(const Layer& merge1, const Layer& merge2, Randomizer& r)
+		:mWeights(OUTPUT), mpReverseWeights(NULL), mpDeltaWeights(NULL), mpSquareWeights(NULL), mpBiasState(NULL), 
+		mpArena(NULL), mReverseWeightsDirty(true), mOptimizer(MomentumOptimizer()), mOptimizerSteps(0)
 	{
 		AllocateMemory();
 		Merge(merge1, merge2, r);
 	}
 
 	//Creates a random merge of the two parents. Used in genetic algorithms
-	void SetFromMergedParents(const Layer& merge1, const Layer& merge2, Randomizer<>& r)
+	void SetFromMergedParents(const Layer& merge1, const Layer& merge2, Randomizer& r)
 	{
 		Merge(merge1, merge2, r);
 	}
@@ -86,10 +97,13 @@ public:
 
 	~Layer()
 	{
-		_aligned_free(mB);
-		_aligned_free(mC);
-		if (mpDeltaWeights)
-			delete mpDeltaWeights;
+		if (!mpArena)
+		{
+			_aligned_free(mB);
+			_aligned_free(mC);
+		}
+		FreeOptimizerState();
+		delete mpReverseWeights;
 	}
 
 /*Public methods */
@@ -154,42 +168,162 @@ public:
 			{ 
 				accum += (*(pt++))*input[j];
 			}
-			output[i] = OutputFunction(accum);
+			output[i] = accum;
 		}	
+		Activation::ApplySlow(output, OUTPUT);
 	}
 
 	/*IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
 	void ProcessInputFast(const FloatingPoint* input, FloatingPoint* output) const
 	{
-		ProcessInputAVX(input, output, INPUT, OUTPUT, mWeights.GetBuffer(), mB);
+		LayerKernels<Unrolled>::template ProcessInput<FloatingPoint, INPUT, OUTPUT, AlignedMatrix<INPUT, FloatingPoint>::AlignedRowSize>(
+			input, output, mWeights.GetBuffer(), mB);
+		Activation::Apply(output, OUTPUT);
 	}
 
-	void Mutate(FloatingPoint rate, Randomizer<>& r)
+	/* Processes "rowCount" consecutive samples, which rows are laid out as in AlignedMatrix.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ProcessBatchFast(const FloatingPoint* input, FloatingPoint* output, unsigned rowCount) const
 	{
-		for (unsigned i = 0; i < OUTPUT; ++i)
+		LayerKernels<Unrolled>::template ProcessBatch<FloatingPoint, INPUT, OUTPUT, AlignedMatrix<INPUT, FloatingPoint>::AlignedRowSize>(
+			input, output, rowCount, mWeights.GetBuffer(), mB);
+		const unsigned outputStride = AVXAlign<FloatingPoint>(OUTPUT);
+		for (unsigned i = 0; i < rowCount; ++i)
 		{
-			MutateWeight(mB[i], rate, r);
-			FloatingPoint* pt = mWeights.GetRow(i);
-			for (unsigned j = 0; j < INPUT; ++j)
+			Activation::Apply(output + i*outputStride, OUTPUT);
+		}
+	}
+
+	/* Each row of the weights takes its own range of blocks of the stream "r" (see Randomizer::FillUniformAt), so
+	the rows are mutated in parallel with the same result as serially. The biases follow the weights. */
+	void Mutate(FloatingPoint rate, Randomizer& r)
+	{
+		mReverseWeightsDirty = true;
+		//The small layers (e.g. of the XOR nets in a Population) don't enter an OMP region at all:
+		const int threads = ParallelThreads((double)OUTPUT*INPUT, OUTPUT);
+		if (threads > 1)
+		{
+			#pragma omp parallel for num_threads(threads)
+			for (int i = 0; i < (int)OUTPUT; ++i)
+				MutateFromStream(mWeights.GetRow(i), INPUT, rate, r, i*PhiloxBlocks(INPUT));
+		}
+		else
+		{
+			for (unsigned i = 0; i < OUTPUT; ++i)
+				MutateFromStream(mWeights.GetRow(i), INPUT, rate, r, i*PhiloxBlocks(INPUT));
+		}
+		r.Skip(OUTPUT*PhiloxBlocks(INPUT));
+		MutateFromStream(mB, OUTPUT, rate, r, 0);
+		r.Skip(PhiloxBlocks(OUTPUT));
+	}
+
+	/* Turns the deltas of the outputs into deltas of the weighted sums (in place), using the derivative
+	of the activation. IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ApplyDerivative(const FloatingPointType* output, FloatingPointType* outputDelta) const
+	{
+		Activation::ApplyDerivative(output, outputDelta, OUTPUT);
+	}
+
+	/* Calculates the deltas of the input from the deltas of the weighted sums (see ApplyDerivative).
+	Goes over the rows of the weights, as the online training changes them after every sample. */
+	void CalculateBackPropagationDeltas(const FloatingPointType* outputDelta, FloatingPointType* inputDelta) const
+	{
+		BackPropagateDeltasByRows(outputDelta, inputDelta, INPUT, OUTPUT, mWeights.GetBuffer());
+	}
+
+	/* Same as above, but with the reverse weights as of the last PrepareBackPropagation, even if the weights
+	changed since. Several threads can call it while others update the weights (see HogwildTrainer.h). */
+	void CalculateBackPropagationDeltasStale(const FloatingPointType* outputDelta, FloatingPointType* inputDelta) const
+	{
+		BackPropagateDeltas(outputDelta, inputDelta, INPUT, OUTPUT, mpReverseWeights->GetBuffer());
+	}
+
+	/* Allocates the training buffers and brings the reverse weights up to date. Call it before the threads 
+	start training the layer concurrently, as the lazy initialization is not thread safe. */
+	void PrepareBackPropagation()
+	{
+		GetOptimizerState();
+		UpdateReverseWeights();
+	}
+
+	/* The reverse (decoder) pass: calculates the input from the output, through the transposed weights
+	and the output bias mC. */
+	void ProcessReverseSlow(const FloatingPoint* output, FloatingPoint* input)
+	{
+		UpdateReverseWeights();
+		for (unsigned i = 0; i < INPUT; ++i)
+		{
+			FloatingPoint accum = mC[i];
+			const FloatingPoint* pt = mpReverseWeights->GetRow(i);
+			for (unsigned j = 0; j < OUTPUT; ++j)
 			{ 
-				MutateWeight(*pt, rate, r);
-				++pt;
+				accum += (*(pt++))*output[j];
 			}
+			input[i] = accum;
 		}	
+		Activation::ApplySlow(input, INPUT);
+	}
+
+	/*IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ProcessReverseFast(const FloatingPoint* output, FloatingPoint* input)
+	{
+		UpdateReverseWeights();
+		ProcessInputAVX(output, input, OUTPUT, INPUT, mpReverseWeights->GetBuffer(), mC);
+		Activation::Apply(input, INPUT);
 	}
 
-	void CalculateBackPropagationDeltas(const FloatingPointType* input, const FloatingPointType* outputDelta, FloatingPointType* inputDelta) const
+	/* The reverse pass (see ProcessReverseSlow) of "rowCount" rows, laid out as in AlignedMatrix.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ProcessReverseBatchFast(const FloatingPoint* output, FloatingPoint* input, unsigned rowCount)
 	{
-		#pragma omp parallel for
-		for (int i = 0; i < (int)INPUT; ++i)
+		UpdateReverseWeights();
+		ProcessBatchAVX(output, input, rowCount, OUTPUT, INPUT, mpReverseWeights->GetBuffer(), mC);
+		const unsigned inputStride = AVXAlign<FloatingPoint>(INPUT);
+		for (unsigned i = 0; i < rowCount; ++i)
 		{
-			double localDelta = 0;
-			for (unsigned j = 0; j < OUTPUT; ++j)
+			Activation::Apply(input + i*inputStride, INPUT);
+		}
+	}
+
+	/* One contrastive divergence update (see ContrastiveDivergence.h) from "rowCount" rows: the visible units and the
+	hidden probabilities at the start ("input", "hidden") and at the end ("reconstruction", "reconstructionHidden")
+	of the Gibbs chain, and "visibleDelta" = input - reconstruction. Plain SGD, the optimizer is not involved.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void UpdateContrastiveDivergence(const FloatingPoint* input, const FloatingPoint* hidden, const FloatingPoint* reconstruction, 
+									 const FloatingPoint* reconstructionHidden, const FloatingPoint* visibleDelta, unsigned rowCount, double learningRate)
+	{
+		//The positive and the negative phase, each averaged over the rows by the GEMM kernel:
+		const OptimizerState<FloatingPoint> noState = {NULL, NULL, NULL, NULL};
+		UpdateWeightsBatch(input, hidden, rowCount, INPUT, OUTPUT, mWeights.GetBuffer(), mB, noState, SGDOptimizer(), learningRate);
+		UpdateWeightsBatch(reconstruction, reconstructionHidden, rowCount, INPUT, OUTPUT, mWeights.GetBuffer(), mB, noState, SGDOptimizer(), -learningRate);
+		const unsigned inputStride = AVXAlign<FloatingPoint>(INPUT);
+		const FloatingPoint rate = (FloatingPoint)(learningRate/rowCount);
+		for (unsigned i = 0; i < rowCount; ++i)
+		{
+			const FloatingPoint* pDelta = visibleDelta + i*inputStride;
+			for (unsigned j = 0; j < INPUT; ++j)
 			{
-				localDelta += mWeights.GetRow(j)[i]*outputDelta[j];//TODO: Optimize with the reverse weights, if worth
+				mC[j] += rate*pDelta[j];
 			}
-			localDelta *= DerivativeFunction(input[i]);
-			inputDelta[i] = localDelta;
+		}
+		mReverseWeightsDirty = true;
+	}
+
+	/* Mini-batch version of ApplyDerivative and CalculateBackPropagationDeltas for "rowCount" rows, laid out as
+	in AlignedMatrix. "inputDelta" can be NULL for the first layer. IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void CalculateBackPropagationDeltasBatch(const FloatingPointType* output, FloatingPointType* outputDelta, 
+											 FloatingPointType* inputDelta, unsigned rowCount)
+	{
+		const unsigned outputStride = AlignedMatrix<OUTPUT, FloatingPoint>::AlignedRowSize;
+		for (unsigned i = 0; i < rowCount; ++i)
+		{
+			ApplyDerivative(output + i*outputStride, outputDelta + i*outputStride);
+		}
+		if (inputDelta)
+		{
+			//The deltas of all rows at once: the forward batch kernel over the transposed weights, without bias
+			UpdateReverseWeights();
+			ProcessBatchAVX(outputDelta, inputDelta, rowCount, OUTPUT, INPUT, mpReverseWeights->GetBuffer(), (const FloatingPoint*)NULL);
 		}
 	}
 
@@ -197,42 +331,82 @@ public:
 	{
 		if (!mpDeltaWeights)
 		{
-			mpDeltaWeights = new AlignedMatrix<INPUT, FloatingPoint>(mWeights.NumRows());
-			#pragma omp parallel for
-			for (int i = 0; i < (int)mpDeltaWeights->NumRows(); ++i)
-			{
-				FloatingPointType* pWeights = mpDeltaWeights->GetRow(i);
-				for (unsigned j = 0; j < INPUT; ++j)
-				{
-					pWeights[j] = 0;
-				}
-			}
+			mpDeltaWeights = NewZeroMatrix<INPUT>(OUTPUT);
 		}
 		return *mpDeltaWeights;
 	}
 
+	/* Selects the update rule of the back propagation (see Optimizer.h). Discards the state of the previous one. */
+	void SetOptimizer(const Optimizer& optimizer)
+	{
+		FreeOptimizerState();
+		mOptimizer = optimizer;
+		mOptimizerSteps = 0;
+	}
+
+	const Optimizer& GetOptimizer() const { return mOptimizer; }
+
+	//Allocates the state, which the optimizer needs, on first use:
+	OptimizerState<FloatingPoint> GetOptimizerState()
+	{
+		OptimizerState<FloatingPoint> state = {NULL, NULL, NULL, NULL};
+		if (!mpBiasState)
+		{
+			mpBiasState = NewZeroMatrix<OUTPUT>(2);
+		}
+		if (UsesVelocity(mOptimizer))
+		{
+			state.Velocity = GetDeltaWeights().GetBuffer();
+			state.BiasVelocity = mpBiasState->GetRow(0);
+		}
+		if (UsesSquares(mOptimizer))
+		{
+			if (!mpSquareWeights)
+				mpSquareWeights = NewZeroMatrix<INPUT>(OUTPUT);
+			state.Squares = mpSquareWeights->GetBuffer();
+			state.BiasSquares = mpBiasState->GetRow(1);
+		}
+		return state;
+	}
+
 	void UpdateWeightsAndBiases(const FloatingPointType* input, const FloatingPointType* outputDelta, double learningRate)
 	{
-		AlignedMatrix<INPUT, FloatingPoint>& rPreviousDeltas = GetDeltaWeights();
-		#pragma omp parallel for
-		for (int i = 0; (int)i < OUTPUT; ++i)
+		UpdateWeights(input, outputDelta, INPUT, OUTPUT, mWeights.GetBuffer(), mB, GetOptimizerState(), mOptimizer, 
+			StepLearningRate(mOptimizer, learningRate, ++mOptimizerSteps));
+		mReverseWeightsDirty = true;
+	}
+
+	/* One update from the gradients of "rowCount" rows (see UpdateWeightsBatch).
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void UpdateWeightsAndBiasesBatch(const FloatingPointType* input, const FloatingPointType* outputDelta, unsigned rowCount, double learningRate)
+	{
+		UpdateWeightsBatch(input, outputDelta, rowCount, INPUT, OUTPUT, mWeights.GetBuffer(), mB, GetOptimizerState(), mOptimizer, 
+			StepLearningRate(mOptimizer, learningRate, ++mOptimizerSteps));
+		mReverseWeightsDirty = true;
+	}
+
+	/* Mixed precision training (see MixedPrecision.h): applies the averaged single precision gradients to these
+	(master) weights and refreshes their single precision copy, with AlignedMatrix<INPUT, float> rows. */
+	void ApplyFloatGradients(const float* gradients, const float* biasGradients, double learningRate, float* floatWeights, float* floatBias)
+	{
+		ApplyGradients(gradients, biasGradients, INPUT, OUTPUT, mWeights.GetBuffer(), mB, GetOptimizerState(), mOptimizer, 
+			StepLearningRate(mOptimizer, learningRate, ++mOptimizerSteps), floatWeights, floatBias);
+		mReverseWeightsDirty = true;
+	}
+
+	//Copies the weights and the biases to single precision, with AlignedMatrix<INPUT, float> rows:
+	void CopyWeights(float* floatWeights, float* floatBias) const
+	{
+		const unsigned floatStride = AlignedMatrix<INPUT, float>::AlignedRowSize;
+		for (unsigned i = 0; i < OUTPUT; ++i)
 		{
-			FloatingPointType* pWeights = mWeights.GetRow(i);
-			FloatingPointType* pPreviousDelta = rPreviousDeltas.GetRow(i);
-			double currentOutputDelta = outputDelta[i];
+			const FloatingPoint* pRow = mWeights.GetRow(i);
 			for (unsigned j = 0; j < INPUT; ++j)
 			{
-				//TODO: Make the momentum (m) adjustable:
-				double delta = 0.3*(*pPreviousDelta) + learningRate*currentOutputDelta*input[j];
-				(*pPreviousDelta) = delta;
-				(*pWeights) = (*pWeights) + delta;
-				++pWeights;
-				++pPreviousDelta;
+				floatWeights[i*floatStride + j] = (float)pRow[j];
 			}
-
-			mB[i] = mB[i] + learningRate*currentOutputDelta;
+			floatBias[i] = (float)mB[i];
 		}
-		mReverseWeightsDirty = true;
 	}
 
 	// Not very efficient, but checks boundaries:
@@ -263,65 +437,158 @@ protected:
 
 	void UpdateReverseWeights()
 	{
+		if (!mpReverseWeights)
+		{
+			mpReverseWeights = new AlignedMatrix<OUTPUT, FloatingPoint>(INPUT);
+			mReverseWeightsDirty = true;
+		}
 		if (!mReverseWeightsDirty)
 			return;
-		throw std::string("Implement me");
+		TransposeMatrix(mWeights.GetBuffer(), mpReverseWeights->GetBuffer(), OUTPUT, INPUT, 
+			AlignedMatrix<INPUT, FloatingPoint>::AlignedRowSize, AlignedMatrix<OUTPUT, FloatingPoint>::AlignedRowSize);
+		mReverseWeightsDirty = false;
 	}
+	//The uniform numbers of Mutate on the stack. A multiple of the numbers of a Philox block:
+	const static unsigned MutateChunk = 256;
 	//Compile-time checks on the parameters
 	void ValidateTemplateParameters();
 
-	double GetRandomWeight(Randomizer<>& rand, double divider, WeightsInitialize how)
+	/* The random weights are generated in place, a row at a time, with the same split of the stream as in Mutate:
+	the weights, then mB and mC. */
+	void Initialize(WeightsInitialize how, Randomizer& rand)
+	{
+		const int threads = ParallelThreads((double)OUTPUT*INPUT, OUTPUT);
+		if (threads > 1)
+		{
+			#pragma omp parallel for num_threads(threads)
+			for (int i = 0; i < (int)OUTPUT; ++i)
+				InitializeRow(i, how, rand);
+		}
+		else
+		{
+			for (unsigned i = 0; i < OUTPUT; ++i)
+				InitializeRow(i, how, rand);
+		}
+		rand.Skip(OUTPUT*PhiloxBlocks(INPUT));
+		rand.FillUniform(mB, OUTPUT);
+		ToRandomWeights(mB, OUTPUT, OUTPUT + 1, how);
+		rand.FillUniform(mC, INPUT);
+		ToRandomWeights(mC, INPUT, INPUT + 1, how);
+	}
+
+	void InitializeRow(unsigned row, WeightsInitialize how, const Randomizer& rand)
+	{
+		FloatingPoint* pRow = mWeights.GetRow(row);
+		rand.FillUniformAt(row*PhiloxBlocks(INPUT), pRow, INPUT);
+		ToRandomWeights(pRow, INPUT, OUTPUT + 1, how);
+	}
+
+	//Turns the uniform (0, 1) numbers in "values" into random weights:
+	static void ToRandomWeights(FloatingPoint* values, unsigned count, double divider, WeightsInitialize how)
 	{
 		//TODO: Backpropagation works best if weights are set to values very close to 0.
 		//This is not the case for genetic algorithms. Consider passing an argument for these
-		double range = (how == InitializeForGenetic) ? 6.0 : 1.0;
-		double value = rand.RangeNext(range);
-		if (value < 0.0001 && value > -0.0001)
+		const double range = (how == InitializeForGenetic) ? 6.0 : 1.0;
+		for (unsigned j = 0; j < count; ++j)
 		{
-			value = _copysign(0.001, value);
+			double value = range*(2*values[j] - 1);
+			if (value < 0.0001 && value > -0.0001)
+			{
+				value = _copysign(0.001, value);
+			}
+			values[j] = (FloatingPoint)(value/divider);
+		}
+	}
+
+	//Allocates a matrix of zeroes for the state of the optimizer:
+	template<unsigned ROWSIZE>
+	static AlignedMatrix<ROWSIZE, FloatingPoint>* NewZeroMatrix(unsigned rowCount)
+	{
+		AlignedMatrix<ROWSIZE, FloatingPoint>* pMatrix = new AlignedMatrix<ROWSIZE, FloatingPoint>(rowCount);
+		const int threads = ParallelThreads((double)rowCount*ROWSIZE, rowCount);
+		#pragma omp parallel for num_threads(threads) if (threads > 1)
+		for (int i = 0; i < (int)rowCount; ++i)
+		{
+			FloatingPointType* pRow = pMatrix->GetRow(i);
+			for (unsigned j = 0; j < ROWSIZE; ++j)
+			{
+				pRow[j] = 0;
+			}
 		}
-		value /= divider;
-		return value;
+		return pMatrix;
+	}
+
+	void FreeOptimizerState()
+	{
+		delete mpDeltaWeights;
+		delete mpSquareWeights;
+		delete mpBiasState;
+		mpDeltaWeights = NULL;
+		mpSquareWeights = NULL;
+		mpBiasState = NULL;
 	}
 
 	void AllocateMemory()
 	{
+		if (mpArena)
+		{
+			mB = (FloatingPoint*)mpArena->Allocate(OUTPUT*sizeof(FloatingPoint));
+			mC = (FloatingPoint*)mpArena->Allocate(INPUT*sizeof(FloatingPoint));
+			return;
+		}
 		mB = (FloatingPoint*)_aligned_malloc(OUTPUT*sizeof(FloatingPoint), 32);
 		mC = (FloatingPoint*)_aligned_malloc(INPUT*sizeof(FloatingPoint), 32);
 	}
 
-	//Changes the "source" weight with the specified rate:
-	void MutateWeight(FloatingPoint& source, double rate, Randomizer<>& rand)
+	/* Mutates "count" weights with the uniform numbers of the stream of "rand" after "blocks" blocks (see Randomizer::FillUniformAt).
+	The numbers are generated MutateChunk at a time on the stack, so neither the big layers overflow the stack of a thread,
+	nor the small ones (e.g. of the XOR nets in a Population) go through the allocator. */
+	static void MutateFromStream(FloatingPoint* weights, unsigned count, FloatingPoint rate, const Randomizer& rand, unsigned blocks)
 	{
-        if (source < 0.00001 && source > -0.00001)
-        {
-            //Abillity to bring back really small numbers:
-			source = -_copysign(0.001, source);//Pass to the other side of the 0
+		_CRT_ALIGN(32) FloatingPoint uniforms[MutateChunk];
+		for (unsigned j = 0; j < count; j += MutateChunk)
+		{
+			const unsigned chunk = (count - j < MutateChunk) ? count - j : MutateChunk;
+			rand.FillUniformAt(blocks + j/PhiloxCounterWords, uniforms, chunk);
+			MutateWeights(weights + j, uniforms, chunk, rate);
 		}
+	}
 
-		double quotient = rand.OffsetNext(rate);
-
-        source = source*quotient;
+	//Changes the "weights" with the specified rate: each is multiplied by (1 - rate, 1 + rate), from its uniform number.
+	//The loop has no calls and a select for the small weights, so the compiler vectorizes it:
+	static void MutateWeights(FloatingPoint* weights, const FloatingPoint* uniforms, unsigned count, double rate)
+	{
+		const FloatingPoint offset = (FloatingPoint)(1 - rate);
+		const FloatingPoint scale = (FloatingPoint)(2*rate);
+		for (unsigned j = 0; j < count; ++j)
+		{
+			FloatingPoint source = weights[j];
+			//Abillity to bring back really small numbers: pass to the other side of the 0
+			source = (source < (FloatingPoint)0.00001 && source > (FloatingPoint)-0.00001) ? (FloatingPoint)-_copysign(0.001, source) : source;
+			weights[j] = source*(offset + scale*uniforms[j]);
+		}
 	}
 
-	void Merge(const Layer& layer1, const Layer& layer2, Randomizer<>& rand)
+	void Merge(const Layer& layer1, const Layer& layer2, Randomizer& rand)
 	{
-		FloatingPoint *pt;
-		const FloatingPoint *pt1, *pt2;
+		mReverseWeightsDirty = true;
+		//A random bit per weight selects the parent, 64 of them per draw (see Crossover):
+		unsigned long long masks[(INPUT > OUTPUT ? INPUT : OUTPUT)/64 + 1];
+		FillMasks(masks, OUTPUT, rand);
+		Crossover(layer1.mB, layer2.mB, mB, OUTPUT, masks);
 		for (unsigned i = 0; i < OUTPUT; ++i)
 		{
-			mB[i] = rand.NextBool() ? layer1.mB[i] : layer2.mB[i];
-			pt = mWeights.GetRow(i);
-			pt1 = layer1.mWeights.GetRow(i);
-			pt2 = layer2.mWeights.GetRow(i);
-			for (unsigned j = 0; j < INPUT; ++j)
-			{ 
-				*pt = rand.NextBool() ? *pt1 : *pt2;
-				++pt;
-				++pt1;
-				++pt2;
-			}
-		}	
+			FillMasks(masks, INPUT, rand);
+			Crossover(layer1.mWeights.GetRow(i), layer2.mWeights.GetRow(i), mWeights.GetRow(i), INPUT, masks);
+		}
+	}
+
+	static void FillMasks(unsigned long long* masks, unsigned count, Randomizer& rand)
+	{
+		for (unsigned i = 0; i < (count + 63)/64; ++i)
+		{
+			masks[i] = rand.NextMask();
+		}
 	}
 };//Layer class
 
@@ -0,0 +1,356 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <omp.h>
+#include <string.h>
+#include "Net.h"
+
+namespace FastNets
+{
+/* Mixed precision training of double precision nets. The forward pass, the deltas and the gradient GEMMs run
+in single precision, on float copies of the weights: half the memory traffic and twice the SIMD width. The
+averaged gradients are applied to the double precision (master) weights of the net with its optimizer, which
+also refreshes the float copies in the same pass (see ApplyGradients). So the small updates are not lost to
+the rounding of the weights. Layers, which are sensitive to the rounding, can opt out and calculate in double:
+	Net<167, Net<112, Net<9>>> net(InitializeForBackProp);
+	MixedPrecisionTrainer<Net<167, Net<112, Net<9>>>> trainer(net);
+	trainer.SetDoublePrecision(1);//The output layer
+	AlignedMatrix<167, float> floatInput(input.NumRows());
+	AlignedMatrix<9, float> floatExpected(input.NumRows());
+	ConvertMatrix(input, floatInput);//Once for all the epochs
+	ConvertMatrix(expected, floatExpected);
+	for (int i = 0; i < 100; ++i)
+		error = trainer.BatchBackPropagation(floatInput, floatExpected, 0.5, 32);
+*/
+
+//Converts "rowCount" rows of "size" elements between the precisions:
+template<class Source, class Target>
+void ConvertRows(const Source* source, Target* target, unsigned rowCount, unsigned size)
+{
+	const unsigned sourceStride = AVXAlign<Source>(size);
+	const unsigned targetStride = AVXAlign<Target>(size);
+	for (unsigned i = 0; i < rowCount; ++i)
+	{
+		for (unsigned j = 0; j < size; ++j)
+		{
+			target[i*targetStride + j] = (Target)source[i*sourceStride + j];
+		}
+	}
+}
+
+//Converts a matrix between the precisions. Both need the same number of rows:
+template<unsigned COLUMNS, class Source, class Target>
+void ConvertMatrix(const AlignedMatrix<COLUMNS, Source>& source, AlignedMatrix<COLUMNS, Target>& target)
+{
+	if (source.NumRows() != target.NumRows())
+		throw std::string("Different number of rows between the two matrices.");
+	ConvertRows(source.GetBuffer(), target.GetBuffer(), source.NumRows(), COLUMNS);
+}
+
+/* The single precision side of a layer: the float copies of the weights and the buffers of a tile of rows. */
+template<unsigned INPUT, unsigned OUTPUT, class Activation>
+class MixedPrecisionLayer
+{
+public:
+	typedef Layer<INPUT, OUTPUT, double, Activation> MasterType;
+	//Up to that many rows per batch:
+	const static unsigned TileRows = 64;
+protected:
+	AlignedMatrix<INPUT, float>		mWeights;
+	AlignedMatrix<OUTPUT, float>*	mpReverseWeights;//Only the layers, which calculate the deltas of their input, need it
+	AlignedMatrix<INPUT, float>		mGradients;
+	AlignedMatrix<OUTPUT, float>	mOutput;
+	AlignedMatrix<OUTPUT, float>	mOutputDelta;
+	float*							mB;
+	float*							mBiasGradients;
+	bool							mReverseWeightsDirty;
+	//The layers, which opted out, calculate in double precision with the master weights:
+	bool							mDoublePrecision;
+	AlignedMatrix<INPUT, double>*	mpDoubleInput;
+	AlignedMatrix<INPUT, double>*	mpDoubleInputDelta;
+	AlignedMatrix<OUTPUT, double>*	mpDoubleOutput;
+	AlignedMatrix<OUTPUT, double>*	mpDoubleOutputDelta;
+private:
+	MixedPrecisionLayer(const MixedPrecisionLayer&){}//No copy
+public:
+	MixedPrecisionLayer()
+		:mWeights(OUTPUT), mpReverseWeights(NULL), mGradients(OUTPUT), mOutput(TileRows), mOutputDelta(TileRows), mReverseWeightsDirty(true),
+		mDoublePrecision(false), mpDoubleInput(NULL), mpDoubleInputDelta(NULL), mpDoubleOutput(NULL), mpDoubleOutputDelta(NULL)
+	{
+		mB = (float*)_aligned_malloc(OUTPUT*sizeof(float), 32);
+		mBiasGradients = (float*)_aligned_malloc(OUTPUT*sizeof(float), 32);
+	}
+
+	~MixedPrecisionLayer()
+	{
+		_aligned_free(mB);
+		_aligned_free(mBiasGradients);
+		delete mpReverseWeights;
+		FreeDoubleBuffers();
+	}
+
+	float* GetOutput() { return mOutput.GetBuffer(); }
+	float* GetOutputDelta() { return mOutputDelta.GetBuffer(); }
+	bool IsDoublePrecision() const { return mDoublePrecision; }
+
+	//The float copies of the weights are stale after the double precision updates, so it refreshes them from "master":
+	void SetDoublePrecision(const MasterType& master, bool doublePrecision)
+	{
+		Synchronize(master);
+		FreeDoubleBuffers();
+		mDoublePrecision = doublePrecision;
+		if (mDoublePrecision)
+		{
+			mpDoubleInput = new AlignedMatrix<INPUT, double>(TileRows);
+			mpDoubleInputDelta = new AlignedMatrix<INPUT, double>(TileRows);
+			mpDoubleOutput = new AlignedMatrix<OUTPUT, double>(TileRows);
+			mpDoubleOutputDelta = new AlignedMatrix<OUTPUT, double>(TileRows);
+		}
+	}
+
+	//Refreshes the float copies from the master weights:
+	void Synchronize(const MasterType& master)
+	{
+		master.CopyWeights(mWeights.GetBuffer(), mB);
+		mReverseWeightsDirty = true;
+	}
+
+	/* The forward pass of "rowCount" rows, laid out as in AlignedMatrix<INPUT, float>. */
+	void Forward(const MasterType& master, const float* input, unsigned rowCount)
+	{
+		if (mDoublePrecision)
+		{
+			ConvertRows(input, mpDoubleInput->GetBuffer(), rowCount, INPUT);
+			master.ProcessBatchFast(mpDoubleInput->GetBuffer(), mpDoubleOutput->GetBuffer(), rowCount);
+			ConvertRows(mpDoubleOutput->GetBuffer(), mOutput.GetBuffer(), rowCount, OUTPUT);
+			return;
+		}
+		ProcessBatchAVX(input, mOutput.GetBuffer(), rowCount, INPUT, OUTPUT, mWeights.GetBuffer(), mB);
+		for (unsigned i = 0; i < rowCount; ++i)
+		{
+			Activation::Apply(mOutput.GetRow(i), OUTPUT);
+		}
+	}
+
+	/* The backward pass, after the upper layers filled the output deltas: calculates the deltas of the input
+	("inputDelta" can be NULL for the first layer) and updates the master weights and the float copies. */
+	void Backward(MasterType& master, const float* input, float* inputDelta, unsigned rowCount, double learningRate)
+	{
+		if (mDoublePrecision)
+		{
+			ConvertRows(mOutputDelta.GetBuffer(), mpDoubleOutputDelta->GetBuffer(), rowCount, OUTPUT);
+			master.CalculateBackPropagationDeltasBatch(mpDoubleOutput->GetBuffer(), mpDoubleOutputDelta->GetBuffer(),
+				inputDelta ? mpDoubleInputDelta->GetBuffer() : NULL, rowCount);
+			master.UpdateWeightsAndBiasesBatch(mpDoubleInput->GetBuffer(), mpDoubleOutputDelta->GetBuffer(), rowCount, learningRate);
+			if (inputDelta)
+				ConvertRows(mpDoubleInputDelta->GetBuffer(), inputDelta, rowCount, INPUT);
+			return;
+		}
+		for (unsigned i = 0; i < rowCount; ++i)
+		{
+			Activation::ApplyDerivative(mOutput.GetRow(i), mOutputDelta.GetRow(i), OUTPUT);
+		}
+		if (inputDelta)
+		{
+			UpdateReverseWeights();
+			ProcessBatchAVX(mOutputDelta.GetBuffer(), inputDelta, rowCount, OUTPUT, INPUT, mpReverseWeights->GetBuffer(), (const float*)NULL);
+		}
+		//The GEMM of the mini-batch with plain SGD at rate 1 leaves the averaged gradients in zeroed buffers:
+		memset(mGradients.GetBuffer(), 0, OUTPUT*AlignedMatrix<INPUT, float>::AlignedRowSize*sizeof(float));
+		memset(mBiasGradients, 0, OUTPUT*sizeof(float));
+		const OptimizerState<float> noState = {NULL, NULL, NULL, NULL};
+		UpdateWeightsBatch(input, mOutputDelta.GetBuffer(), rowCount, INPUT, OUTPUT, mGradients.GetBuffer(), mBiasGradients,
+			noState, SGDOptimizer(), 1.0);
+		master.ApplyFloatGradients(mGradients.GetBuffer(), mBiasGradients, learningRate, mWeights.GetBuffer(), mB);
+		mReverseWeightsDirty = true;
+	}
+
+protected:
+	//Transposes the float weights on first use after they change, so the first layer of the net never does:
+	void UpdateReverseWeights()
+	{
+		if (!mpReverseWeights)
+		{
+			mpReverseWeights = new AlignedMatrix<OUTPUT, float>(INPUT);
+			mReverseWeightsDirty = true;
+		}
+		if (!mReverseWeightsDirty)
+			return;
+		TransposeMatrix(mWeights.GetBuffer(), mpReverseWeights->GetBuffer(), OUTPUT, INPUT,
+			AlignedMatrix<INPUT, float>::AlignedRowSize, AlignedMatrix<OUTPUT, float>::AlignedRowSize);
+		mReverseWeightsDirty = false;
+	}
+
+	void FreeDoubleBuffers()
+	{
+		delete mpDoubleInput;
+		delete mpDoubleInputDelta;
+		delete mpDoubleOutput;
+		delete mpDoubleOutputDelta;
+		mpDoubleInput = mpDoubleInputDelta = NULL;
+		mpDoubleOutput = mpDoubleOutputDelta = NULL;
+	}
+};
+
+//Mirrors the structure of a double precision Net. See the specializations below.
+template<class NetType>
+class MixedPrecisionNet;
+
+template<unsigned INPUT, class UpperNet, class Activation>
+class MixedPrecisionNet<Net<INPUT, UpperNet, Activation> >
+{
+public:
+	typedef Net<INPUT, UpperNet, Activation> NetType;
+	const static unsigned Input = INPUT;
+	const static unsigned Output = NetType::Output;
+	const static bool	  Last = false;
+protected:
+	MixedPrecisionLayer<INPUT, UpperNet::Input, Activation>	mInputLayer;
+	MixedPrecisionNet<UpperNet>								mNext;
+public:
+	void Synchronize(const NetType& net)
+	{
+		mInputLayer.Synchronize(net.GetInputLayer());
+		mNext.Synchronize(net.GetNext());
+	}
+
+	void SetDoublePrecision(const NetType& net, unsigned layer, bool doublePrecision)
+	{
+		if (layer)
+			mNext.SetDoublePrecision(net.GetNext(), layer - 1, doublePrecision);
+		else
+			mInputLayer.SetDoublePrecision(net.GetInputLayer(), doublePrecision);
+	}
+
+	/* One mini-batch of "rowCount" float rows. "deltas" receives the deltas of the input, unless NULL.
+	Returns the sum of the errors of the rows. */
+	double BatchBackPropagation(NetType& net, const float* input, const float* expected, unsigned rowCount, float* deltas, double learningRate)
+	{
+		mInputLayer.Forward(net.GetInputLayer(), input, rowCount);
+		double error = mNext.BatchBackPropagation(net.GetNext(), mInputLayer.GetOutput(), expected, rowCount,
+			mInputLayer.GetOutputDelta(), learningRate);
+		mInputLayer.Backward(net.GetInputLayer(), input, deltas, rowCount, learningRate);
+		return error;
+	}
+};
+
+//The ending of the stack: calculates the deltas of the outputs.
+template<unsigned INPUT>
+class MixedPrecisionNetEnd
+{
+public:
+	const static unsigned Input = INPUT;
+	const static unsigned Output = INPUT;
+	const static bool Last = true;
+
+	template<class NetType>
+	void Synchronize(const NetType& net){}
+	template<class NetType>
+	void SetDoublePrecision(const NetType& net, unsigned layer, bool doublePrecision) { throw std::string("layer parameter is too big"); }
+
+	template<class NetType>
+	double BatchBackPropagation(NetType& net, const float* input, const float* expected, unsigned rowCount, float* deltas, double learningRate)
+	{
+		const unsigned stride = AlignedMatrix<INPUT, float>::AlignedRowSize;
+		double error = 0;
+		for (unsigned s = 0; s < rowCount; ++s)
+		{
+			error += CalculateOutputDeltas(input + s*stride, expected + s*stride, deltas + s*stride, INPUT);
+		}
+		return error/INPUT;
+	}
+};
+
+//Only double precision nets have master weights to keep:
+template<unsigned INPUT, class Activation>
+class MixedPrecisionNet<Net<INPUT, double, Activation> > : public MixedPrecisionNetEnd<INPUT>
+{
+};
+
+template<class NetType>
+class MixedPrecisionTrainer
+{
+public:
+	const static unsigned TileRows = NetType::TileRows;
+protected:
+	NetType&							mNet;
+	MixedPrecisionNet<NetType>			mMixed;
+private:
+	MixedPrecisionTrainer(const MixedPrecisionTrainer&):mNet(*(NetType*)NULL){}//No copy
+public:
+	MixedPrecisionTrainer(NetType& net)
+		:mNet(net)
+	{
+		mMixed.Synchronize(mNet);
+	}
+
+	//The layer (0 is the one of the input) calculates in double precision, e.g. if it is sensitive to the rounding:
+	void SetDoublePrecision(unsigned layer, bool doublePrecision = true)
+	{
+		mMixed.SetDoublePrecision(mNet, layer, doublePrecision);
+	}
+
+	//Call it after the weights of the net change outside of the trainer:
+	void Synchronize()
+	{
+		mMixed.Synchronize(mNet);
+	}
+
+	/* Same as Net::BatchBackPropagation, with mixed precision. Returns the average error before the updates.
+	The data set is in single precision: convert it once for all the epochs with ConvertMatrix. */
+	double BatchBackPropagation(const AlignedMatrix<NetType::Input, float>& input, const AlignedMatrix<NetType::Output, float>& expected,
+								double learningRate, unsigned batchRows)
+	{
+		if (input.NumRows() != expected.NumRows())
+			throw std::string("Different number of rows between the two matrices.");
+		if (!batchRows || batchRows > TileRows)
+			throw std::string("The batch size must be between 1 and TileRows");
+
+		double totalError = 0;
+		for (unsigned i = 0; i < input.NumRows(); i += batchRows)
+		{
+			unsigned rowCount = (input.NumRows() - i < batchRows) ? input.NumRows() - i : batchRows;
+			totalError += mMixed.BatchBackPropagation(mNet, input.GetRow(i), expected.GetRow(i), rowCount, NULL, learningRate);
+		}
+		return totalError/input.NumRows();
+	}
+};
+
+//The convergence of the mixed precision training, compared to double precision (see CompareMixedPrecision):
+struct MixedPrecisionReport
+{
+	double DoubleError;//The error of the last epoch of each training
+	double MixedError;
+	double MaxDifference;//The largest difference between the errors of the same epoch
+	double DoubleSeconds;
+	double MixedSeconds;
+};
+
+/* Trains two identical nets (e.g. read from the same file) for "epochs" passes over the rows: "doubleNet" in
+double precision and "mixedNet" with "trainer" (made for "mixedNet"), and compares the errors and the times. */
+template<class NetType>
+MixedPrecisionReport CompareMixedPrecision(NetType& doubleNet, MixedPrecisionTrainer<NetType>& trainer,
+										   const AlignedMatrix<NetType::Input, double>& input, const AlignedMatrix<NetType::Output, double>& expected,
+										   double learningRate, unsigned batchRows, unsigned epochs)
+{
+	MixedPrecisionReport report = {0, 0, 0, 0, 0};
+	Workspace<NetType> workspace;
+	AlignedMatrix<NetType::Input, float> floatInput(input.NumRows());
+	AlignedMatrix<NetType::Output, float> floatExpected(expected.NumRows());
+	ConvertMatrix(input, floatInput);
+	ConvertMatrix(expected, floatExpected);
+	for (unsigned i = 0; i < epochs; ++i)
+	{
+		double start = omp_get_wtime();
+		report.DoubleError = doubleNet.BatchBackPropagation(input, expected, learningRate, batchRows, workspace);
+		double middle = omp_get_wtime();
+		report.MixedError = trainer.BatchBackPropagation(floatInput, floatExpected, learningRate, batchRows);
+		report.DoubleSeconds += middle - start;
+		report.MixedSeconds += omp_get_wtime() - middle;
+		double difference = fabs(report.DoubleError - report.MixedError);
+		if (report.MaxDifference < difference)
+			report.MaxDifference = difference;
+	}
+	return report;
+}
+
+}//FastNets namespace
@@ -2,7 +2,9 @@
 // Published under Apache 2.0 licence.
 #pragma once
 #include "Layer.h"
+#include "ContrastiveDivergence.h"
 #include "File.h"
+#include "Workspace.h"
 
 namespace FastNets
 {
@@ -12,8 +14,11 @@ namespace FastNets
 //The line above creates a network with 3 layers, 5 input neurons, 3 hidden ones and 1 output.
 //It is possible to stack this way to arbitrary depth:
 //	Net<10, Net<9, Net<8, Net<7, Net<6, Net<5>>>>>> n5;
+//The optional third parameter is the activation (see Activation.h) of the layer, which INPUT feeds:
+//	Net<167, Net<112, Net<9>, Softmax>, ReLU> n6;
+//Above the hidden layer uses ReLU and the output one Softmax.
 
-template<unsigned INPUT, class UpperNet = double>
+template<unsigned INPUT, class UpperNet = double, class Activation = DefaultActivation>
 class Net
 {
 /* Public constants */
@@ -21,19 +26,37 @@ public:
 	const static unsigned Input = INPUT;
 	const static unsigned Output = UpperNet::Output;
 	const static bool	  Last = false;
+	//The widest hidden layer in the stack (the input and the output are not counted):
+	const static unsigned MaxHidden = UpperNet::Last ? 0 : 
+		(UpperNet::Input > UpperNet::MaxHidden ? UpperNet::Input : UpperNet::MaxHidden);
+	//Number of rows that BatchProcessInputFast pushes through the network one layer at a time:
+	const static unsigned TileRows = 64;
 
 	typedef typename UpperNet::FloatingPointType FloatingPointType;
+	//The widest layer output, including the output of the net:
+	const static unsigned MaxLayer = UpperNet::Input > UpperNet::MaxLayer ? UpperNet::Input : UpperNet::MaxLayer;
+	//The number of weights, i.e. the multiply-adds of the forward calculation of one sample:
+	const static unsigned Weights = INPUT*UpperNet::Input + UpperNet::Weights;
+	//The bytes of the weights and the biases of all the layers in an Arena (see Arena.h):
+	const static unsigned ArenaSize = Layer<INPUT, UpperNet::Input, FloatingPointType, Activation>::ArenaSize + UpperNet::ArenaSize;
+	//The total size of the aligned outputs of all the layers, kept during back propagation:
+	const static unsigned ActivationsSize = AlignedMatrix<UpperNet::Input, FloatingPointType>::AlignedRowSize + UpperNet::ActivationsSize;
+	//The last (dummy) level, which keeps the workspace of the whole stack (see GetWorkspace):
+	typedef typename UpperNet::EndType EndType;
 protected:
 	//Unfortunately, the stack size is limited and insufficient for really deep
-	//networks. So we dynamically allocate the large data here:
-	Layer<INPUT, UpperNet::Input, FloatingPointType>		mInputLayer;
+	//networks. So we dynamically allocate the large data here (see also Workspace.h):
+	Layer<INPUT, UpperNet::Input, FloatingPointType, Activation>	mInputLayer;
 	UpperNet									  			mNext;
 private:
 	Net(const Net&){}//No copy
 
 /*Constructors and destructors */
 public:
-	Net(WeightsInitialize initialize):mInputLayer(initialize), mNext(initialize){}
+	//The weights go to "pArena", if not NULL. Otherwise each layer allocates its own. With "pRandom" the initial 
+	//weights of each layer come from its own stream (see Randomizer::SetLayer), "layer" is the index of the first one:
+	Net(WeightsInitialize initialize, Arena* pArena = NULL, Randomizer* pRandom = NULL, unsigned layer = 0)
+		:mInputLayer(initialize, pArena, SelectLayer(pRandom, layer)), mNext(initialize, pArena, pRandom, layer + 1){}
 
 	Net(const char* szFile):mInputLayer(NoWeightsInitialize), mNext(NoWeightsInitialize)
 	{
@@ -41,14 +64,14 @@ public:
 		ReadFromFile(f);
 	}
 
-	Net(const Net& first, const Net& second, Randomizer<>& rand)
+	Net(const Net& first, const Net& second, Randomizer& rand)
 		:mInputLayer(first.mInputLayer, second.mInputLayer, rand),
 		mNext(first.mNext, second.mNext, rand)
 	{
 	}
 
 	//Creates a random merge of the two parents. Used in genetic algorithms
-	void SetFromMergedParents(const Net& first, const Net& second, Randomizer<>& rand)
+	void SetFromMergedParents(const Net& first, const Net& second, Randomizer& rand)
 	{
 		mInputLayer.SetFromMergedParents(first.mInputLayer, second.mInputLayer, rand);
 		mNext.SetFromMergedParents(first.mNext, second.mNext, rand);
@@ -130,18 +153,105 @@ public:
 	{
 		EnsureSameSize(input, output);
 
-		#pragma omp parallel for
-		for (int i = 0; i < (int)input.NumRows(); ++i)
+		//The tiles go to the threads, unless there are too few of them. Then the layers split the tiles (see ChooseParallelism):
+		const unsigned numTiles = (input.NumRows() + TileRows - 1)/TileRows;
+		const int threads = ParallelThreads((double)input.NumRows()*Weights, numTiles);
+		#pragma omp parallel num_threads(threads) if (threads > 1)
 		{
-			ProcessInputFast(input.GetRow(i), output.GetRow(i));
+			//Allocated once per thread:
+			Workspace<Net> workspace;
+			ShareTilesFast(input, output, workspace);
+		}
+	}
+
+	/* Same as above with a workspace owned by the caller, on the calling thread only. The threads of a parallel
+	region can process their own matrices, each with its own workspace. */
+	void BatchProcessInputFast(const AlignedMatrix<INPUT, FloatingPointType>& input, AlignedMatrix<Output, FloatingPointType>& output,
+							   Workspace<Net>& rWorkspace) const
+	{
+		EnsureSameSize(input, output);
+
+		const unsigned numTiles = (input.NumRows() + TileRows - 1)/TileRows;
+		for (unsigned i = 0; i < numTiles; ++i)
+		{
+			ProcessTileFast(input, output, i*TileRows, rWorkspace);
+		}
+	}
+
+	/* Fused forward calculation and CalculateError: returns the sum of the errors of the rows (not divided by their
+	number). Only the outputs of a tile of rows are kept at a time, in the workspace, instead of a matrix of all of them.
+	Processes the tiles "firstTile", "firstTile" + "tileStep", ..., so the threads of a parallel region can split them. */
+	double SumBatchError(const AlignedMatrix<INPUT, FloatingPointType>& input, const AlignedMatrix<Output, FloatingPointType>& expected,
+						 Workspace<Net>& rWorkspace, unsigned firstTile = 0, unsigned tileStep = 1) const
+	{
+		EnsureSameSize(input, expected);
+
+		const unsigned numTiles = (input.NumRows() + TileRows - 1)/TileRows;
+		double accum = 0;
+		for (unsigned i = firstTile; i < numTiles; i += tileStep)
+		{
+			accum += SumTileError(input, expected, i*TileRows, rWorkspace);
+		}
+		return accum;
+	}
+
+	/* Same as SumBatchError for a group of "count" nets, e.g. individuals of a population: each tile of rows goes 
+	through all of them while it is in the cache, so the input is read from the memory once per group instead of
+	once per net. Adds the sum of the errors of each net to "errors". */
+	static void SumBatchErrors(const Net* const* nets, unsigned count, const AlignedMatrix<INPUT, FloatingPointType>& input, 
+							   const AlignedMatrix<Output, FloatingPointType>& expected, Workspace<Net>& rWorkspace, double* errors,
+							   unsigned firstTile = 0, unsigned tileStep = 1)
+	{
+		if (input.NumRows() != expected.NumRows())
+			throw std::string("Different number of rows between the two matrices.");
+
+		const unsigned numTiles = (input.NumRows() + TileRows - 1)/TileRows;
+		for (unsigned i = firstTile; i < numTiles; i += tileStep)
+		{
+			for (unsigned j = 0; j < count; ++j)
+			{
+				errors[j] += nets[j]->SumTileError(input, expected, i*TileRows, rWorkspace);
+			}
+		}
+	}
+
+	/* Forward calculation of "rowCount" consecutive AlignedMatrix rows, one layer at a time.
+	The hidden activations go to "pScratch" and "pNextScratch", alternating between the layers.
+	Each of them needs space for "rowCount" rows of MaxHidden elements.*/
+	void ProcessTileFast(const FloatingPointType* input, FloatingPointType* output, unsigned rowCount, 
+						 FloatingPointType* pScratch, FloatingPointType* pNextScratch) const
+	{
+		if (UpperNet::Last)//Should be constant expression
+		{
+			mInputLayer.ProcessBatchFast(input, output, rowCount);
+		}
+		else
+		{
+			mInputLayer.ProcessBatchFast(input, pScratch, rowCount);
+			mNext.ProcessTileFast(pScratch, output, rowCount, pNextScratch, pScratch);
 		}
 	}
 
 	/* Forward calculation of the network. The method uses the first INPUT elements
 	   of the "input" array, so the array will need to have at least as much elements.
 	   The same applies to the "output" array, where the last layer of the net will
-	   put its data there.*/
+	   put its data there. The hidden outputs go to the workspace of the net (see GetWorkspace), so this one
+	   is not thread safe: the threads need the overload below, each with its own workspace.
+	   IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
 	void ProcessInputFast(const FloatingPointType* input, FloatingPointType* output) const
+	{
+		ProcessInputFast(input, output, GetWorkspace());
+	}
+
+	/* IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	void ProcessInputFast(const FloatingPointType* input, FloatingPointType* output, Workspace<Net>& rWorkspace) const
+	{
+		ProcessInputFast(input, output, rWorkspace.GetScratch(), rWorkspace.GetNextScratch());
+	}
+
+	//This method should be called only by the method above. The scratch buffers are used as in ProcessTileFast.
+	void ProcessInputFast(const FloatingPointType* input, FloatingPointType* output, 
+						  FloatingPointType* pScratch, FloatingPointType* pNextScratch) const
 	{
 		if (UpperNet::Last)//Should be constant expression
 		{
@@ -150,52 +260,159 @@ public:
 		}
 		else
 		{
-			_CRT_ALIGN(32) FloatingPointType intermediate[UpperNet::Input];
-			mInputLayer.ProcessInputFast(input, intermediate);
-			mNext.ProcessInputFast(intermediate, output);
+			mInputLayer.ProcessInputFast(input, pScratch);
+			mNext.ProcessInputFast(pScratch, output, pNextScratch, pScratch);
 		}
 	}
 
 	void Mutate(double rate)
 	{
-		Randomizer<> rand;
+		Randomizer rand;
 		Mutate(rate, rand);
 	}
 
-	void Mutate(double rate, Randomizer<>& rand)
+	/* Each layer is mutated with the stream of its index (see Randomizer::SetLayer), so the result depends only
+	on the seed, the individual and the step of "rand". */
+	void Mutate(double rate, Randomizer& rand, unsigned layer = 0)
 	{
+		rand.SetLayer(layer);
 		mInputLayer.Mutate(rate, rand);
-		mNext.Mutate(rate, rand);
+		mNext.Mutate(rate, rand, layer + 1);
 	}
 
 	double BackPropagation(const AlignedMatrix<INPUT, FloatingPointType>& input, const AlignedMatrix<Output, FloatingPointType>& expected, double learningRate)
+	{
+		return BackPropagation(input, expected, learningRate, GetWorkspace());
+	}
+
+	double BackPropagation(const AlignedMatrix<INPUT, FloatingPointType>& input, const AlignedMatrix<Output, FloatingPointType>& expected, 
+						   double learningRate, Workspace<Net>& rWorkspace)
 	{
 		EnsureSameSize(input, expected);
 
 		double totalError = 0;
 		for (unsigned i = 0; i < input.NumRows(); ++i)
 		{
-			totalError += BackPropagation(input.GetRow(i), expected.GetRow(i), NULL, learningRate);
+			totalError += BackPropagation(input.GetRow(i), expected.GetRow(i), learningRate, rWorkspace);
 		}
 
 		return totalError/input.NumRows();
 	}
 
-	//This method should be called only by the method above.
-	double BackPropagation(const FloatingPointType* input, const FloatingPointType* expected, 
-								 FloatingPointType* deltas, double learningRate)
+	/* Trains on a single sample. IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	double BackPropagation(const FloatingPointType* input, const FloatingPointType* expected, double learningRate, Workspace<Net>& rWorkspace)
 	{
-		_CRT_ALIGN(32) FloatingPointType nextOutput[UpperNet::Input];
-		_CRT_ALIGN(32) FloatingPointType nextDelta[UpperNet::Input];
+		return BackPropagation(input, expected, NULL, learningRate, rWorkspace.GetActivations(), rWorkspace.GetDeltas(), rWorkspace.GetNextDeltas(), false);
+	}
+
+	/* Trains on a single sample, while other threads may be training the same net (Hogwild, see HogwildTrainer.h).
+	The weights are updated without locks and the deltas use the reverse weights as of the last PrepareBackPropagation.
+	IMPORTANT: This one requires _CRT_ALIGN(32) pointers */
+	double HogwildBackPropagation(const FloatingPointType* input, const FloatingPointType* expected, double learningRate, Workspace<Net>& rWorkspace)
+	{
+		return BackPropagation(input, expected, NULL, learningRate, rWorkspace.GetActivations(), rWorkspace.GetDeltas(), rWorkspace.GetNextDeltas(), true);
+	}
+
+	//Sets the optimizer of all the layers (see Optimizer.h):
+	void SetOptimizer(const Optimizer& optimizer)
+	{
+		mInputLayer.SetOptimizer(optimizer);
+		mNext.SetOptimizer(optimizer);
+	}
+
+	/* Allocates the training buffers of all the layers and updates their reverse weights. Required before 
+	HogwildBackPropagation and at its synchronization points. */
+	void PrepareBackPropagation()
+	{
+		mInputLayer.PrepareBackPropagation();
+		mNext.PrepareBackPropagation();
+	}
+
+	/* Greedy layer-wise pretraining with contrastive divergence (see ContrastiveDivergence.h): each hidden layer
+	is trained "epochs" passes as a restricted Boltzmann machine on the outputs of the (already pretrained) layers
+	below. The output layer is left to the back propagation. */
+	void Pretrain(const AlignedMatrix<INPUT, FloatingPointType>& input, double learningRate, unsigned epochs, 
+				  unsigned steps = 1, unsigned batchRows = 32)
+	{
+		if (UpperNet::Last)
+			return;
+		ContrastiveDivergence<InputLayerType> cd(mInputLayer, steps, batchRows);
+		for (unsigned i = 0; i < epochs; ++i)
+		{
+			cd.Train(input, learningRate);
+		}
+		AlignedMatrix<UpperNet::Input, FloatingPointType> hidden(input.NumRows());
+		mInputLayer.ProcessBatchFast(input.GetBuffer(), hidden.GetBuffer(), input.NumRows());
+		mNext.Pretrain(hidden, learningRate, epochs, steps, batchRows);
+	}
+
+	/* Mini-batch training: the rows are processed "batchRows" (up to TileRows) at a time, as matrices. Each batch
+	ends with a single update of the weights from the accumulated gradients (see UpdateWeightsBatch).
+	Returns the average error before the updates. */
+	double BatchBackPropagation(const AlignedMatrix<INPUT, FloatingPointType>& input, const AlignedMatrix<Output, FloatingPointType>& expected, 
+								double learningRate, unsigned batchRows)
+	{
+		return BatchBackPropagation(input, expected, learningRate, batchRows, GetWorkspace());
+	}
+
+	double BatchBackPropagation(const AlignedMatrix<INPUT, FloatingPointType>& input, const AlignedMatrix<Output, FloatingPointType>& expected, 
+								double learningRate, unsigned batchRows, Workspace<Net>& rWorkspace)
+	{
+		EnsureSameSize(input, expected);
+		if (!batchRows || batchRows > TileRows)
+			throw std::string("The batch size must be between 1 and TileRows");
+
+		double totalError = 0;
+		for (unsigned i = 0; i < input.NumRows(); i += batchRows)
+		{
+			unsigned rowCount = (input.NumRows() - i < batchRows) ? input.NumRows() - i : batchRows;
+			totalError += BatchBackPropagation(input.GetRow(i), expected.GetRow(i), rowCount, NULL, learningRate, 
+											   rWorkspace.GetActivations(), rWorkspace.GetDeltas(), rWorkspace.GetNextDeltas());
+		}
+
+		return totalError/input.NumRows();
+	}
+
+	//This method should be called only by the methods above. The buffers are used as in BackPropagation, with "rowCount" rows each.
+	double BatchBackPropagation(const FloatingPointType* input, const FloatingPointType* expected, unsigned rowCount, FloatingPointType* deltas, 
+								double learningRate, FloatingPointType* pActivations, FloatingPointType* pDelta, FloatingPointType* pNextDelta)
+	{
+		FloatingPointType* nextOutput = pActivations;
+		FloatingPointType* nextDelta = pDelta;
+		//Forward pass:
+		mInputLayer.ProcessBatchFast(input, nextOutput, rowCount);
+		//Continues the forward pass and comes back:
+		double outputError = mNext.BatchBackPropagation(nextOutput, expected, rowCount, nextDelta, learningRate, 
+			pActivations + rowCount*AlignedMatrix<UpperNet::Input, FloatingPointType>::AlignedRowSize, pNextDelta, pDelta);
+		//Backward pass:
+		mInputLayer.CalculateBackPropagationDeltasBatch(nextOutput, nextDelta, deltas, rowCount);
+		mInputLayer.UpdateWeightsAndBiasesBatch(input, nextDelta, rowCount, learningRate);
+		return outputError;
+	}
+
+	/* This method should be called only by the methods above. "pActivations" receives the outputs of this 
+	and the upper layers. "pDelta" and "pNextDelta" are ping-pong buffers for the deltas: the upper net
+	writes the deltas of our output in "pDelta", while it uses "pNextDelta" for its own. With "staleReverseWeights"
+	the deltas are calculated without refreshing the reverse weights (see HogwildBackPropagation). */
+	double BackPropagation(const FloatingPointType* input, const FloatingPointType* expected, FloatingPointType* deltas, double learningRate,
+						   FloatingPointType* pActivations, FloatingPointType* pDelta, FloatingPointType* pNextDelta, bool staleReverseWeights)
+	{
+		FloatingPointType* nextOutput = pActivations;
+		FloatingPointType* nextDelta = pDelta;
 		//Forward pass:
 		mInputLayer.ProcessInputFast(input, nextOutput);
 		//Continues the forward pass and comes back:
-		double outputError = mNext.BackPropagation(nextOutput, expected, nextDelta, learningRate);
+		double outputError = mNext.BackPropagation(nextOutput, expected, nextDelta, learningRate, 
+			pActivations + AlignedMatrix<UpperNet::Input, FloatingPointType>::AlignedRowSize, pNextDelta, pDelta, staleReverseWeights);
 		//Backward pass:
+		mInputLayer.ApplyDerivative(nextOutput, nextDelta);
 		//Calculate the errors for the lower level, unless there is no lower one:
 		if (deltas)
 		{
-			mInputLayer.CalculateBackPropagationDeltas(input, nextDelta, deltas);
+			if (staleReverseWeights)
+				mInputLayer.CalculateBackPropagationDeltasStale(nextDelta, deltas);
+			else
+				mInputLayer.CalculateBackPropagationDeltas(nextDelta, deltas);
 		}
 		mInputLayer.UpdateWeightsAndBiases(input, nextDelta, learningRate);
 		return outputError;
@@ -215,7 +432,67 @@ public:
 		mNext.PrintWeights();
 		mInputLayer.PrintWeights();
 	}
+
+	//Access to the layers, e.g. for quantization (see Quantized.h):
+	typedef Layer<INPUT, UpperNet::Input, FloatingPointType, Activation> InputLayerType;
+	const InputLayerType& GetInputLayer() const { return mInputLayer; }
+	const UpperNet& GetNext() const { return mNext; }
+	InputLayerType& GetInputLayer() { return mInputLayer; }
+	UpperNet& GetNext() { return mNext; }
 protected:
+	//The workspace of the methods without one, allocated on first use. Not thread safe, as the training itself:
+	Workspace<Net>& GetWorkspace() const
+	{
+		return GetEnd().template GetWorkspace<Workspace<Net> >();
+	}
+
+public:
+	const EndType& GetEnd() const { return mNext.GetEnd(); }
+protected:
+
+	//The threads of the enclosing parallel region share the tiles of the batch (see BatchProcessInputFast):
+	void ShareTilesFast(const AlignedMatrix<INPUT, FloatingPointType>& input, AlignedMatrix<Output, FloatingPointType>& output,
+						Workspace<Net>& rWorkspace) const
+	{
+		const int numTiles = (int)((input.NumRows() + TileRows - 1)/TileRows);
+		#pragma omp for
+		for (int i = 0; i < numTiles; ++i)
+		{
+			ProcessTileFast(input, output, i*TileRows, rWorkspace);
+		}
+	}
+
+	//The outputs of the tile of rows, which starts at "startRow":
+	void ProcessTileFast(const AlignedMatrix<INPUT, FloatingPointType>& input, AlignedMatrix<Output, FloatingPointType>& output,
+						 unsigned startRow, Workspace<Net>& rWorkspace) const
+	{
+		const unsigned rowCount = (input.NumRows() - startRow < TileRows) ? input.NumRows() - startRow : TileRows;
+		ProcessTileFast(input.GetRow(startRow), output.GetRow(startRow), rowCount, rWorkspace.GetScratch(), rWorkspace.GetNextScratch());
+	}
+
+	//The sum of the errors of the tile of rows, which starts at "startRow" (see SumBatchError):
+	double SumTileError(const AlignedMatrix<INPUT, FloatingPointType>& input, const AlignedMatrix<Output, FloatingPointType>& expected,
+						unsigned startRow, Workspace<Net>& rWorkspace) const
+	{
+		const unsigned stride = AlignedMatrix<Output, FloatingPointType>::AlignedRowSize;
+		const unsigned rowCount = (input.NumRows() - startRow < TileRows) ? input.NumRows() - startRow : TileRows;
+		FloatingPointType* pOutput = rWorkspace.GetOutputs();
+		ProcessTileFast(input.GetRow(startRow), pOutput, rowCount, rWorkspace.GetScratch(), rWorkspace.GetNextScratch());
+		double accum = 0;
+		for (unsigned j = 0; j < rowCount; ++j)
+		{
+			accum += CalculateOutputError(pOutput + j*stride, expected.GetRow(startRow + j), Output);
+		}
+		return accum;
+	}
+
+	static Randomizer* SelectLayer(Randomizer* pRandom, unsigned layer)
+	{
+		if (pRandom)
+			pRandom->SetLayer(layer);
+		return pRandom;
+	}
+
 	template<unsigned first, unsigned second>
 	void EnsureSameSize(const AlignedMatrix<first, FloatingPointType>& input, const AlignedMatrix<second, FloatingPointType>& output) const
 	{
@@ -224,46 +501,116 @@ protected:
 	}
 };//Net class
 
-//Specialization for the ending, most implementation is empty
-template<unsigned INPUT>
-class Net<INPUT, double>
+//The ending of the stack, most implementation is empty. The specializations of Net
+//below carry the floating point type of the whole network:
+//	Net<5, Net<3, Net<1>>>			- double precision
+//	Net<5, Net<3, Net<1, float>>>	- single precision
+template<unsigned INPUT, class FloatingPoint>
+class NetEnd
 {
 /* Public constants */
 public:
 	const static unsigned Input = INPUT;
 	const static unsigned Output = INPUT;
 	const static bool Last = true;//Identifies the last (dummy) layer.
+	const static unsigned MaxHidden = 0;
+	const static unsigned MaxLayer = 0;
+	const static unsigned Weights = 0;
+	const static unsigned ArenaSize = 0;
+	const static unsigned ActivationsSize = 0;
 
-	typedef double FloatingPointType;
+	typedef FloatingPoint FloatingPointType;
+	typedef NetEnd EndType;
+protected:
+	/* The workspace of the methods of the whole stack, which don't take one (see Net::GetWorkspace). A single one
+	per net, instead of one per level. It has the type of the level, which uses it, normally the top one: */
+	mutable void*	mpWorkspace;
+	mutable void	(*mpFreeWorkspace)(void*);
+private:
+	NetEnd(const NetEnd&){}//No copy
 public:
-	Net(WeightsInitialize initialize){}
-	Net(const char* szFile){}      
-	Net(const Net& first, const Net& second, Randomizer<>& rand){}
+	NetEnd():mpWorkspace(NULL), mpFreeWorkspace(NULL){}
+
+	~NetEnd()
+	{
+		if (mpFreeWorkspace)
+			mpFreeWorkspace(mpWorkspace);
+	}
+
+	const EndType& GetEnd() const { return *this; }
+
+	template<class WorkspaceType>
+	WorkspaceType& GetWorkspace() const
+	{
+		if (mpFreeWorkspace != &FreeWorkspace<WorkspaceType>)
+		{
+			if (mpFreeWorkspace)
+				mpFreeWorkspace(mpWorkspace);
+			mpFreeWorkspace = NULL;
+			mpWorkspace = new WorkspaceType();
+			mpFreeWorkspace = &FreeWorkspace<WorkspaceType>;
+		}
+		return *(WorkspaceType*)mpWorkspace;
+	}
+
+	template<class WorkspaceType>
+	static void FreeWorkspace(void* pWorkspace) { delete (WorkspaceType*)pWorkspace; }
+
 	void WriteToFile(const char* szFile){}
 	void WriteToFile(File& rFile){}
 	void ReadFromFile(File& rFile){}
-	bool IsSame(const Net& other) const { return true; }
+	bool IsSame(const NetEnd& other) const { return true; }
 	double ProcessInputSlow(const FloatingPointType* input, FloatingPointType* output) const { throw std::string("Execution Flow error"); }
-	double ProcessInputFast(const FloatingPointType* input, FloatingPointType* output) const { throw std::string("Execution Flow error"); }
-	void Mutate(double rate, Randomizer<>& rand){}
+	void ProcessInputFast(const FloatingPointType* input, FloatingPointType* output, 
+						  FloatingPointType* pScratch, FloatingPointType* pNextScratch) const { throw std::string("Execution Flow error"); }
+	void ProcessTileFast(const FloatingPointType* input, FloatingPointType* output, unsigned rowCount, 
+						 FloatingPointType* pScratch, FloatingPointType* pNextScratch) const { throw std::string("Execution Flow error"); }
+	void Mutate(double rate, Randomizer& rand, unsigned layer){}
 	//Creates a random merge of the two parents. Used in genetic algorithms
-	void SetFromMergedParents(const Net& first, const Net& second, Randomizer<>& rand){}
-	double BackPropagation(const FloatingPointType* input, const FloatingPointType* expected, 
-								 FloatingPointType* deltas, double learningRate)
+	void SetFromMergedParents(const NetEnd& first, const NetEnd& second, Randomizer& rand){}
+	void PrepareBackPropagation(){}
+	void SetOptimizer(const Optimizer& optimizer){}
+	template<class Matrix>
+	void Pretrain(const Matrix& input, double learningRate, unsigned epochs, unsigned steps, unsigned batchRows){}
+	double BackPropagation(const FloatingPointType* input, const FloatingPointType* expected, FloatingPointType* deltas, double learningRate,
+						   FloatingPointType* pActivations, FloatingPointType* pDelta, FloatingPointType* pNextDelta, bool staleReverseWeights)
+	{
+		//The input for the last, dummy layer is the actual output of the net. The deltas are by the outputs,
+		//the layer below applies the derivative of its activation:
+		return CalculateOutputDeltas(input, expected, deltas, Output)/Output;
+	}
+
+	double BatchBackPropagation(const FloatingPointType* input, const FloatingPointType* expected, unsigned rowCount, FloatingPointType* deltas, 
+								double learningRate, FloatingPointType* pActivations, FloatingPointType* pDelta, FloatingPointType* pNextDelta)
 	{
-		//The input for the last, dummy layer is the actual output of the net:
-		//TODO: use AVX here:
+		//The rows of all the matrices are aligned:
+		const unsigned stride = AlignedMatrix<Output, FloatingPointType>::AlignedRowSize;
 		double error = 0;
-		for (int i = 0; i < (int)Output; ++i)
+		for (unsigned s = 0; s < rowCount; ++s)
 		{
-			double localError = expected[i] - input[i];
-			deltas[i] = localError*DerivativeFunction(input[i]);
-			error += localError*localError;
+			error += CalculateOutputDeltas(input + s*stride, expected + s*stride, deltas + s*stride, Output);
 		}
-		error /= Output;
-		return error;
+		return error/Output;
 	}
 	void PrintWeights() const {}
 };
 
+template<unsigned INPUT, class Activation>
+class Net<INPUT, double, Activation> : public NetEnd<INPUT, double>
+{
+public:
+	Net(WeightsInitialize initialize, Arena* pArena = NULL, Randomizer* pRandom = NULL, unsigned layer = 0){}
+	Net(const char* szFile){}      
+	Net(const Net& first, const Net& second, Randomizer& rand){}
+};
+
+template<unsigned INPUT, class Activation>
+class Net<INPUT, float, Activation> : public NetEnd<INPUT, float>
+{
+public:
+	Net(WeightsInitialize initialize, Arena* pArena = NULL, Randomizer* pRandom = NULL, unsigned layer = 0){}
+	Net(const char* szFile){}      
+	Net(const Net& first, const Net& second, Randomizer& rand){}
+};
+
 }//FastNets namespace
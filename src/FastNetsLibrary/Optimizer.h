@@ -0,0 +1,66 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <math.h>
+#include "FloatingPoint.h"
+
+namespace FastNets
+{
+	/* The optimizers of the back propagation. Each layer keeps the state of its optimizer in aligned matrices
+	next to its weights, and the update is a single vectorized pass over the weights, the gradients and the
+	state (see UpdateWeights). Example:
+		Net<167, Net<112, Net<9>>> net(InitializeForBackProp);
+		net.SetOptimizer(AdamOptimizer());
+		net.BackPropagation(input, expected, 0.001);
+	The default is MomentumOptimizer(). */
+
+	inline Optimizer SGDOptimizer()
+	{
+		Optimizer optimizer = {OptimizerSGD, 0, 0, 0};
+		return optimizer;
+	}
+
+	inline Optimizer MomentumOptimizer(double momentum = 0.3)
+	{
+		Optimizer optimizer = {OptimizerMomentum, momentum, 0, 0};
+		return optimizer;
+	}
+
+	inline Optimizer NesterovOptimizer(double momentum = 0.9)
+	{
+		Optimizer optimizer = {OptimizerNesterov, momentum, 0, 0};
+		return optimizer;
+	}
+
+	inline Optimizer RMSPropOptimizer(double decay = 0.9, double epsilon = 1e-8)
+	{
+		Optimizer optimizer = {OptimizerRMSProp, 0, decay, epsilon};
+		return optimizer;
+	}
+
+	inline Optimizer AdamOptimizer(double meanDecay = 0.9, double squaresDecay = 0.999, double epsilon = 1e-8)
+	{
+		Optimizer optimizer = {OptimizerAdam, meanDecay, squaresDecay, epsilon};
+		return optimizer;
+	}
+
+	//Whether the optimizer keeps the last change or the mean gradient of each weight:
+	inline bool UsesVelocity(const Optimizer& optimizer)
+	{
+		return optimizer.Type == OptimizerMomentum || optimizer.Type == OptimizerNesterov || optimizer.Type == OptimizerAdam;
+	}
+
+	//Whether the optimizer keeps the mean square of the gradients of each weight:
+	inline bool UsesSquares(const Optimizer& optimizer)
+	{
+		return optimizer.Type == OptimizerRMSProp || optimizer.Type == OptimizerAdam;
+	}
+
+	/* The learning rate of the update number "step" (starting from 1). Adam starts with zero means, so its
+	rate is corrected by the sum of the weights of the gradients so far. The rest use the rate as is. */
+	inline double StepLearningRate(const Optimizer& optimizer, double learningRate, unsigned step)
+	{
+		if (optimizer.Type != OptimizerAdam)
+			return learningRate;
+		return learningRate*sqrt(1 - pow(optimizer.Decay, (double)step))/(1 - pow(optimizer.Momentum, (double)step));
+	}
+}
@@ -0,0 +1,64 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <omp.h>
+
+namespace FastNets
+{
+	/* The cost model of the OMP regions. Each parallel loop in the library asks ChooseParallelism how to split
+	its work, instead of always opening a region: for the XOR nets the fork/join of the threads costs much more
+	than the loops themselves. The regions are never nested: inside a parallel region (e.g. the evaluation of
+	the population or the Hogwild threads) the answer is always serial, so the caller's threads are not
+	oversubscribed. */
+	enum ParallelStrategy
+	{
+		ParallelSerial,
+		ParallelOverSamples,//Each thread processes its own rows (samples, tiles or individuals)
+		ParallelOverNeurons,//The threads share a sample and split the outputs (neurons) of the layer
+	};
+
+	struct ParallelPlan
+	{
+		ParallelStrategy Strategy;
+		int Threads;
+	};
+
+	//Multiply-adds, which pay for the start of an additional thread:
+	const double ParallelWorkPerThread = 32*1024;
+
+	/* "work" is the number of multiply-adds, "samples" and "neurons" are the number of independent pieces,
+	in which the work can be split each way (0 if it can't). The samples are preferred, as they don't share
+	cache lines of the outputs and don't need the weights synchronized between the threads. */
+	inline ParallelPlan ChooseParallelism(double work, unsigned samples, unsigned neurons)
+	{
+		ParallelPlan plan = {ParallelSerial, 1};
+		//Checked first, as it doesn't need any OMP calls:
+		if (work < 2*ParallelWorkPerThread || omp_in_parallel())
+			return plan;
+		int threads = omp_get_max_threads();
+		if (threads > work/ParallelWorkPerThread)
+			threads = (int)(work/ParallelWorkPerThread);
+
+		if (samples >= (unsigned)threads || (samples >= neurons && samples >= 2))
+		{
+			plan.Strategy = ParallelOverSamples;
+			plan.Threads = (samples < (unsigned)threads) ? (int)samples : threads;
+		}
+		else if (neurons >= 2)
+		{
+			plan.Strategy = ParallelOverNeurons;
+			plan.Threads = (neurons < (unsigned)threads) ? (int)neurons : threads;
+		}
+		if (plan.Threads < 2)
+		{
+			plan.Strategy = ParallelSerial;
+			plan.Threads = 1;
+		}
+		return plan;
+	}
+
+	//The number of threads for a loop of "items" independent pieces of "work" multiply-adds in total:
+	inline int ParallelThreads(double work, unsigned items)
+	{
+		return ChooseParallelism(work, items, 0).Threads;
+	}
+}
@@ -0,0 +1,342 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <omp.h>
+#include <vector>
+#include "Net.h"
+
+namespace FastNets
+{
+/* Pipeline-parallel training: the layers of the net are split in stages of consecutive layers, one thread
+per stage, and micro-batches of rows stream through them. The stages advance in lock step (ticks): at tick t
+stage s runs the forward pass of micro-batch t - s and the backward pass of micro-batch t - 2*(S - 1) + s,
+where S is the number of stages, so each stage works on a different micro-batch than its neighbours. Each
+backward pass updates the weights of its layers right away, so the forward pass of a micro-batch can see
+weights, which are older by up to 2*(S - 1 - s) updates than those of its backward pass (bounded staleness).
+A flush (draining of the pipeline) every "flushInterval" micro-batches bounds the drift further; with 1 the
+training is the same as Net::BatchBackPropagation with batches of "microBatchRows":
+	Net<167, Net<112, Net<50, Net<9>>>> net(InitializeForBackProp);
+	PipelineTrainer<Net<167, Net<112, Net<50, Net<9>>>>> trainer(net, 3, 16);
+	for (int i = 0; i < 100; ++i)
+		error = trainer.Train(input, expected, 0.1);
+	printf("%.0f%% busy\n", 100*trainer.GetLastReport().StageReports[0].Utilization);
+The layers are too small to split between threads when the pipeline pays off, so the kernels inside the stages
+run serially (see Parallelism.h).
+*/
+
+//A layer of the net, without its type (see PipelineLayers):
+template<class FloatingPoint>
+struct PipelineLayer
+{
+	void*		pLayer;
+	unsigned	Input;
+	unsigned	Output;
+	void (*Forward)(void* pLayer, const FloatingPoint* input, FloatingPoint* output, unsigned rowCount);
+	//Calculates the deltas of the input (unless NULL) and updates the weights:
+	void (*Backward)(void* pLayer, const FloatingPoint* input, const FloatingPoint* output, FloatingPoint* outputDelta,
+					 FloatingPoint* inputDelta, unsigned rowCount, double learningRate);
+};
+
+template<class LayerType>
+struct PipelineLayerKernels
+{
+	typedef typename LayerType::FloatingPointType FloatingPoint;
+
+	static void Forward(void* pLayer, const FloatingPoint* input, FloatingPoint* output, unsigned rowCount)
+	{
+		((LayerType*)pLayer)->ProcessBatchFast(input, output, rowCount);
+	}
+
+	static void Backward(void* pLayer, const FloatingPoint* input, const FloatingPoint* output, FloatingPoint* outputDelta,
+						 FloatingPoint* inputDelta, unsigned rowCount, double learningRate)
+	{
+		LayerType* pTyped = (LayerType*)pLayer;
+		pTyped->CalculateBackPropagationDeltasBatch(output, outputDelta, inputDelta, rowCount);
+		pTyped->UpdateWeightsAndBiasesBatch(input, outputDelta, rowCount, learningRate);
+	}
+
+	static PipelineLayer<FloatingPoint> Make(LayerType& layer)
+	{
+		PipelineLayer<FloatingPoint> result = {&layer, LayerType::Input, LayerType::Output, &Forward, &Backward};
+		return result;
+	}
+};
+
+//Lists the layers of a net, from the input to the output:
+template<class NetType>
+struct PipelineLayers;
+
+template<unsigned INPUT, class UpperNet, class Activation>
+struct PipelineLayers<Net<INPUT, UpperNet, Activation> >
+{
+	typedef Net<INPUT, UpperNet, Activation> NetType;
+	typedef typename NetType::FloatingPointType FloatingPoint;
+
+	static void Collect(NetType& net, std::vector<PipelineLayer<FloatingPoint> >& layers)
+	{
+		layers.push_back(PipelineLayerKernels<typename NetType::InputLayerType>::Make(net.GetInputLayer()));
+		PipelineLayers<UpperNet>::Collect(net.GetNext(), layers);
+	}
+};
+
+template<unsigned INPUT, class Activation>
+struct PipelineLayers<Net<INPUT, double, Activation> >
+{
+	template<class NetType, class Layers>
+	static void Collect(NetType& net, Layers& layers){}
+};
+
+template<unsigned INPUT, class Activation>
+struct PipelineLayers<Net<INPUT, float, Activation> >
+{
+	template<class NetType, class Layers>
+	static void Collect(NetType& net, Layers& layers){}
+};
+
+struct PipelineStageReport
+{
+	unsigned FirstLayer;
+	unsigned LayerCount;
+	double BusySeconds;//The time of the stage in its forward and backward passes
+	double Utilization;//BusySeconds relative to the time of the training
+};
+
+//The throughput of a training run and the utilization of each stage:
+struct PipelineReport
+{
+	unsigned Stages;
+	unsigned MicroBatches;
+	unsigned Samples;
+	double Seconds;
+	double SamplesPerSecond;
+	double Error;//The average error before the updates
+	std::vector<PipelineStageReport> StageReports;
+};
+
+template<class NetType>
+class PipelineTrainer
+{
+public:
+	typedef typename NetType::FloatingPointType FloatingPointType;
+protected:
+	NetType&								mNet;
+	std::vector<PipelineLayer<FloatingPointType> >	mLayers;
+	std::vector<unsigned>					mStageStarts;//The first layer of each stage, followed by the number of layers
+	unsigned								mMicroBatchRows;
+	unsigned								mFlushInterval;
+	//The micro-batches in flight, each with the outputs and the deltas of all the layers:
+	unsigned								mSlots;
+	std::vector<FloatingPointType*>			mActivations;//[slot*layers + layer]
+	std::vector<FloatingPointType*>			mDeltas;
+	PipelineReport							mLastReport;
+private:
+	PipelineTrainer(const PipelineTrainer&):mNet(*(NetType*)NULL){}//No copy
+public:
+	/* "stages" of 0 uses a stage per OMP thread, up to one per layer. */
+	PipelineTrainer(NetType& net, unsigned stages = 0, unsigned microBatchRows = 16, unsigned flushInterval = 0)
+		:mNet(net), mMicroBatchRows(microBatchRows), mFlushInterval(flushInterval), mSlots(0)
+	{
+		if (!microBatchRows)
+			throw std::string("The micro-batches must have rows");
+		PipelineLayers<NetType>::Collect(mNet, mLayers);
+		SetStages(stages);
+	}
+
+	~PipelineTrainer()
+	{
+		FreeBuffers();
+	}
+
+	//Splits the layers in stages with about the same number of weights each:
+	void SetStages(unsigned stages)
+	{
+		const unsigned layers = (unsigned)mLayers.size();
+		if (!stages)
+			stages = (unsigned)omp_get_max_threads();
+		if (stages > layers)
+			stages = layers;
+
+		double remaining = 0;
+		for (unsigned i = 0; i < layers; ++i)
+		{
+			remaining += (double)mLayers[i].Input*mLayers[i].Output;
+		}
+		mStageStarts.clear();
+		unsigned layer = 0;
+		for (unsigned s = 0; s < stages; ++s)
+		{
+			mStageStarts.push_back(layer);
+			const unsigned stagesLeft = stages - s;
+			const double target = remaining/stagesLeft;
+			double cost = 0;
+			//At least one layer per stage, while the next one brings the stage closer to the target:
+			do
+			{
+				cost += (double)mLayers[layer].Input*mLayers[layer].Output;
+				++layer;
+			} while (layer < layers - (stagesLeft - 1) &&
+					 (stagesLeft == 1 || cost + (double)mLayers[layer].Input*mLayers[layer].Output/2 <= target));
+			remaining -= cost;
+		}
+		mStageStarts.push_back(layers);
+		AllocateBuffers();
+	}
+
+	unsigned NumStages() const { return (unsigned)mStageStarts.size() - 1; }
+	void SetFlushInterval(unsigned flushInterval) { mFlushInterval = flushInterval; }
+	const PipelineReport& GetLastReport() const { return mLastReport; }
+
+	/* One pass over the rows. Returns the average error before the updates. */
+	double Train(const AlignedMatrix<NetType::Input, FloatingPointType>& input, const AlignedMatrix<NetType::Output, FloatingPointType>& expected,
+				 double learningRate)
+	{
+		if (input.NumRows() != expected.NumRows())
+			throw std::string("Different number of rows between the two matrices.");
+		if (!input.NumRows())
+			throw std::string("No rows to train on");
+
+		const int stages = (int)NumStages();
+		const unsigned microBatches = (input.NumRows() + mMicroBatchRows - 1)/mMicroBatchRows;
+		const unsigned flushInterval = mFlushInterval ? mFlushInterval : microBatches;
+		std::vector<double> busySeconds(stages, 0.0);
+		double error = 0;//Only the last stage adds to it
+		//The lazy initialization of the layers must not happen in the threads:
+		mNet.PrepareBackPropagation();
+
+		double start = omp_get_wtime();
+		for (unsigned first = 0; first < microBatches; first += flushInterval)
+		{
+			const int count = (int)((microBatches - first < flushInterval) ? microBatches - first : flushInterval);
+			const int ticks = count + 2*stages - 2;
+			#pragma omp parallel num_threads(stages) if (stages > 1)
+			{
+				const int thread = omp_get_thread_num();
+				const int numThreads = omp_get_num_threads();
+				for (int tick = 0; tick < ticks; ++tick)
+				{
+					//If OMP provided fewer threads, some run several stages:
+					for (int s = thread; s < stages; s += numThreads)
+					{
+						double stageStart = omp_get_wtime();
+						const int forward = tick - s;
+						if (forward >= 0 && forward < count)
+						{
+							double stageError = Forward(s, first + forward, input, expected);
+							if (s == stages - 1)
+								error += stageError;
+						}
+						const int backward = tick - 2*(stages - 1) + s;
+						if (backward >= 0 && backward < count)
+						{
+							Backward(s, first + backward, input, learningRate);
+						}
+						busySeconds[s] += omp_get_wtime() - stageStart;
+					}
+					//The outputs and the deltas of this tick are the inputs of the neighbours at the next one:
+					#pragma omp barrier
+				}
+			}
+		}
+		double seconds = omp_get_wtime() - start;
+
+		mLastReport.Stages = stages;
+		mLastReport.MicroBatches = microBatches;
+		mLastReport.Samples = input.NumRows();
+		mLastReport.Seconds = seconds;
+		mLastReport.SamplesPerSecond = (seconds > 0) ? input.NumRows()/seconds : 0;
+		mLastReport.Error = error/input.NumRows();
+		mLastReport.StageReports.clear();
+		for (int s = 0; s < stages; ++s)
+		{
+			PipelineStageReport report = {mStageStarts[s], mStageStarts[s + 1] - mStageStarts[s], busySeconds[s],
+				(seconds > 0) ? busySeconds[s]/seconds : 0};
+			mLastReport.StageReports.push_back(report);
+		}
+		return mLastReport.Error;
+	}
+
+protected:
+	unsigned MicroBatchSize(unsigned microBatch, unsigned rows) const
+	{
+		const unsigned first = microBatch*mMicroBatchRows;
+		return (rows - first < mMicroBatchRows) ? rows - first : mMicroBatchRows;
+	}
+
+	//The output of "layer" for the micro-batch:
+	FloatingPointType* Activations(unsigned microBatch, unsigned layer)
+	{
+		return mActivations[(microBatch % mSlots)*mLayers.size() + layer];
+	}
+
+	FloatingPointType* Deltas(unsigned microBatch, unsigned layer)
+	{
+		return mDeltas[(microBatch % mSlots)*mLayers.size() + layer];
+	}
+
+	//The forward pass of the layers of the stage. The last stage calculates the output deltas and returns the sum of the errors:
+	double Forward(unsigned stage, unsigned microBatch, const AlignedMatrix<NetType::Input, FloatingPointType>& input,
+				   const AlignedMatrix<NetType::Output, FloatingPointType>& expected)
+	{
+		const unsigned rowCount = MicroBatchSize(microBatch, input.NumRows());
+		for (unsigned l = mStageStarts[stage]; l < mStageStarts[stage + 1]; ++l)
+		{
+			const FloatingPointType* pInput = l ? Activations(microBatch, l - 1) : input.GetRow(microBatch*mMicroBatchRows);
+			mLayers[l].Forward(mLayers[l].pLayer, pInput, Activations(microBatch, l), rowCount);
+		}
+		if (stage + 1 < NumStages())
+			return 0;
+
+		const unsigned last = (unsigned)mLayers.size() - 1;
+		const unsigned stride = AlignedMatrix<NetType::Output, FloatingPointType>::AlignedRowSize;
+		const FloatingPointType* pOutput = Activations(microBatch, last);
+		FloatingPointType* pDelta = Deltas(microBatch, last);
+		double error = 0;
+		for (unsigned s = 0; s < rowCount; ++s)
+		{
+			error += CalculateOutputDeltas(pOutput + s*stride, expected.GetRow(microBatch*mMicroBatchRows + s), pDelta + s*stride, NetType::Output);
+		}
+		return error/NetType::Output;
+	}
+
+	//The backward pass of the layers of the stage, from the top:
+	void Backward(unsigned stage, unsigned microBatch, const AlignedMatrix<NetType::Input, FloatingPointType>& input, double learningRate)
+	{
+		const unsigned rowCount = MicroBatchSize(microBatch, input.NumRows());
+		for (unsigned l = mStageStarts[stage + 1]; l-- > mStageStarts[stage]; )
+		{
+			const FloatingPointType* pInput = l ? Activations(microBatch, l - 1) : input.GetRow(microBatch*mMicroBatchRows);
+			mLayers[l].Backward(mLayers[l].pLayer, pInput, Activations(microBatch, l), Deltas(microBatch, l),
+				l ? Deltas(microBatch, l - 1) : NULL, rowCount, learningRate);
+		}
+	}
+
+	void AllocateBuffers()
+	{
+		FreeBuffers();
+		//Stage 0 keeps a micro-batch from its forward pass until its backward one, 2*(S - 1) ticks later:
+		mSlots = 2*NumStages() - 1;
+		for (unsigned slot = 0; slot < mSlots; ++slot)
+		{
+			for (unsigned l = 0; l < mLayers.size(); ++l)
+			{
+				const size_t size = mMicroBatchRows*AVXAlign<FloatingPointType>(mLayers[l].Output)*sizeof(FloatingPointType);
+				mActivations.push_back((FloatingPointType*)_aligned_malloc(size, 32));
+				mDeltas.push_back((FloatingPointType*)_aligned_malloc(size, 32));
+				if (!mActivations.back() || !mDeltas.back())
+					throw std::string("Not enough memory for the pipeline");
+			}
+		}
+	}
+
+	void FreeBuffers()
+	{
+		for (unsigned i = 0; i < mActivations.size(); ++i)
+		{
+			_aligned_free(mActivations[i]);
+			_aligned_free(mDeltas[i]);
+		}
+		mActivations.clear();
+		mDeltas.clear();
+	}
+};
+
+}//FastNets namespace
@@ -0,0 +1,270 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <math.h>
+#include "Net.h"
+
+namespace FastNets
+{
+/* Post-training int8 quantization for forward inference.
+Each weight row is scaled to -127..127 by its own scale. The inputs of each layer are mapped
+to 0..127 (7 bits, so that _mm256_maddubs_epi16 never saturates) with a scale and a zero point,
+calibrated on sample inputs. The bias and the activation are calculated in single precision.
+Example usage:
+	Net<167, Net<112, Net<9>>> net(...);
+	//... train the net
+	QuantizedNet<Net<167, Net<112, Net<9>>>> quantized(net, calibrationInput);
+	QuantizationReport report = quantized.CompareWith(net, testInput);
+*/
+
+//The difference between the outputs of the quantized and the original net:
+struct QuantizationReport
+{
+	double MaxError;//The largest absolute difference of a single output
+	double MeanError;//The average absolute difference
+	double RootMeanSquareError;
+	double SameArgMax;//The fraction of samples, which largest output is the same in both nets
+};
+
+template<unsigned INPUT, unsigned OUTPUT, class Activation>
+class QuantizedLayer
+{
+protected:
+	AlignedMatrix<INPUT, signed char>	mWeights;//The padding is 0
+	float*								mWeightScales;
+	float*								mB;
+	int*								mRowSums;//Sum of each row of weights, to subtract the zero point
+	float								mInputScale;
+	int									mInputZeroPoint;
+private:
+	QuantizedLayer(const QuantizedLayer&){}//No copy
+public:
+	const static unsigned Input		= INPUT;
+	const static unsigned Output	= OUTPUT;
+	const static unsigned AlignedInput = AlignedMatrix<INPUT, unsigned char>::AlignedRowSize;
+
+	QuantizedLayer()
+		:mWeights(OUTPUT), mInputScale(1), mInputZeroPoint(0)
+	{
+		mWeightScales = (float*)_aligned_malloc(OUTPUT*sizeof(float), 32);
+		mB = (float*)_aligned_malloc(OUTPUT*sizeof(float), 32);
+		mRowSums = (int*)_aligned_malloc(OUTPUT*sizeof(int), 32);
+	}
+
+	~QuantizedLayer()
+	{
+		_aligned_free(mWeightScales);
+		_aligned_free(mB);
+		_aligned_free(mRowSums);
+	}
+
+	/* Quantizes the weights of "layer". "inputMin" and "inputMax" are the range of its inputs
+	observed during the calibration. */
+	template<class FloatingPoint>
+	void Quantize(const Layer<INPUT, OUTPUT, FloatingPoint, Activation>& layer, double inputMin, double inputMax)
+	{
+		//The range has to include 0, so that the zero point is in 0..127:
+		if (inputMin > 0) inputMin = 0;
+		if (inputMax < 0) inputMax = 0;
+		mInputScale = (inputMax > inputMin) ? (float)((inputMax - inputMin)/127) : 1.0f;
+		mInputZeroPoint = (int)floor(-inputMin/mInputScale + 0.5);
+
+		for (unsigned i = 0; i < OUTPUT; ++i)
+		{
+			double maxWeight = 0;
+			for (unsigned j = 0; j < INPUT; ++j)
+			{
+				double weight = fabs((double)layer.GetWeight(j, i));
+				if (maxWeight < weight)
+					maxWeight = weight;
+			}
+			mWeightScales[i] = (maxWeight > 0) ? (float)(maxWeight/127) : 1.0f;
+
+			signed char* pRow = mWeights.GetRow(i);
+			int rowSum = 0;
+			for (unsigned j = 0; j < AlignedInput; ++j)
+			{
+				int weight = (j < INPUT) ? (int)floor(layer.GetWeight(j, i)/mWeightScales[i] + 0.5) : 0;
+				pRow[j] = (signed char)weight;
+				rowSum += weight;
+			}
+			mRowSums[i] = rowSum;
+			mB[i] = (float)layer.GetWeight(INPUT, i);
+		}
+	}
+
+	/* IMPORTANT: This one requires _CRT_ALIGN(32) "output" */
+	template<class T>
+	void ProcessInput(const T* input, float* output) const
+	{
+		_CRT_ALIGN(32) unsigned char quantizedInput[AlignedInput];
+		_CRT_ALIGN(32) int sums[OUTPUT];
+		const float inverseScale = 1/mInputScale;
+		for (unsigned j = 0; j < INPUT; ++j)
+		{
+			int value = (int)floor(input[j]*inverseScale + 0.5f) + mInputZeroPoint;
+			quantizedInput[j] = (unsigned char)((value < 0) ? 0 : (value > 127 ? 127 : value));
+		}
+		for (unsigned j = INPUT; j < AlignedInput; ++j)
+		{
+			quantizedInput[j] = 0;
+		}
+
+		ProcessInputInt8(quantizedInput, sums, AlignedInput, OUTPUT, mWeights.GetBuffer());
+		for (unsigned i = 0; i < OUTPUT; ++i)
+		{
+			output[i] = (sums[i] - mInputZeroPoint*mRowSums[i])*mInputScale*mWeightScales[i] + mB[i];
+		}
+		Activation::Apply(output, OUTPUT);
+	}
+};
+
+//Mirrors the structure of the Net. See the specializations below.
+template<class NetType>
+class QuantizedNet;
+
+template<unsigned INPUT, class UpperNet, class Activation>
+class QuantizedNet<Net<INPUT, UpperNet, Activation> >
+{
+public:
+	typedef Net<INPUT, UpperNet, Activation> NetType;
+	typedef typename NetType::FloatingPointType FloatingPointType;
+	const static unsigned Input = INPUT;
+	const static unsigned Output = NetType::Output;
+	const static bool	  Last = false;
+protected:
+	QuantizedLayer<INPUT, UpperNet::Input, Activation>	mInputLayer;
+	QuantizedNet<UpperNet>								mNext;
+private:
+	QuantizedNet(const QuantizedNet&){}//No copy
+public:
+	QuantizedNet(){}
+
+	/* Quantizes a trained net. The rows of "calibrationInput" should be representative of the inputs
+	the net will process, as they determine the ranges of the inputs of each layer. */
+	QuantizedNet(const NetType& net, const AlignedMatrix<INPUT, FloatingPointType>& calibrationInput)
+	{
+		Quantize(net, calibrationInput);
+	}
+
+	void Quantize(const NetType& net, const AlignedMatrix<INPUT, FloatingPointType>& calibrationInput)
+	{
+		if (!calibrationInput.NumRows())
+			throw std::string("No calibration input");
+		double inputMin = 1e100, inputMax = -1e100;
+		for (unsigned i = 0; i < calibrationInput.NumRows(); ++i)
+		{
+			const FloatingPointType* pRow = calibrationInput.GetRow(i);
+			for (unsigned j = 0; j < INPUT; ++j)
+			{
+				if (inputMin > pRow[j]) inputMin = pRow[j];
+				if (inputMax < pRow[j]) inputMax = pRow[j];
+			}
+		}
+		mInputLayer.Quantize(net.GetInputLayer(), inputMin, inputMax);
+		if (!UpperNet::Last)//Should be constant expression
+		{
+			//The outputs of the original layer are the calibration input of the next one:
+			AlignedMatrix<UpperNet::Input, FloatingPointType> nextInput(calibrationInput.NumRows());
+			net.GetInputLayer().ProcessBatchFast(calibrationInput.GetBuffer(), nextInput.GetBuffer(), calibrationInput.NumRows());
+			mNext.Quantize(net.GetNext(), nextInput);
+		}
+	}
+
+	void ProcessInput(const FloatingPointType* input, FloatingPointType* output) const
+	{
+		_CRT_ALIGN(32) float result[Output];
+		ProcessQuantized(input, result);
+		for (unsigned i = 0; i < Output; ++i)
+		{
+			output[i] = (FloatingPointType)result[i];
+		}
+	}
+
+	void BatchProcessInput(const AlignedMatrix<INPUT, FloatingPointType>& input, AlignedMatrix<Output, FloatingPointType>& output) const
+	{
+		if (input.NumRows() != output.NumRows())
+			throw std::string("Different number of rows between the two matrices.");
+		const int threads = ParallelThreads((double)input.NumRows()*NetType::Weights, input.NumRows());
+		#pragma omp parallel for num_threads(threads) if (threads > 1)
+		for (int i = 0; i < (int)input.NumRows(); ++i)
+		{
+			ProcessInput(input.GetRow(i), output.GetRow(i));
+		}
+	}
+
+	/* Runs both nets on the rows of "input" and compares the outputs. */
+	QuantizationReport CompareWith(const NetType& net, const AlignedMatrix<INPUT, FloatingPointType>& input) const
+	{
+		AlignedMatrix<Output, FloatingPointType> expected(input.NumRows()), actual(input.NumRows());
+		net.BatchProcessInputFast(input, expected);
+		BatchProcessInput(input, actual);
+
+		QuantizationReport report = {0, 0, 0, 0};
+		for (unsigned i = 0; i < input.NumRows(); ++i)
+		{
+			const FloatingPointType* pExpected = expected.GetRow(i);
+			const FloatingPointType* pActual = actual.GetRow(i);
+			unsigned expectedMax = 0, actualMax = 0;
+			for (unsigned j = 0; j < Output; ++j)
+			{
+				double error = fabs((double)pExpected[j] - pActual[j]);
+				if (report.MaxError < error)
+					report.MaxError = error;
+				report.MeanError += error;
+				report.RootMeanSquareError += error*error;
+				if (pExpected[expectedMax] < pExpected[j]) expectedMax = j;
+				if (pActual[actualMax] < pActual[j]) actualMax = j;
+			}
+			if (expectedMax == actualMax)
+				report.SameArgMax += 1;
+		}
+		const double count = (double)input.NumRows()*Output;
+		report.MeanError /= count;
+		report.RootMeanSquareError = sqrt(report.RootMeanSquareError/count);
+		report.SameArgMax /= input.NumRows();
+		return report;
+	}
+
+	//This method should be called only by the methods above.
+	template<class T>
+	void ProcessQuantized(const T* input, float* output) const
+	{
+		if (UpperNet::Last)//Should be constant expression
+		{
+			mInputLayer.ProcessInput(input, output);
+		}
+		else
+		{
+			_CRT_ALIGN(32) float intermediate[UpperNet::Input];
+			mInputLayer.ProcessInput(input, intermediate);
+			mNext.ProcessQuantized(intermediate, output);
+		}
+	}
+};
+
+//The ending of the stack:
+template<unsigned INPUT>
+class QuantizedNetEnd
+{
+public:
+	const static unsigned Input = INPUT;
+	const static unsigned Output = INPUT;
+	const static bool Last = true;
+
+	template<class NetType, class FloatingPoint>
+	void Quantize(const NetType& net, const AlignedMatrix<INPUT, FloatingPoint>& calibrationInput){}
+	template<class T>
+	void ProcessQuantized(const T* input, float* output) const { throw std::string("Execution Flow error"); }
+};
+
+template<unsigned INPUT, class Activation>
+class QuantizedNet<Net<INPUT, double, Activation> > : public QuantizedNetEnd<INPUT>
+{
+};
+
+template<unsigned INPUT, class Activation>
+class QuantizedNet<Net<INPUT, float, Activation> > : public QuantizedNetEnd<INPUT>
+{
+};
+
+}//FastNets namespace
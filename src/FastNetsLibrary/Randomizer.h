@@ -4,47 +4,127 @@
 
 #include <Windows.h>
 #include <stdio.h>
-#include <boost/random/mersenne_twister.hpp>
-#include <boost/random/uniform_int_distribution.hpp>
+#include <intrin.h>
+#include "FloatingPoint.h"
 
 namespace FastNets
 {
-	/* Helper class for generating random numbers */
-	template <class Distribution = boost::random::uniform_int_distribution<>>
+	/* Helper class for generating random numbers. The numbers come from the counter-based Philox4x32-10 generator
+	(see PhiloxBlock): each 128 bit counter {position, step, individual, layer} gives 4 random words with the 64 bit
+	seed as the key. So a stream is a function of (seed, individual, layer, step) only and any part of it can be
+	generated independently of the others, e.g. by different threads in any order:
+		Randomizer r(seed, individual, layer);
+		r.FillUniform(values, count);//The same numbers on every run, on all the tiers of the kernels
+	The draws of the scalar methods (Next, BiasNext, ...) continue from the position of the last bulk one. */
 	class Randomizer
 	{
 		unsigned mMax;
-		boost::mt11213b mGen;
-		Distribution mDist;
+		unsigned mKey[2];
+		unsigned mCounter[PhiloxCounterWords];//{position, step, individual, layer}
+		unsigned mBlock[PhiloxCounterWords];//The words of the last block for the scalar draws
+		unsigned mUsed;//The words of mBlock already drawn
 	private:
 		Randomizer(const Randomizer&){}//No copy
 	public:
-		//Note the seed passed to the mGen. The regular "time" function is not
-		//good enough, as many of the calculations happen between less than 1 second
-		//intervals.
+		//Note the seed. The regular "time" function is not good enough, as many of the calculations happen
+		//between less than 1 second intervals. Under FIXED_RANDOM the seeds are 1, 2, 3, ... in the order of
+		//construction (counted atomically, as randomizers are created by parallel threads too).
 		Randomizer(unsigned max = 10000)
-			:mMax(max), mDist(1, max) 
-#ifndef FIXED_RANDOM
-			, mGen((uint32_t)__rdtsc())
-#endif
+			:mMax(max)
 		{
 #ifdef FIXED_RANDOM
-			static int seed;
-			mGen.seed(++seed);
+			static volatile long sSeed;
+			SetSeed((unsigned long long)InterlockedIncrement(&sSeed));
+#else
+			SetSeed(__rdtsc());
 #endif
+			SetStream(0, 0);
+		}
+
+		//A reproducible stream:
+		Randomizer(unsigned long long seed, unsigned individual, unsigned layer = 0, unsigned max = 10000)
+			:mMax(max)
+		{
+			SetSeed(seed);
+			SetStream(individual, layer);
 		}
+
 		unsigned Max() const { return mMax; }
+		unsigned long long Seed() const { return ((unsigned long long)mKey[1] << 32) | mKey[0]; }
+		unsigned Individual() const { return mCounter[2]; }
+		unsigned Layer() const { return mCounter[3]; }
+		unsigned Step() const { return mCounter[1]; }
+		//The next unused block of the stream:
+		unsigned Position() const { return mCounter[0]; }
+
+		//Starts the stream of the "individual" and the "layer" from the beginning. The "step" separates more streams
+		//of the same layer, e.g. the ones of the generations of a Population:
+		void SetStream(unsigned individual, unsigned layer, unsigned step = 0)
+		{
+			mCounter[0] = 0;
+			mCounter[1] = step;
+			mCounter[2] = individual;
+			mCounter[3] = layer;
+			mUsed = PhiloxCounterWords;
+		}
+
+		//Starts the stream of "layer" of the same individual and step:
+		void SetLayer(unsigned layer) { SetStream(mCounter[2], layer, mCounter[1]); }
+
+		//Skips "blocks" blocks (4 numbers each) of the stream, e.g. the ones generated by FillUniformAt:
+		void Skip(unsigned blocks)
+		{
+			mCounter[0] += blocks;
+			mUsed = PhiloxCounterWords;
+		}
 
-		//Returns a random number:
-		int Next() { return mDist(mGen); }
+		//Returns a random number in [1, Max()]:
+		int Next() { return 1 + (int)(((unsigned long long)NextWord()*mMax) >> 32); }
 
 		//True or False:
-		bool NextBool() { return !!(Next() % 2); }
-		//Returns (0..1)
-		double BiasNext() { return ((double)Next())/mMax; }
+		bool NextBool() { return (NextWord() & 1) != 0; }
+		//64 random bits, e.g. 64 decisions of NextBool at once:
+		unsigned long long NextMask() { unsigned long long high = NextWord(); return (high << 32) | NextWord(); }
+		//Returns (0..1), with the full 32 bits of a word:
+		double BiasNext() { return PhiloxUniform(NextWord()); }
 		//Returns (-absMax, absMax):
 		double RangeNext(double absMax){ return absMax*(2*BiasNext() - 1); }
 		//Returns (1 - offsetMax, 1 + offsetMax)
 		double OffsetNext(double offsetMax){ return 1.0 + RangeNext(offsetMax); }
+
+		/* Fills "values" with "count" uniform numbers in (0, 1) with the SIMD kernels (see GenerateUniform) and moves
+		the stream past them. The draws start at a new block. */
+		template<class T>
+		void FillUniform(T* values, unsigned count)
+		{
+			FillUniformAt(0, values, count);
+			Skip(PhiloxBlocks(count));
+		}
+
+		/* The same numbers as FillUniform after skipping "blocks" blocks, without moving the stream. Parallel loops
+		give each thread its own range of blocks and Skip all of them at the end. */
+		template<class T>
+		void FillUniformAt(unsigned blocks, T* values, unsigned count) const
+		{
+			unsigned counter[PhiloxCounterWords] = { mCounter[0] + blocks, mCounter[1], mCounter[2], mCounter[3] };
+			GenerateUniform(mKey, counter, values, count);
+		}
+	protected:
+		void SetSeed(unsigned long long seed)
+		{
+			mKey[0] = (unsigned)seed;
+			mKey[1] = (unsigned)(seed >> 32);
+		}
+
+		unsigned NextWord()
+		{
+			if (mUsed == PhiloxCounterWords)
+			{
+				PhiloxBlock(mCounter, mKey, mBlock);
+				++mCounter[0];
+				mUsed = 0;
+			}
+			return mBlock[mUsed++];
+		}
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,378 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <immintrin.h>
+#include <math.h>
+
+//AVX-512 intrinsics are available only in the newer compilers:
+#if defined(__AVX512F__) || (defined(_MSC_VER) && _MSC_VER >= 1911)
+	#define FASTNETS_AVX512
+#endif
+
+namespace FastNets
+{
+namespace Simd
+{
+//Each translation unit has its own copy (see Kernels.h):
+namespace
+{
+	/* Thin wrappers over the SIMD intrinsics, so that the kernels are written once for each
+	instruction set and floating point type. Each wrapper provides:
+		Type, Vector, Width				- the floating point type, the register and the number of elements in it
+		Zero, Set, Load, Store			- Load and Store require Width*sizeof(Type) aligned pointers, except for AVX-512
+		Add, Sub, Mul, MulAdd(a, b, c)	- MulAdd calculates a*b + c, fused when the instruction set allows it
+		Sum(v), Sum4(a, b, c, d, res)	- horizontal sums; Sum4 stores 4 sums in 32 byte aligned "res"
+		Div, Sqrt, Min, Max, Round		- Round is to the nearest integer
+		Step(v)							- 1 for the positive elements of v, 0 for the rest
+		Blend(a, b, bits)				- the elements of b, which bits (the lowest Width of "bits") are set, and of a for the rest
+		Scale(p, n)						- p*2^n for integer valued n, in the range of the exponent
+	The double precision ones also have LoadFloat and StoreFloat, which convert Width floats at unaligned pointers.
+	*/
+
+	//A single element with the arithmetic of the wrappers below, e.g. for the tails of the kernels:
+	template<class T>
+	struct Scalar
+	{
+		typedef T Type;
+		typedef T Vector;
+		const static unsigned Width = 1;
+
+		static Vector Zero() { return 0; }
+		static Vector Set(T value) { return value; }
+		static Vector Load(const T* p) { return *p; }
+		static void Store(T* p, Vector v) { *p = v; }
+		static Vector Add(Vector a, Vector b) { return a + b; }
+		static Vector Sub(Vector a, Vector b) { return a - b; }
+		static Vector Mul(Vector a, Vector b) { return a*b; }
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return a*b + c; }
+		static Vector Div(Vector a, Vector b) { return a/b; }
+		static Vector Sqrt(Vector v) { return (T)sqrt(v); }
+		static Vector LoadFloat(const float* p) { return (T)*p; }
+		static void StoreFloat(float* p, Vector v) { *p = (float)v; }
+		static Vector Min(Vector a, Vector b) { return (a < b) ? a : b; }
+		static Vector Max(Vector a, Vector b) { return (a > b) ? a : b; }
+		static Vector Step(Vector v) { return (T)((v > 0) ? 1 : 0); }
+		static Vector Blend(Vector a, Vector b, unsigned bits) { return (bits & 1) ? b : a; }
+		static T Sum(Vector v) { return v; }
+	};
+
+	struct SSE2Double
+	{
+		typedef double Type;
+		typedef __m128d Vector;
+		const static unsigned Width = 2;
+
+		static Vector Zero() { return _mm_setzero_pd(); }
+		static Vector Set(double value) { return _mm_set1_pd(value); }
+		static Vector Load(const double* p) { return _mm_load_pd(p); }
+		static void Store(double* p, Vector v) { _mm_store_pd(p, v); }
+		static Vector Add(Vector a, Vector b) { return _mm_add_pd(a, b); }
+		static Vector Sub(Vector a, Vector b) { return _mm_sub_pd(a, b); }
+		static Vector Mul(Vector a, Vector b) { return _mm_mul_pd(a, b); }
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+		static Vector Div(Vector a, Vector b) { return _mm_div_pd(a, b); }
+		static Vector Sqrt(Vector v) { return _mm_sqrt_pd(v); }
+		static Vector LoadFloat(const float* p) { return _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)p))); }
+		static void StoreFloat(float* p, Vector v) { _mm_storel_epi64((__m128i*)p, _mm_castps_si128(_mm_cvtpd_ps(v))); }
+		static Vector Min(Vector a, Vector b) { return _mm_min_pd(a, b); }
+		static Vector Max(Vector a, Vector b) { return _mm_max_pd(a, b); }
+		static Vector Round(Vector v) { return _mm_cvtepi32_pd(_mm_cvtpd_epi32(v)); }
+		static Vector Step(Vector v) { return _mm_and_pd(_mm_cmpgt_pd(v, _mm_setzero_pd()), _mm_set1_pd(1)); }
+		static Vector Blend(Vector a, Vector b, unsigned bits)
+		{
+			__m128d mask = _mm_castsi128_pd(_mm_set_epi32(-(int)((bits >> 1) & 1), -(int)((bits >> 1) & 1), -(int)(bits & 1), -(int)(bits & 1)));
+			return _mm_or_pd(_mm_and_pd(mask, b), _mm_andnot_pd(mask, a));
+		}
+		static Vector Scale(Vector p, Vector n)
+		{
+			__m128i exponent = _mm_add_epi32(_mm_cvtpd_epi32(n), _mm_set1_epi32(1023));
+			exponent = _mm_slli_epi64(_mm_unpacklo_epi32(exponent, _mm_setzero_si128()), 52);
+			return _mm_mul_pd(p, _mm_castsi128_pd(exponent));
+		}
+		static double Sum(Vector v) { return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v))); }
+		static void Sum4(Vector a, Vector b, Vector c, Vector d, double* result)
+		{
+			result[0] = Sum(a); result[1] = Sum(b); result[2] = Sum(c); result[3] = Sum(d);
+		}
+	};
+
+	struct SSE2Float
+	{
+		typedef float Type;
+		typedef __m128 Vector;
+		const static unsigned Width = 4;
+
+		static Vector Zero() { return _mm_setzero_ps(); }
+		static Vector Set(float value) { return _mm_set1_ps(value); }
+		static Vector Load(const float* p) { return _mm_load_ps(p); }
+		static void Store(float* p, Vector v) { _mm_store_ps(p, v); }
+		static Vector Add(Vector a, Vector b) { return _mm_add_ps(a, b); }
+		static Vector Sub(Vector a, Vector b) { return _mm_sub_ps(a, b); }
+		static Vector Mul(Vector a, Vector b) { return _mm_mul_ps(a, b); }
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+		static Vector Div(Vector a, Vector b) { return _mm_div_ps(a, b); }
+		static Vector Sqrt(Vector v) { return _mm_sqrt_ps(v); }
+		static Vector Min(Vector a, Vector b) { return _mm_min_ps(a, b); }
+		static Vector Max(Vector a, Vector b) { return _mm_max_ps(a, b); }
+		static Vector Round(Vector v) { return _mm_cvtepi32_ps(_mm_cvtps_epi32(v)); }
+		static Vector Step(Vector v) { return _mm_and_ps(_mm_cmpgt_ps(v, _mm_setzero_ps()), _mm_set1_ps(1)); }
+		static Vector Blend(Vector a, Vector b, unsigned bits)
+		{
+			__m128 mask = _mm_castsi128_ps(_mm_set_epi32(-(int)((bits >> 3) & 1), -(int)((bits >> 2) & 1), -(int)((bits >> 1) & 1), -(int)(bits & 1)));
+			return _mm_or_ps(_mm_and_ps(mask, b), _mm_andnot_ps(mask, a));
+		}
+		static Vector Scale(Vector p, Vector n)
+		{
+			__m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+			return _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+		}
+		static float Sum(Vector v)
+		{
+			v = _mm_add_ps(v, _mm_movehl_ps(v, v));//{v0 + v2, v1 + v3, ...}
+			v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+			return _mm_cvtss_f32(v);
+		}
+		static void Sum4(Vector a, Vector b, Vector c, Vector d, float* result)
+		{
+			_MM_TRANSPOSE4_PS(a, b, c, d);
+			_mm_store_ps(result, _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d)));
+		}
+	};
+
+	struct AVXDouble
+	{
+		typedef double Type;
+		typedef __m256d Vector;
+		const static unsigned Width = 4;
+
+		static Vector Zero() { return _mm256_setzero_pd(); }
+		static Vector Set(double value) { return _mm256_set1_pd(value); }
+		static Vector Load(const double* p) { return _mm256_load_pd(p); }
+		static void Store(double* p, Vector v) { _mm256_store_pd(p, v); }
+		static Vector Add(Vector a, Vector b) { return _mm256_add_pd(a, b); }
+		static Vector Sub(Vector a, Vector b) { return _mm256_sub_pd(a, b); }
+		static Vector Mul(Vector a, Vector b) { return _mm256_mul_pd(a, b); }
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return _mm256_add_pd(_mm256_mul_pd(a, b), c); }
+		static Vector Div(Vector a, Vector b) { return _mm256_div_pd(a, b); }
+		static Vector Sqrt(Vector v) { return _mm256_sqrt_pd(v); }
+		static Vector LoadFloat(const float* p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+		static void StoreFloat(float* p, Vector v) { _mm_storeu_ps(p, _mm256_cvtpd_ps(v)); }
+		static Vector Min(Vector a, Vector b) { return _mm256_min_pd(a, b); }
+		static Vector Max(Vector a, Vector b) { return _mm256_max_pd(a, b); }
+		static Vector Round(Vector v) { return _mm256_round_pd(v, _MM_FROUND_TO_NEAREST_INT); }
+		static Vector Step(Vector v) { return _mm256_and_pd(_mm256_cmp_pd(v, _mm256_setzero_pd(), _CMP_GT_OQ), _mm256_set1_pd(1)); }
+		static Vector Blend(Vector a, Vector b, unsigned bits)
+		{
+			//The sign bits select:
+			return _mm256_blendv_pd(a, b, _mm256_castsi256_pd(_mm256_set_epi32(-(int)((bits >> 3) & 1), 0, -(int)((bits >> 2) & 1), 0, 
+				-(int)((bits >> 1) & 1), 0, -(int)(bits & 1), 0)));
+		}
+		static Vector Scale(Vector p, Vector n)
+		{
+			//There are no 256 bit integer instructions in AVX, so the exponent is built in two halves:
+			__m128i exponent = _mm_add_epi32(_mm256_cvtpd_epi32(n), _mm_set1_epi32(1023));
+			__m128i low = _mm_slli_epi64(_mm_unpacklo_epi32(exponent, _mm_setzero_si128()), 52);
+			__m128i high = _mm_slli_epi64(_mm_unpackhi_epi32(exponent, _mm_setzero_si128()), 52);
+			__m256i bits = _mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1);
+			return _mm256_mul_pd(p, _mm256_castsi256_pd(bits));
+		}
+
+		static double Sum(Vector v)
+		{
+			v = _mm256_hadd_pd(v, v);//{v0 + v1, v0 + v1, v2 + v3, v2 + v3}
+			Vector tmp = _mm256_permute2f128_pd(v, v, 1);//{v2 + v3, v2 + v3, v0 + v1, v0 + v1}
+			v = _mm256_add_pd(v, tmp);//{v0 + v1 + v2 + v3, ....}
+			return _mm_cvtsd_f64(_mm256_castpd256_pd128(v));
+		}
+
+		static void Sum4(Vector a, Vector b, Vector c, Vector d, double* result)
+		{
+			Vector ab = _mm256_hadd_pd(a, b);//{a0 + a1, b0 + b1, a2 + a3, b2 + b3}
+			Vector cd = _mm256_hadd_pd(c, d);//{c0 + c1, d0 + d1, c2 + c3, d2 + d3}
+			Vector low = _mm256_permute2f128_pd(ab, cd, 0x20);//{a0 + a1, b0 + b1, c0 + c1, d0 + d1}
+			Vector high = _mm256_permute2f128_pd(ab, cd, 0x31);//{a2 + a3, b2 + b3, c2 + c3, d2 + d3}
+			_mm256_store_pd(result, _mm256_add_pd(low, high));
+		}
+	};
+
+	struct AVXFloat
+	{
+		typedef float Type;
+		typedef __m256 Vector;
+		const static unsigned Width = 8;
+
+		static Vector Zero() { return _mm256_setzero_ps(); }
+		static Vector Set(float value) { return _mm256_set1_ps(value); }
+		static Vector Load(const float* p) { return _mm256_load_ps(p); }
+		static void Store(float* p, Vector v) { _mm256_store_ps(p, v); }
+		static Vector Add(Vector a, Vector b) { return _mm256_add_ps(a, b); }
+		static Vector Sub(Vector a, Vector b) { return _mm256_sub_ps(a, b); }
+		static Vector Mul(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return _mm256_add_ps(_mm256_mul_ps(a, b), c); }
+		static Vector Div(Vector a, Vector b) { return _mm256_div_ps(a, b); }
+		static Vector Sqrt(Vector v) { return _mm256_sqrt_ps(v); }
+		static Vector Min(Vector a, Vector b) { return _mm256_min_ps(a, b); }
+		static Vector Max(Vector a, Vector b) { return _mm256_max_ps(a, b); }
+		static Vector Round(Vector v) { return _mm256_round_ps(v, _MM_FROUND_TO_NEAREST_INT); }
+		static Vector Step(Vector v) { return _mm256_and_ps(_mm256_cmp_ps(v, _mm256_setzero_ps(), _CMP_GT_OQ), _mm256_set1_ps(1)); }
+		static Vector Blend(Vector a, Vector b, unsigned bits)
+		{
+			return _mm256_blendv_ps(a, b, _mm256_castsi256_ps(_mm256_set_epi32(-(int)((bits >> 7) & 1), -(int)((bits >> 6) & 1), 
+				-(int)((bits >> 5) & 1), -(int)((bits >> 4) & 1), -(int)((bits >> 3) & 1), -(int)((bits >> 2) & 1), -(int)((bits >> 1) & 1), -(int)(bits & 1))));
+		}
+		static Vector Scale(Vector p, Vector n)
+		{
+			__m256i exponent = _mm256_cvtps_epi32(n);
+			__m128i low = _mm_slli_epi32(_mm_add_epi32(_mm256_castsi256_si128(exponent), _mm_set1_epi32(127)), 23);
+			__m128i high = _mm_slli_epi32(_mm_add_epi32(_mm256_extractf128_si256(exponent, 1), _mm_set1_epi32(127)), 23);
+			__m256i bits = _mm256_insertf128_si256(_mm256_castsi128_si256(low), high, 1);
+			return _mm256_mul_ps(p, _mm256_castsi256_ps(bits));
+		}
+
+		static float Sum(Vector v)
+		{
+			__m128 res = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));//{v0 + v4, v1 + v5, ...}
+			res = _mm_hadd_ps(res, res);
+			res = _mm_hadd_ps(res, res);
+			return _mm_cvtss_f32(res);
+		}
+
+		static void Sum4(Vector a, Vector b, Vector c, Vector d, float* result)
+		{
+			Vector ab = _mm256_hadd_ps(a, b);//{a0 + a1, a2 + a3, b0 + b1, b2 + b3, a4 + a5, ...}
+			Vector cd = _mm256_hadd_ps(c, d);
+			Vector abcd = _mm256_hadd_ps(ab, cd);//{a0..a3, b0..b3, c0..c3, d0..d3, a4..a7, b4..b7, ...}
+			_mm_store_ps(result, _mm_add_ps(_mm256_castps256_ps128(abcd), _mm256_extractf128_ps(abcd, 1)));
+		}
+	};
+
+	//AVX2 machines also have FMA3. The rest is the same as AVX:
+	struct FMADouble : public AVXDouble
+	{
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return _mm256_fmadd_pd(a, b, c); }
+	};
+
+	struct FMAFloat : public AVXFloat
+	{
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return _mm256_fmadd_ps(a, b, c); }
+	};
+
+#ifdef FASTNETS_AVX512
+	//AlignedMatrix aligns the rows to 32 bytes only, so the loads and stores here are unaligned:
+	struct AVX512Double
+	{
+		typedef double Type;
+		typedef __m512d Vector;
+		const static unsigned Width = 8;
+
+		static Vector Zero() { return _mm512_setzero_pd(); }
+		static Vector Set(double value) { return _mm512_set1_pd(value); }
+		static Vector Load(const double* p) { return _mm512_loadu_pd(p); }
+		static void Store(double* p, Vector v) { _mm512_storeu_pd(p, v); }
+		static Vector Add(Vector a, Vector b) { return _mm512_add_pd(a, b); }
+		static Vector Sub(Vector a, Vector b) { return _mm512_sub_pd(a, b); }
+		static Vector Mul(Vector a, Vector b) { return _mm512_mul_pd(a, b); }
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return _mm512_fmadd_pd(a, b, c); }
+		static Vector Div(Vector a, Vector b) { return _mm512_div_pd(a, b); }
+		static Vector Sqrt(Vector v) { return _mm512_sqrt_pd(v); }
+		static Vector LoadFloat(const float* p) { return _mm512_cvtps_pd(_mm256_loadu_ps(p)); }
+		static void StoreFloat(float* p, Vector v) { _mm256_storeu_ps(p, _mm512_cvtpd_ps(v)); }
+		static Vector Min(Vector a, Vector b) { return _mm512_min_pd(a, b); }
+		static Vector Max(Vector a, Vector b) { return _mm512_max_pd(a, b); }
+		static Vector Round(Vector v) { return _mm512_roundscale_pd(v, _MM_FROUND_TO_NEAREST_INT); }
+		static Vector Step(Vector v) { return _mm512_maskz_mov_pd(_mm512_cmp_pd_mask(v, _mm512_setzero_pd(), _CMP_GT_OQ), _mm512_set1_pd(1)); }
+		static Vector Blend(Vector a, Vector b, unsigned bits) { return _mm512_mask_blend_pd((__mmask8)bits, a, b); }
+		static Vector Scale(Vector p, Vector n) { return _mm512_scalef_pd(p, n); }
+		static double Sum(Vector v) { return _mm512_reduce_add_pd(v); }
+		static void Sum4(Vector a, Vector b, Vector c, Vector d, double* result)
+		{
+			result[0] = Sum(a); result[1] = Sum(b); result[2] = Sum(c); result[3] = Sum(d);
+		}
+	};
+
+	struct AVX512Float
+	{
+		typedef float Type;
+		typedef __m512 Vector;
+		const static unsigned Width = 16;
+
+		static Vector Zero() { return _mm512_setzero_ps(); }
+		static Vector Set(float value) { return _mm512_set1_ps(value); }
+		static Vector Load(const float* p) { return _mm512_loadu_ps(p); }
+		static void Store(float* p, Vector v) { _mm512_storeu_ps(p, v); }
+		static Vector Add(Vector a, Vector b) { return _mm512_add_ps(a, b); }
+		static Vector Sub(Vector a, Vector b) { return _mm512_sub_ps(a, b); }
+		static Vector Mul(Vector a, Vector b) { return _mm512_mul_ps(a, b); }
+		static Vector MulAdd(Vector a, Vector b, Vector c) { return _mm512_fmadd_ps(a, b, c); }
+		static Vector Div(Vector a, Vector b) { return _mm512_div_ps(a, b); }
+		static Vector Sqrt(Vector v) { return _mm512_sqrt_ps(v); }
+		static Vector Min(Vector a, Vector b) { return _mm512_min_ps(a, b); }
+		static Vector Max(Vector a, Vector b) { return _mm512_max_ps(a, b); }
+		static Vector Round(Vector v) { return _mm512_roundscale_ps(v, _MM_FROUND_TO_NEAREST_INT); }
+		static Vector Step(Vector v) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(v, _mm512_setzero_ps(), _CMP_GT_OQ), _mm512_set1_ps(1)); }
+		static Vector Blend(Vector a, Vector b, unsigned bits) { return _mm512_mask_blend_ps((__mmask16)bits, a, b); }
+		static Vector Scale(Vector p, Vector n) { return _mm512_scalef_ps(p, n); }
+		static float Sum(Vector v) { return _mm512_reduce_add_ps(v); }
+		static void Sum4(Vector a, Vector b, Vector c, Vector d, float* result)
+		{
+			result[0] = Sum(a); result[1] = Sum(b); result[2] = Sum(c); result[3] = Sum(d);
+		}
+	};
+#endif
+	/* Vectorized exp(x). The argument is reduced to x = n*ln(2) + r, |r| <= ln(2)/2, and exp(r)
+	is calculated with its Taylor polynomial, so exp(x) = 2^n*exp(r). The arguments are clamped
+	to the range, where the result is a normal number.
+	Maximum relative error, compared to the CRT exp, over [-700, 700] (double) and [-87, 87] (float):
+		double: degree 12, 3.2e-16
+		float:  degree 7,  7.4e-8 (less than the float epsilon)
+	The errors of the sigmoid and tanh built on top of it are of the same order. */
+	template<class V>
+	typename V::Vector Exp(typename V::Vector x, const double*)
+	{
+		x = V::Min(V::Max(x, V::Set(-708.0)), V::Set(708.0));
+		typename V::Vector n = V::Round(V::Mul(x, V::Set(1.44269504088896340736)));//log2(e)
+		//ln(2) is split in two, so that n*ln(2) is subtracted without rounding errors:
+		typename V::Vector r = V::MulAdd(n, V::Set(-6.93147180369123816490e-01), x);
+		r = V::MulAdd(n, V::Set(-1.90821492927058770002e-10), r);
+		typename V::Vector p = V::Set(1.0/479001600);//1/12!
+		p = V::MulAdd(p, r, V::Set(1.0/39916800));
+		p = V::MulAdd(p, r, V::Set(1.0/3628800));
+		p = V::MulAdd(p, r, V::Set(1.0/362880));
+		p = V::MulAdd(p, r, V::Set(1.0/40320));
+		p = V::MulAdd(p, r, V::Set(1.0/5040));
+		p = V::MulAdd(p, r, V::Set(1.0/720));
+		p = V::MulAdd(p, r, V::Set(1.0/120));
+		p = V::MulAdd(p, r, V::Set(1.0/24));
+		p = V::MulAdd(p, r, V::Set(1.0/6));
+		p = V::MulAdd(p, r, V::Set(0.5));
+		p = V::MulAdd(p, r, V::Set(1.0));
+		p = V::MulAdd(p, r, V::Set(1.0));
+		return V::Scale(p, n);
+	}
+
+	template<class V>
+	typename V::Vector Exp(typename V::Vector x, const float*)
+	{
+		x = V::Min(V::Max(x, V::Set(-87.0f)), V::Set(87.0f));
+		typename V::Vector n = V::Round(V::Mul(x, V::Set(1.44269504f)));//log2(e)
+		//ln(2) is split in two, so that n*ln(2) is subtracted without rounding errors:
+		typename V::Vector r = V::MulAdd(n, V::Set(-0.693359375f), x);
+		r = V::MulAdd(n, V::Set(2.12194440e-4f), r);
+		typename V::Vector p = V::Set(1.0f/5040);//1/7!
+		p = V::MulAdd(p, r, V::Set(1.0f/720));
+		p = V::MulAdd(p, r, V::Set(1.0f/120));
+		p = V::MulAdd(p, r, V::Set(1.0f/24));
+		p = V::MulAdd(p, r, V::Set(1.0f/6));
+		p = V::MulAdd(p, r, V::Set(0.5f));
+		p = V::MulAdd(p, r, V::Set(1.0f));
+		p = V::MulAdd(p, r, V::Set(1.0f));
+		return V::Scale(p, n);
+	}
+
+	template<class V>
+	typename V::Vector Exp(typename V::Vector x)
+	{
+		return Exp<V>(x, (const typename V::Type*)0);
+	}
+}
+}//Simd namespace
+}//FastNets namespace
@@ -0,0 +1,55 @@
+// Published under Apache 2.0 licence.
+#pragma once
+#include <malloc.h>
+#include "AlignedMatrix.h"
+
+namespace FastNets
+{
+/* The scratch memory of Net::ProcessInputFast, Net::BatchProcessInputFast and Net::BackPropagation.
+The sizes are compile-time constants of the Net<> type chain, so deep and wide nets don't need the 
+stack and the calls don't allocate. The workspace is not thread safe, allocate one per thread:
+	Net<5, Net<3, Net<1>>> n(InitializeForBackProp);
+	Workspace<Net<5, Net<3, Net<1>>>> workspace;
+	n.BackPropagation(input, expected, 0.1, workspace);
+*/
+template<class NetType>
+class Workspace
+{
+public:
+	typedef typename NetType::FloatingPointType FloatingPointType;
+	//Ping-pong buffers for the hidden layers of a tile of rows (a single row uses their first rows):
+	const static unsigned ScratchSize = NetType::TileRows*AlignedMatrix<NetType::MaxHidden, FloatingPointType>::AlignedRowSize;
+	//Ping-pong buffers for the deltas of the back propagation of up to TileRows rows (see Net::BatchBackPropagation):
+	const static unsigned DeltasSize = NetType::TileRows*AlignedMatrix<NetType::MaxLayer, FloatingPointType>::AlignedRowSize;
+	//The outputs of all the layers for up to TileRows rows:
+	const static unsigned ActivationsSize = NetType::TileRows*NetType::ActivationsSize;
+	//Total number of elements:
+	const static unsigned Size = 2*ScratchSize + ActivationsSize + 2*DeltasSize;
+protected:
+	FloatingPointType* mpBuffer;
+private:
+	Workspace(const Workspace&){}//No copy
+public:
+	Workspace()
+	{
+		mpBuffer = (FloatingPointType*)_aligned_malloc(Size*sizeof(FloatingPointType), 32);
+		if (!mpBuffer)
+			throw std::string("Not enough memory for the workspace");
+	}
+
+	~Workspace()
+	{
+		_aligned_free(mpBuffer);
+	}
+
+	FloatingPointType* GetScratch() { return mpBuffer; }
+	FloatingPointType* GetNextScratch() { return mpBuffer + ScratchSize; }
+	//The outputs of all the layers, one after the other:
+	FloatingPointType* GetActivations() { return mpBuffer + 2*ScratchSize; }
+	FloatingPointType* GetDeltas() { return GetActivations() + ActivationsSize; }
+	FloatingPointType* GetNextDeltas() { return GetDeltas() + DeltasSize; }
+	//The outputs of a tile of rows for the fused error calculation (see Net::SumBatchError), shared with the deltas:
+	FloatingPointType* GetOutputs() { return GetDeltas(); }
+};
+
+}//FastNets namespace
@@ -9,6 +9,11 @@
 #include "..\FastNetsLibrary\Net.h"
 #include "..\FastNetsLibrary\Timer.h"
 #include "..\FastNetsLibrary\Genetic.h"
+#include "..\FastNetsLibrary\Quantized.h"
+#include "..\FastNetsLibrary\DynamicNet.h"
+#include "..\FastNetsLibrary\HogwildTrainer.h"
+#include "..\FastNetsLibrary\MixedPrecision.h"
+#include "..\FastNetsLibrary\PipelineTrainer.h"
 
 using namespace FastNets;
 using namespace std;
@@ -16,6 +21,80 @@ using namespace std;
 #define TEST_PERF
 #define TEST_GENETIC
 
+//The input of the mini-batch test:
+double MiniBatchInput(unsigned row, unsigned column, unsigned output)
+{
+	return ((column*row + column) % 17)*0.05 - 0.4;
+}
+
+//The input of the parallel test:
+double ParallelInput(unsigned row, unsigned column, unsigned output)
+{
+	return ((column*row + column) % 11)*0.05 - 0.25;
+}
+
+//The input of the pretraining test:
+double PretrainInput(unsigned row, unsigned column, unsigned output)
+{
+	return (column % output == row % output) ? 1 : ((column*row) % 7)*0.05;
+}
+
+//The default input of the training fixture, which leans towards the one-hot expected outputs:
+double LeaningInput(unsigned row, unsigned column, unsigned output)
+{
+	return ((column % output == row % output) ? 0.5 : -0.1) + ((column*row) % 7)*0.02;
+}
+
+/* The fixture of the training tests: "cloneCount" nets with the same random weights (through a file) and "rows" rows
+of "fill" inputs with one-hot expected outputs. 0 rows for the nets only, e.g. for the XOR data. */
+template<class NetType>
+class TrainingFixture
+{
+	std::vector<NetType*> mClones;
+	TrainingFixture(const TrainingFixture&){}//No copy
+public:
+	AlignedMatrix<NetType::Input>	Input;
+	AlignedMatrix<NetType::Output>	Expected;
+
+	typedef double (*InputFill)(unsigned row, unsigned column, unsigned output);
+
+	TrainingFixture(unsigned cloneCount, unsigned rows, InputFill fill = LeaningInput)
+		:Input(rows), Expected(rows)
+	{
+		{
+			NetType original(InitializeForBackProp);
+			original.WriteToFile("fixture");
+		}
+		for (unsigned i = 0; i < cloneCount; ++i)
+		{
+			mClones.push_back(new NetType("fixture"));
+		}
+		remove("fixture");
+		const unsigned output = NetType::Output;
+		for (unsigned j = 0; j < rows; ++j)
+		{
+			for (unsigned i = 0; i < NetType::Input; ++i)
+			{
+				Input.GetRow(j)[i] = fill(j, i, output);
+			}
+			for (unsigned i = 0; i < output; ++i)
+			{
+				Expected.GetRow(j)[i] = (j % output == i) ? 1 : 0;
+			}
+		}
+	}
+
+	~TrainingFixture()
+	{
+		for (unsigned i = 0; i < mClones.size(); ++i)
+		{
+			delete mClones[i];
+		}
+	}
+
+	NetType& Clone(unsigned index) { return *mClones[index]; }
+};
+
 int _tmain(int argc, _TCHAR* argv[])
 {
 	const unsigned input = 167;
@@ -112,11 +191,30 @@ int _tmain(int argc, _TCHAR* argv[])
 		if (!slowOutputMatrix.IsSame(fastOutputMatrix))
 			throw std::string("Different results");
 		cout << "Succeeded." << endl;
+
+		{
+			cout << "Verifying batches, which are not multiple of the tile size...";
+			const unsigned partialRows = 2*n.TileRows + 7;
+			AlignedMatrix<input> partialInput(partialRows);
+			AlignedMatrix<output> partialSlow(partialRows), partialFast(partialRows);
+			for (unsigned j = 0; j < partialRows; ++j)
+			{
+				for (unsigned i = 0; i < input; ++i)
+				{
+					partialInput.GetRow(j)[i] = (i + j)*0.0003;
+				}
+			}
+			n.BatchProcessInputSlow(partialInput, partialSlow);
+			n.BatchProcessInputFast(partialInput, partialFast);
+			if (!partialSlow.IsSame(partialFast))
+				throw std::string("Different results");
+			cout << "Succeeded." << endl;
+		}
 #endif
 
 		{
 			cout << "Test randomizer...";
-			Randomizer<> r1, r2;
+			Randomizer r1, r2;
 			if (r1.Next() == r2.Next())
 				throw std::string("Should be different!");
 			if (r1.RangeNext(6) == r2.RangeNext(6))
@@ -131,7 +229,7 @@ int _tmain(int argc, _TCHAR* argv[])
 			nSecond.ProcessInputFast(inputMatrix.GetRow(0), slowOutputMatrix.GetRow(0));
 			if (AreSame(slowOutputMatrix.GetRow(0), fastOutputMatrix.GetRow(0), nFirst.Output))
 				throw std::string("Should be different!");	
-			Randomizer<> r;
+			Randomizer r;
 			Net<5, Net<6, Net<3>>> nSame(nFirst, nFirst, r);
 			nSame.ProcessInputFast(inputMatrix.GetRow(0), slowOutputMatrix.GetRow(0));
 			if (!AreSame(slowOutputMatrix.GetRow(0), fastOutputMatrix.GetRow(0), nFirst.Output))
@@ -174,7 +272,7 @@ int _tmain(int argc, _TCHAR* argv[])
 #ifdef TEST_GENETIC
 		{
 			cout << "Test genetic algos...";
-			Population<XorNetType> population(10000, 0.01);
+			Population<XorNetType> population(10000, 0.01, 1);
 			cout << endl;
 			double previousError = 1e10;
 			{
@@ -228,6 +326,1095 @@ int _tmain(int argc, _TCHAR* argv[])
 
 			cout << "Succeeded." << endl;
 		}
+		{
+			cout << "Verifying single precision networks...";
+			const unsigned floatRows = 1001;
+			Net<input, Net<112, Net<112, Net<output, float>>>> floatNet(InitializeForGenetic);
+			AlignedMatrix<input, float> floatInput(floatRows);
+			AlignedMatrix<output, float> floatSlow(floatRows), floatFast(floatRows);
+			for (unsigned j = 0; j < floatRows; ++j)
+			{
+				for (unsigned i = 0; i < input; ++i)
+				{
+					floatInput.GetRow(j)[i] = (i + j)*0.0003f;
+				}
+			}
+			floatNet.BatchProcessInputSlow(floatInput, floatSlow);
+			floatNet.BatchProcessInputFast(floatInput, floatFast);
+			if (!floatSlow.IsSame(floatFast))
+				throw std::string("Different results");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test single precision back propagataion...";
+			float floatInput[_countof(testInput)], floatExpected[_countof(testExpected)];
+			for (unsigned i = 0; i < _countof(testInput); ++i) floatInput[i] = (float)testInput[i];
+			for (unsigned i = 0; i < _countof(testExpected); ++i) floatExpected[i] = (float)testExpected[i];
+			AlignedMatrix<2, float> xorFloatInputMatrix(floatInput, _countof(testExpected));
+			AlignedMatrix<1, float> xorFloatExpectedMatrix(floatExpected, _countof(testExpected));
+			//XOR has local minima, which back propagation doesn't leave: a stream, which starts outside of them
+			Randomizer xorRandom(1, 0);
+			Net<2, Net<2, Net<1, float>>> net(InitializeForBackProp, NULL, &xorRandom);
+			double error = 1e10;
+			{
+				Timer t;
+				for (int i = 0; i < 200000 && error > 1e-3; ++i)
+				{
+					error = net.BackPropagation(xorFloatInputMatrix, xorFloatExpectedMatrix, 0.3);
+				}
+			}
+			if (error > 1e-3)
+				throw std::string("Not converging");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the kernels of each supported instruction set..." << endl;
+			const unsigned tierRows = 103;
+			const KernelTier activeTier = GetKernelTier();
+			Net<input, Net<31, Net<output>>> tierNet(InitializeForGenetic);
+			Net<input, Net<31, Net<output, float>>> floatTierNet(InitializeForGenetic);
+			AlignedMatrix<input> tierInput(tierRows);
+			AlignedMatrix<input, float> floatTierInput(tierRows);
+			AlignedMatrix<output> tierSlow(tierRows), tierFast(tierRows);
+			AlignedMatrix<output, float> floatTierSlow(tierRows), floatTierFast(tierRows);
+			for (unsigned j = 0; j < tierRows; ++j)
+			{
+				for (unsigned i = 0; i < input; ++i)
+				{
+					tierInput.GetRow(j)[i] = (i + 2*j)*0.0002;
+					floatTierInput.GetRow(j)[i] = (i + 2*j)*0.0002f;
+				}
+			}
+			tierNet.BatchProcessInputSlow(tierInput, tierSlow);
+			floatTierNet.BatchProcessInputSlow(floatTierInput, floatTierSlow);
+			for (int tier = KernelSSE2; tier <= GetSupportedKernelTier(); ++tier)
+			{
+				cout << "   " << KernelTierName((KernelTier)tier) << "...";
+				SetKernelTier((KernelTier)tier);
+				tierNet.BatchProcessInputFast(tierInput, tierFast);
+				floatTierNet.BatchProcessInputFast(floatTierInput, floatTierFast);
+				if (!tierSlow.IsSame(tierFast) || !floatTierSlow.IsSame(floatTierFast))
+					throw std::string("Different results");
+				cout << "Succeeded." << endl;
+			}
+			SetKernelTier(activeTier);
+		}
+		{
+			cout << "Verifying the activation functions...";
+			const unsigned activationRows = 67;
+			Net<input, Net<37, Net<19, Net<output>, Softmax>, Tanh>, LeakyReLU> activationNet(InitializeForGenetic);
+			Net<input, Net<37, Net<output, float>, Identity>, ReLU> floatActivationNet(InitializeForGenetic);
+			AlignedMatrix<input> activationInput(activationRows);
+			AlignedMatrix<input, float> floatActivationInput(activationRows);
+			AlignedMatrix<output> activationSlow(activationRows), activationFast(activationRows);
+			AlignedMatrix<output, float> floatActivationSlow(activationRows), floatActivationFast(activationRows);
+			for (unsigned j = 0; j < activationRows; ++j)
+			{
+				for (unsigned i = 0; i < input; ++i)
+				{
+					activationInput.GetRow(j)[i] = ((i + 3*j) % 11)*0.002 - 0.01;
+					floatActivationInput.GetRow(j)[i] = ((i + 3*j) % 11)*0.002f - 0.01f;
+				}
+			}
+			activationNet.BatchProcessInputSlow(activationInput, activationSlow);
+			activationNet.BatchProcessInputFast(activationInput, activationFast);
+			floatActivationNet.BatchProcessInputSlow(floatActivationInput, floatActivationSlow);
+			floatActivationNet.BatchProcessInputFast(floatActivationInput, floatActivationFast);
+			if (!activationSlow.IsSame(activationFast) || !floatActivationSlow.IsSame(floatActivationFast))
+				throw std::string("Different results");
+			for (unsigned j = 0; j < activationRows; ++j)
+			{
+				double sum = 0;
+				for (unsigned i = 0; i < output; ++i)
+				{
+					sum += activationFast.GetRow(j)[i];
+				}
+				if (!AreSame(sum, 1.0))
+					throw std::string("The softmax outputs do not add up to 1");
+			}
+			//The softmax derivative against the Jacobian, on all the tiers. The output has a tail for all the vector widths:
+			const unsigned softmaxSize = 19;
+			AlignedMatrix<softmaxSize> softmaxOutputs(1), softmaxDeltas(1), softmaxExpected(1);
+			double softmaxDot = 0;
+			for (unsigned i = 0; i < softmaxSize; ++i)
+			{
+				softmaxOutputs.GetRow(0)[i] = (i + 1)/190.0;
+				softmaxExpected.GetRow(0)[i] = ((i*7) % 5)*0.1 - 0.2;
+				softmaxDot += softmaxExpected.GetRow(0)[i]*softmaxOutputs.GetRow(0)[i];
+			}
+			for (unsigned i = 0; i < softmaxSize; ++i)
+			{
+				softmaxExpected.GetRow(0)[i] = softmaxOutputs.GetRow(0)[i]*(softmaxExpected.GetRow(0)[i] - softmaxDot);
+			}
+			const KernelTier activeTier = GetKernelTier();
+			for (int tier = KernelSSE2; tier <= GetSupportedKernelTier(); ++tier)
+			{
+				SetKernelTier((KernelTier)tier);
+				for (unsigned i = 0; i < softmaxSize; ++i)
+				{
+					softmaxDeltas.GetRow(0)[i] = ((i*7) % 5)*0.1 - 0.2;
+				}
+				ApplyActivationDerivative(ActivationSoftmax, softmaxOutputs.GetRow(0), softmaxDeltas.GetRow(0), softmaxSize);
+				if (!softmaxDeltas.IsSame(softmaxExpected))
+					throw std::string("Wrong softmax derivative");
+			}
+			SetKernelTier(activeTier);
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the errors of the vectorized exp..." << endl;
+			//Over the reduced range, |x| <= ln(2)/2, where the polynomial is used as it is, and over the whole range, where 
+			//the result is also scaled by 2^n. The odd number of points has a tail too:
+			const unsigned expPoints = 20001;
+			const double reducedRange = 0.5*log(2.0);
+			AlignedMatrix<expPoints> doubleExp(2);
+			AlignedMatrix<expPoints, float> floatExp(2);
+			for (unsigned i = 0; i < expPoints; ++i)
+			{
+				doubleExp.GetRow(0)[i] = reducedRange*(2.0*i/(expPoints - 1) - 1);
+				doubleExp.GetRow(1)[i] = 700*(2.0*i/(expPoints - 1) - 1);
+				floatExp.GetRow(0)[i] = (float)doubleExp.GetRow(0)[i];
+				floatExp.GetRow(1)[i] = (float)(87*(2.0*i/(expPoints - 1) - 1));
+			}
+			const KernelTier activeTier = GetKernelTier();
+			for (int tier = KernelSSE2; tier <= GetSupportedKernelTier(); ++tier)
+			{
+				SetKernelTier((KernelTier)tier);
+				double maxDoubleError = 0, maxFloatError = 0;
+				for (unsigned row = 0; row < 2; ++row)
+				{
+					AlignedMatrix<expPoints> doubleResult(1);
+					AlignedMatrix<expPoints, float> floatResult(1);
+					memcpy(doubleResult.GetRow(0), doubleExp.GetRow(row), expPoints*sizeof(double));
+					memcpy(floatResult.GetRow(0), floatExp.GetRow(row), expPoints*sizeof(float));
+					ApplyExp(doubleResult.GetRow(0), expPoints);
+					ApplyExp(floatResult.GetRow(0), expPoints);
+					for (unsigned i = 0; i < expPoints; ++i)
+					{
+						const double doubleExpected = exp(doubleExp.GetRow(row)[i]);
+						const double floatExpected = exp((double)floatExp.GetRow(row)[i]);
+						maxDoubleError = max(maxDoubleError, fabs(doubleResult.GetRow(0)[i] - doubleExpected)/doubleExpected);
+						maxFloatError = max(maxFloatError, fabs(floatResult.GetRow(0)[i] - floatExpected)/floatExpected);
+					}
+				}
+				cout << "   " << KernelTierName((KernelTier)tier) << ": " << maxDoubleError << " (double), " << maxFloatError << " (float)" << endl;
+				//The bounds documented at Simd::Exp:
+				if (maxDoubleError > 3.2e-16 || maxFloatError > 7.4e-8)
+					throw std::string("The exp is less accurate than documented");
+			}
+			SetKernelTier(activeTier);
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test back propagation with ReLU hidden layers...";
+			Net<2, Net<8, Net<1>>, LeakyReLU> net(InitializeForBackProp);
+			double error = 1e10;
+			{
+				Timer t;
+				for (int i = 0; i < 200000 && error > 1e-3; ++i)
+				{
+					error = net.BackPropagation(xorInputMatrix, xorExpectedMatrix, 0.1);
+				}
+			}
+			if (error > 1e-3)
+				throw std::string("Not converging");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying int8 quantized inference..." << endl;
+			typedef Net<input, Net<61, Net<output>>, ReLU> QuantizedNetType;
+			const unsigned quantizedRows = 200;
+			const KernelTier activeTier = GetKernelTier();
+			QuantizedNetType original(InitializeForBackProp);
+			AlignedMatrix<input> quantizedInput(quantizedRows);
+			AlignedMatrix<output> quantizedFirst(quantizedRows), quantizedOutput(quantizedRows);
+			for (unsigned j = 0; j < quantizedRows; ++j)
+			{
+				for (unsigned i = 0; i < input; ++i)
+				{
+					quantizedInput.GetRow(j)[i] = ((i*7 + j*3) % 29)*0.1 - 1;
+				}
+			}
+			QuantizedNet<QuantizedNetType> quantized(original, quantizedInput);
+			QuantizationReport report = quantized.CompareWith(original, quantizedInput);
+			cout << "   Max error: " << report.MaxError << "; RMS error: " << report.RootMeanSquareError 
+				 << "; Same largest output: " << report.SameArgMax*100 << "%" << endl;
+			if (report.MaxError > 0.01 || report.SameArgMax < 0.9)
+				throw std::string("Too inaccurate");
+			//The integer dot products are exact, so all the instruction sets should agree:
+			quantized.BatchProcessInput(quantizedInput, quantizedFirst);
+			for (int tier = KernelSSE2; tier <= GetSupportedKernelTier(); ++tier)
+			{
+				cout << "   " << KernelTierName((KernelTier)tier) << "...";
+				SetKernelTier((KernelTier)tier);
+				quantized.BatchProcessInput(quantizedInput, quantizedOutput);
+				if (!quantizedFirst.IsSame(quantizedOutput))
+					throw std::string("Different results");
+				cout << "Succeeded." << endl;
+			}
+			SetKernelTier(activeTier);
+		}
+		{
+			cout << "Verifying the unrolled kernels of small layers...";
+			const unsigned smallRows = 70;
+			Net<5, Net<7, Net<3, float>>> smallNet(InitializeForGenetic);
+			if (!Layer<5, 7, float>::Unrolled || Layer<input, 31>::Unrolled)
+				throw std::string("Unexpected choice of kernels");
+			AlignedMatrix<5, float> smallInput(smallRows);
+			AlignedMatrix<3, float> smallSlow(smallRows), smallFast(smallRows), smallSingle(smallRows);
+			for (unsigned j = 0; j < smallRows; ++j)
+			{
+				for (unsigned i = 0; i < 5; ++i)
+				{
+					smallInput.GetRow(j)[i] = ((i + j) % 7)*0.3f - 1;
+				}
+			}
+			smallNet.BatchProcessInputSlow(smallInput, smallSlow);
+			smallNet.BatchProcessInputFast(smallInput, smallFast);
+			for (unsigned j = 0; j < smallRows; ++j)
+			{
+				smallNet.ProcessInputFast(smallInput.GetRow(j), smallSingle.GetRow(j));
+			}
+			if (!smallSlow.IsSame(smallFast) || !smallSlow.IsSame(smallSingle))
+				throw std::string("Different results");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the workspaces of wide networks...";
+			typedef Net<input, Net<3000, Net<2000, Net<output, float>>>> WideNetType;
+			const unsigned wideRows = 5;
+			WideNetType wideNet(InitializeForBackProp);
+			Workspace<WideNetType> workspace;
+			if (Workspace<WideNetType>::Size != WideNetType::TileRows*(2*3000 + (3000 + 2000 + 16) + 2*3000))
+				throw std::string("Wrong workspace size");
+			AlignedMatrix<input, float> wideInput(wideRows);
+			AlignedMatrix<output, float> wideBatch(wideRows), wideSingle(wideRows), wideExpected(wideRows);
+			for (unsigned j = 0; j < wideRows; ++j)
+			{
+				for (unsigned i = 0; i < input; ++i)
+				{
+					wideInput.GetRow(j)[i] = ((i + j) % 5)*0.2f;
+				}
+				for (unsigned i = 0; i < output; ++i)
+				{
+					wideExpected.GetRow(j)[i] = (i == j) ? 1.0f : 0.0f;
+				}
+			}
+			wideNet.BatchProcessInputFast(wideInput, wideBatch, workspace);
+			for (unsigned j = 0; j < wideRows; ++j)
+			{
+				wideNet.ProcessInputFast(wideInput.GetRow(j), wideSingle.GetRow(j), workspace);
+			}
+			if (!wideBatch.IsSame(wideSingle))
+				throw std::string("Different results");
+			double firstError = wideNet.BackPropagation(wideInput, wideExpected, 0.01, workspace);
+			double error = firstError;
+			for (int i = 0; i < 20; ++i)
+			{
+				error = wideNet.BackPropagation(wideInput, wideExpected, 0.01, workspace);
+			}
+			if (error >= firstError)
+				throw std::string("Not improving");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying networks loaded at runtime...";
+			const unsigned dynamicRows = 75;
+			Net<input, Net<31, Net<output>, ReLU>, Tanh> bigNet(InitializeForGenetic);
+			Net<5, Net<7, Net<3>>> smallNet(InitializeForGenetic);
+			bigNet.WriteToFile("dynamicBig");
+			smallNet.WriteToFile("dynamicSmall");
+			DynamicNet<> bigDynamic("dynamicBig", ActivationTanh);
+			DynamicNet<> smallDynamic("dynamicSmall");
+			bigDynamic.SetActivation(1, ActivationReLU);
+			if (bigDynamic.NumLayers() != 2 || bigDynamic.Input() != input || bigDynamic.Output() != output || smallDynamic.MaxHidden() != 7)
+				throw std::string("Wrong topology");
+			AlignedMatrix<input> bigInput(dynamicRows);
+			AlignedMatrix<5> smallInput(dynamicRows);
+			AlignedMatrix<output> bigExpected(dynamicRows), bigActual(dynamicRows), bigSingle(dynamicRows);
+			AlignedMatrix<3> smallExpected(dynamicRows), smallActual(dynamicRows);
+			for (unsigned j = 0; j < dynamicRows; ++j)
+			{
+				for (unsigned i = 0; i < input; ++i)
+				{
+					bigInput.GetRow(j)[i] = ((i + j) % 13)*0.001;
+				}
+				for (unsigned i = 0; i < 5; ++i)
+				{
+					smallInput.GetRow(j)[i] = ((i + j) % 3)*0.5 - 0.5;
+				}
+			}
+			bigNet.BatchProcessInputFast(bigInput, bigExpected);
+			smallNet.BatchProcessInputFast(smallInput, smallExpected);
+			bigDynamic.BatchProcessInput(bigInput.GetBuffer(), bigActual.GetBuffer(), dynamicRows);
+			smallDynamic.BatchProcessInput(smallInput.GetBuffer(), smallActual.GetBuffer(), dynamicRows);
+			DynamicNet<>::Workspace workspace(bigDynamic);
+			for (unsigned j = 0; j < dynamicRows; ++j)
+			{
+				bigDynamic.ProcessInput(bigInput.GetRow(j), bigSingle.GetRow(j), workspace);
+			}
+			if (!bigExpected.IsSame(bigActual) || !bigExpected.IsSame(bigSingle) || !smallExpected.IsSame(smallActual))
+				throw std::string("Different results");
+			bool thrown = false;
+			try
+			{
+				DynamicNet<float> wrongType("dynamicSmall");
+			}
+			catch(string)
+			{
+				thrown = true;
+			}
+			if (!thrown)
+				throw std::string("Loaded a file of a different floating point type");
+			remove("dynamicBig");
+			remove("dynamicSmall");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the reverse weights...";
+			Layer<37, 23> reverseLayer(InitializeForGenetic);
+			Randomizer reverseRandom;
+			_CRT_ALIGN(32) double reverseOutput[23];
+			_CRT_ALIGN(32) double reverseSlow[37];
+			_CRT_ALIGN(32) double reverseFast[37];
+			_CRT_ALIGN(32) double expectedDeltas[37];
+			for (unsigned i = 0; i < 23; ++i)
+			{
+				reverseOutput[i] = (i % 5)*0.1;
+			}
+			for (int pass = 0; pass < 2; ++pass)
+			{
+				reverseLayer.ProcessReverseSlow(reverseOutput, reverseSlow);
+				reverseLayer.ProcessReverseFast(reverseOutput, reverseFast);
+				if (!AreSame(reverseSlow, reverseFast, 37))
+					throw std::string("Different results");
+				for (unsigned i = 0; i < 37; ++i)
+				{
+					expectedDeltas[i] = 0;
+					for (unsigned j = 0; j < 23; ++j)
+					{
+						expectedDeltas[i] += reverseLayer.GetWeight(i, j)*reverseOutput[j];
+					}
+				}
+				reverseLayer.CalculateBackPropagationDeltas(reverseOutput, reverseFast);
+				if (!AreSame(expectedDeltas, reverseFast, 37))
+					throw std::string("Different deltas");
+				//The reverse weights have to follow the changes of the weights:
+				reverseLayer.Mutate(0.5, reverseRandom);
+			}
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test mini-batch back propagation...";
+			typedef Net<input, Net<37, Net<output>>, ReLU> MiniBatchNetType;
+			const unsigned miniBatchRows = 256;
+			TrainingFixture<MiniBatchNetType> fixture(3, miniBatchRows, MiniBatchInput);
+			MiniBatchNetType &online = fixture.Clone(0), &batchOfOne = fixture.Clone(1), &batched = fixture.Clone(2);
+			const AlignedMatrix<input>& miniBatchInput = fixture.Input;
+			const AlignedMatrix<output>& miniBatchExpected = fixture.Expected;
+			//Batches of a single row are the same as the online training:
+			for (int i = 0; i < 3; ++i)
+			{
+				online.BackPropagation(miniBatchInput, miniBatchExpected, 0.1);
+				batchOfOne.BatchBackPropagation(miniBatchInput, miniBatchExpected, 0.1, 1);
+			}
+			if (!online.IsSame(batchOfOne))
+				throw std::string("Different weights");
+			double firstError = batched.BatchBackPropagation(miniBatchInput, miniBatchExpected, 0.5, 32);
+			double error = firstError;
+			{
+				Timer t;
+				for (int i = 0; i < 200; ++i)
+				{
+					error = batched.BatchBackPropagation(miniBatchInput, miniBatchExpected, 0.5, 32);
+				}
+			}
+			if (error > firstError/2)
+				throw std::string("Not converging");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the output deltas...";
+			const KernelTier activeTier = GetKernelTier();
+			_CRT_ALIGN(64) double deltaOutput[13], deltaExpected[13], deltas[13];
+			double expectedSquares = 0;
+			for (unsigned i = 0; i < 13; ++i)
+			{
+				deltaOutput[i] = i*0.07;
+				deltaExpected[i] = (i % 2) ? 1 : 0;
+				expectedSquares += (deltaExpected[i] - deltaOutput[i])*(deltaExpected[i] - deltaOutput[i]);
+			}
+			for (int tier = KernelSSE2; tier <= GetSupportedKernelTier(); ++tier)
+			{
+				SetKernelTier((KernelTier)tier);
+				if (!AreSame(CalculateOutputDeltas(deltaOutput, deltaExpected, deltas, 13), expectedSquares) || 
+					!AreSame(deltas[12], deltaExpected[12] - deltaOutput[12]))
+					throw std::string("Wrong deltas");
+			}
+			SetKernelTier(activeTier);
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test Hogwild training...";
+			typedef Net<input, Net<37, Net<output>>, ReLU> HogwildNetType;
+			const unsigned hogwildRows = 512;
+			TrainingFixture<HogwildNetType> fixture(3, hogwildRows);
+			HogwildNetType &serial = fixture.Clone(0), &singleThread = fixture.Clone(1), &hogwild = fixture.Clone(2);
+			const AlignedMatrix<input>& hogwildInput = fixture.Input;
+			const AlignedMatrix<output>& hogwildExpected = fixture.Expected;
+			//A single thread, which synchronizes after every row, is the same as the online training:
+			HogwildTrainer<HogwildNetType> singleTrainer(singleThread, 1, 1);
+			for (int i = 0; i < 3; ++i)
+			{
+				serial.BackPropagation(hogwildInput, hogwildExpected, 0.1);
+				singleTrainer.Train(hogwildInput, hogwildExpected, 0.1);
+			}
+			if (!serial.IsSame(singleThread))
+				throw std::string("Different weights");
+
+			HogwildTrainer<HogwildNetType> trainer(hogwild, 0, 64);
+			double firstError = trainer.Train(hogwildInput, hogwildExpected, 0.1);
+			double error = firstError;
+			for (int i = 0; i < 50; ++i)
+			{
+				error = trainer.Train(hogwildInput, hogwildExpected, 0.1);
+			}
+			if (error > firstError/2)
+				throw std::string("Not converging");
+			std::vector<HogwildReport> scaling = trainer.MeasureScaling(hogwildInput, hogwildExpected, 0.1, 4, 5);
+			if (scaling.size() != 3 || scaling.back().Samples != 5*hogwildRows)
+				throw std::string("Wrong scaling report");
+			cout << endl;
+			for (unsigned i = 0; i < scaling.size(); ++i)
+			{
+				printf("%u threads: %.0f samples/s (x%.2f)\n", scaling[i].Threads, scaling[i].SamplesPerSecond, scaling[i].Speedup);
+			}
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test the optimizers...";
+			const KernelTier activeTier = GetKernelTier();
+			//The fused kernels against a plain implementation of Adam, including the tails of the vectors:
+			const unsigned optimizerInput = 13, optimizerOutput = 11, optimizerStride = 16;
+			_CRT_ALIGN(64) double optimizerIn[optimizerStride], optimizerDelta[optimizerStride];
+			_CRT_ALIGN(64) double optimizerState[4][optimizerOutput*optimizerStride];
+			_CRT_ALIGN(64) double optimizerWeights[optimizerOutput*optimizerStride], optimizerBias[optimizerStride];
+			for (unsigned i = 0; i < optimizerStride; ++i)
+			{
+				optimizerIn[i] = (i % 5)*0.1 - 0.2;
+				optimizerDelta[i] = (i % 3)*0.05 - 0.04;
+			}
+			const Optimizer adam = AdamOptimizer();
+			for (int tier = KernelSSE2; tier <= GetSupportedKernelTier(); ++tier)
+			{
+				SetKernelTier((KernelTier)tier);
+				for (unsigned i = 0; i < optimizerOutput*optimizerStride; ++i)
+				{
+					optimizerWeights[i] = 0.5;
+					optimizerState[0][i] = optimizerState[1][i] = optimizerState[2][i] = optimizerState[3][i] = 0;
+				}
+				for (unsigned i = 0; i < optimizerStride; ++i)
+				{
+					optimizerBias[i] = 0;
+				}
+				OptimizerState<double> state = {optimizerState[0], optimizerState[1], optimizerState[2], optimizerState[3]};
+				for (unsigned step = 1; step <= 3; ++step)
+				{
+					UpdateWeights(optimizerIn, optimizerDelta, optimizerInput, optimizerOutput, optimizerWeights, optimizerBias, 
+						state, adam, StepLearningRate(adam, 0.01, step));
+				}
+				for (unsigned i = 0; i < optimizerOutput; ++i)
+				{
+					//The last one is the bias:
+					for (unsigned j = 0; j <= optimizerInput; ++j)
+					{
+						double gradient = optimizerDelta[i]*((j < optimizerInput) ? optimizerIn[j] : 1);
+						double expected = (j < optimizerInput) ? 0.5 : 0, mean = 0, squares = 0;
+						for (unsigned step = 1; step <= 3; ++step)
+						{
+							mean = 0.9*mean + 0.1*gradient;
+							squares = 0.999*squares + 0.001*gradient*gradient;
+							expected += StepLearningRate(adam, 0.01, step)*mean/(sqrt(squares) + 1e-8);
+						}
+						double actual = (j < optimizerInput) ? optimizerWeights[i*optimizerStride + j] : optimizerBias[i];
+						if (!AreSame(actual, expected))
+							throw std::string("Wrong Adam update");
+					}
+				}
+			}
+			SetKernelTier(activeTier);
+
+			//Each optimizer trains the same net:
+			typedef Net<input, Net<37, Net<output>>, ReLU> OptimizerNetType;
+			const unsigned optimizerRows = 256;
+			TrainingFixture<OptimizerNetType> fixture(OptimizerCount, optimizerRows);
+			const AlignedMatrix<input>& optimizerInputs = fixture.Input;
+			const AlignedMatrix<output>& optimizerExpected = fixture.Expected;
+			const char* optimizerNames[] = {"SGD", "Momentum", "Nesterov", "RMSProp", "Adam"};
+			const Optimizer optimizers[] = {SGDOptimizer(), MomentumOptimizer(), NesterovOptimizer(), RMSPropOptimizer(), AdamOptimizer()};
+			const double learningRates[] = {0.5, 0.5, 0.1, 0.002, 0.002};
+			cout << endl;
+			for (int o = 0; o < OptimizerCount; ++o)
+			{
+				OptimizerNetType& net = fixture.Clone(o);
+				net.SetOptimizer(optimizers[o]);
+				double firstError = net.BatchBackPropagation(optimizerInputs, optimizerExpected, learningRates[o], 16);
+				double error = firstError;
+				for (int i = 0; i < 30; ++i)
+				{
+					error = net.BatchBackPropagation(optimizerInputs, optimizerExpected, learningRates[o], 16);
+				}
+				printf("   %s: %f -> %f\n", optimizerNames[o], firstError, error);
+				if (error > firstError/2)
+					throw std::string("Not converging");
+			}
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the parallelism cost model...";
+			const int savedThreads = omp_get_max_threads();
+			omp_set_num_threads(4);
+			//The XOR nets never start threads:
+			if (ChooseParallelism(2*3, 4, 3).Strategy != ParallelSerial)
+				throw std::string("Threads for a small net");
+			ParallelPlan plan = ChooseParallelism(1e9, 64, 2);
+			if (plan.Strategy != ParallelOverSamples || plan.Threads != 4)
+				throw std::string("Wrong plan for many samples");
+			plan = ChooseParallelism(1e9, 1, 1000);
+			if (plan.Strategy != ParallelOverNeurons || plan.Threads != 4)
+				throw std::string("Wrong plan for a single sample");
+			int nested = 0;
+			#pragma omp parallel num_threads(2) reduction(+:nested)
+			{
+				if (ChooseParallelism(1e9, 64, 64).Strategy != ParallelSerial)
+					++nested;
+			}
+			if (nested)
+				throw std::string("Nested parallel region");
+
+			//The results don't depend on the split:
+			typedef Net<input, Net<512, Net<output>>> ParallelNetType;
+			const unsigned parallelRows = 40;
+			TrainingFixture<ParallelNetType> fixture(2, parallelRows, ParallelInput);
+			ParallelNetType &serialNet = fixture.Clone(0), &parallelNet = fixture.Clone(1);
+			const AlignedMatrix<input>& parallelInput = fixture.Input;
+			const AlignedMatrix<output>& parallelExpected = fixture.Expected;
+			AlignedMatrix<output> parallelOutput(parallelRows), slowOutput(parallelRows);
+			parallelNet.BatchProcessInputFast(parallelInput, parallelOutput);
+			parallelNet.BatchProcessInputSlow(parallelInput, slowOutput);
+			if (!parallelOutput.IsSame(slowOutput))
+				throw std::string("Different outputs");
+			parallelNet.BackPropagation(parallelInput, parallelExpected, 0.1);
+			parallelNet.BatchBackPropagation(parallelInput, parallelExpected, 0.1, 40);
+			omp_set_num_threads(1);
+			serialNet.BackPropagation(parallelInput, parallelExpected, 0.1);
+			serialNet.BatchBackPropagation(parallelInput, parallelExpected, 0.1, 40);
+			omp_set_num_threads(savedThreads);
+			if (!serialNet.IsSame(parallelNet))
+				throw std::string("Different weights");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test mixed precision training..." << endl;
+			//The XOR net:
+			TrainingFixture<XorNetType> xorFixture(2, 0);
+			MixedPrecisionTrainer<XorNetType> xorTrainer(xorFixture.Clone(1));
+			MixedPrecisionReport report = CompareMixedPrecision(xorFixture.Clone(0), xorTrainer, xorInputMatrix, xorExpectedMatrix, 0.3, 1, 3000);
+			cout << "   XOR: double error: " << report.DoubleError << "; mixed error: " << report.MixedError 
+				<< "; max difference: " << report.MaxDifference << endl;
+			if (report.MaxDifference > 0.01)
+				throw std::string("The mixed precision diverges from the double precision on XOR");
+
+			//The net of the performance test, with and without the output layer in double precision:
+			typedef Net<input, Net<112, Net<output>>, ReLU> MixedNetType;
+			const unsigned mixedRows = 256;
+			TrainingFixture<MixedNetType> fixture(3, mixedRows);
+			MixedNetType &doubleNet = fixture.Clone(0), &mixedNet = fixture.Clone(1), &optOutNet = fixture.Clone(2);
+			const AlignedMatrix<input>& mixedInput = fixture.Input;
+			const AlignedMatrix<output>& mixedExpected = fixture.Expected;
+			AlignedMatrix<input, float> floatInput(mixedRows);
+			AlignedMatrix<output, float> floatExpected(mixedRows);
+			ConvertMatrix(mixedInput, floatInput);
+			ConvertMatrix(mixedExpected, floatExpected);
+			MixedPrecisionTrainer<MixedNetType> mixedTrainer(mixedNet), optOutTrainer(optOutNet);
+			optOutTrainer.SetDoublePrecision(1);
+			const double firstError = mixedTrainer.BatchBackPropagation(floatInput, floatExpected, 0.1, 32);
+			double optOutError = optOutTrainer.BatchBackPropagation(floatInput, floatExpected, 0.1, 32);
+			doubleNet.BatchBackPropagation(mixedInput, mixedExpected, 0.1, 32);
+			if (fabs(firstError - optOutError) > 1e-5)
+				throw std::string("Different errors of the same weights");
+			report = CompareMixedPrecision(doubleNet, mixedTrainer, mixedInput, mixedExpected, 0.1, 32, 200);
+			for (int i = 0; i < 200; ++i)
+			{
+				optOutError = optOutTrainer.BatchBackPropagation(floatInput, floatExpected, 0.1, 32);
+			}
+			cout << "   " << input << "x112x" << output << ": double error: " << report.DoubleError << " (" << report.DoubleSeconds 
+				<< "s); mixed error: " << report.MixedError << " (" << report.MixedSeconds << "s); max difference: " << report.MaxDifference 
+				<< "; output layer in double: " << optOutError << endl;
+			if (report.MixedError > firstError/2 || optOutError > firstError/2)
+				throw std::string("Not converging");
+			if (report.MaxDifference > 0.01)
+				throw std::string("The mixed precision diverges from the double precision");
+			//Back in single precision, the output layer continues from its trained weights:
+			optOutTrainer.SetDoublePrecision(1, false);
+			if (fabs(optOutTrainer.BatchBackPropagation(floatInput, floatExpected, 0.1, 32) - optOutError) > optOutError/10)
+				throw std::string("Stale weights after switching the precision");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test contrastive divergence...";
+			//Four binary patterns, each in several rows:
+			typedef Layer<16, 8, double, Sigmoid> RBMLayerType;
+			const unsigned patternRows = 64;
+			AlignedMatrix<16> patterns(patternRows);
+			for (unsigned j = 0; j < patternRows; ++j)
+			{
+				for (unsigned i = 0; i < 16; ++i)
+				{
+					patterns.GetRow(j)[i] = (i/4 == j % 4 || i % 4 == j % 4) ? 1 : 0;
+				}
+			}
+			for (unsigned steps = 1; steps <= 3; steps += 2)
+			{
+				RBMLayerType layer(InitializeForBackProp);
+				ContrastiveDivergence<RBMLayerType> cd(layer, steps, 16);
+				const double firstError = cd.Train(patterns, 0.5);
+				double error = firstError;
+				for (int i = 0; i < 200; ++i)
+				{
+					error = cd.Train(patterns, 0.5);
+				}
+				if (error > firstError/2)
+					throw std::string("Not converging");
+			}
+
+			//Greedy pretraining of the hidden layers, followed by back propagation:
+			typedef Net<input, Net<37, Net<19, Net<output>>, Sigmoid>, Sigmoid> PretrainedNetType;
+			const unsigned pretrainRows = 256;
+			TrainingFixture<PretrainedNetType> fixture(2, pretrainRows, PretrainInput);
+			PretrainedNetType &plainNet = fixture.Clone(0), &pretrainedNet = fixture.Clone(1);
+			const AlignedMatrix<input>& pretrainInput = fixture.Input;
+			const AlignedMatrix<output>& pretrainExpected = fixture.Expected;
+			pretrainedNet.Pretrain(pretrainInput, 0.1, 10);
+			if (pretrainedNet.IsSame(plainNet))
+				throw std::string("Not pretrained");
+			double plainError = 0, pretrainedError = 0;
+			for (int i = 0; i < 30; ++i)
+			{
+				plainError = plainNet.BatchBackPropagation(pretrainInput, pretrainExpected, 0.5, 4);
+				pretrainedError = pretrainedNet.BatchBackPropagation(pretrainInput, pretrainExpected, 0.5, 4);
+			}
+			cout << endl << "   Error after 30 epochs: " << plainError << "; pretrained: " << pretrainedError << endl;
+			if (pretrainedError > 0.01)
+				throw std::string("The pretrained net is not converging");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test pipeline-parallel training...";
+			typedef Net<input, Net<112, Net<50, Net<output>>, ReLU>, ReLU> PipelineNetType;
+			const unsigned pipelineRows = 256;
+			TrainingFixture<PipelineNetType> fixture(3, pipelineRows);
+			PipelineNetType &serialNet = fixture.Clone(0), &flushedNet = fixture.Clone(1), &pipelinedNet = fixture.Clone(2);
+			const AlignedMatrix<input>& pipelineInput = fixture.Input;
+			const AlignedMatrix<output>& pipelineExpected = fixture.Expected;
+			//Flushing after each micro-batch is the same as the mini-batch training:
+			PipelineTrainer<PipelineNetType> flushed(flushedNet, 3, 16, 1);
+			if (flushed.NumStages() != 3)
+				throw std::string("Wrong number of stages");
+			for (int i = 0; i < 3; ++i)
+			{
+				double serialError = serialNet.BatchBackPropagation(pipelineInput, pipelineExpected, 0.1, 16);
+				if (fabs(serialError - flushed.Train(pipelineInput, pipelineExpected, 0.1)) > 1e-12)
+					throw std::string("Different errors");
+			}
+			if (!serialNet.IsSame(flushedNet))
+				throw std::string("Different weights");
+
+			PipelineTrainer<PipelineNetType> pipelined(pipelinedNet, 3, 16);
+			const double firstError = pipelined.Train(pipelineInput, pipelineExpected, 0.1);
+			double error = firstError;
+			for (int i = 0; i < 30; ++i)
+			{
+				error = pipelined.Train(pipelineInput, pipelineExpected, 0.1);
+			}
+			if (error > firstError/2)
+				throw std::string("Not converging");
+			const PipelineReport& report = pipelined.GetLastReport();
+			cout << endl << "   " << report.SamplesPerSecond << " samples/s; stage utilization:";
+			for (unsigned s = 0; s < report.StageReports.size(); ++s)
+			{
+				cout << " " << (int)(100*report.StageReports[s].Utilization) << "% (" << report.StageReports[s].LayerCount << " layers)";
+			}
+			cout << endl;
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the fused evaluation of the population...";
+			Population<XorNetType> xorPopulation(20, 0.2);
+			xorPopulation.Evaluate(xorInputMatrix, xorExpectedMatrix);
+			double bestError = xorPopulation.Select();
+			AlignedMatrix<1> xorOutput(xorInputMatrix.NumRows());
+			xorPopulation.Best().BatchProcessInputFast(xorInputMatrix, xorOutput);
+			if (fabs(bestError - xorPopulation.Best().CalculateError(xorOutput, xorExpectedMatrix)) > 1e-12)
+				throw std::string("Different XOR error");
+
+			//Few individuals split the tiles of the rows between the threads:
+			typedef Net<input, Net<37, Net<output>>> EvaluatedNetType;
+			const int savedThreads = omp_get_max_threads();
+			omp_set_num_threads(4);
+			Population<EvaluatedNetType> population(2, 0.5);
+			for (unsigned rows = 1; rows <= 1000; rows += 333)
+			{
+				AlignedMatrix<input> evaluatedInput(rows);
+				AlignedMatrix<output> evaluatedExpected(rows), evaluatedOutput(rows);
+				for (unsigned j = 0; j < rows; ++j)
+				{
+					for (unsigned i = 0; i < input; ++i)
+					{
+						evaluatedInput.GetRow(j)[i] = ((i*j + i) % 17)*0.05 - 0.4;
+					}
+					for (unsigned i = 0; i < output; ++i)
+					{
+						evaluatedExpected.GetRow(j)[i] = (j % output == i) ? 1 : 0;
+					}
+				}
+				//Twice, with the workspaces of the previous call:
+				for (int i = 0; i < 2; ++i)
+				{
+					population.Evaluate(evaluatedInput, evaluatedExpected);
+					bestError = population.Select();
+				}
+				population.Best().BatchProcessInputFast(evaluatedInput, evaluatedOutput);
+				if (fabs(bestError - population.Best().CalculateError(evaluatedOutput, evaluatedExpected)) > 1e-9)
+					throw std::string("Different error");
+			}
+			omp_set_num_threads(savedThreads);
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the arena of the population...";
+			typedef Net<input, Net<37, Net<output>>> ArenaNetType;
+			Arena arena(2*ArenaNetType::ArenaSize);
+			ArenaNetType first(InitializeForGenetic, &arena), second(NoWeightsInitialize, &arena);
+			if (arena.Used() != arena.Size())
+				throw std::string("Wrong arena size");
+			first.WriteToFile("arena");
+			{
+				File f("arena", "rb");
+				second.ReadFromFile(f);
+			}
+			remove("arena");
+			if (!second.IsSame(first))
+				throw std::string("Different nets");
+			try
+			{
+				ArenaNetType third(NoWeightsInitialize, &arena);
+				throw std::string("The arena is not full");
+			}
+			catch(string error)
+			{
+				if (error != "The arena is full")
+					throw;
+			}
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the crossover and the parallel reproduction...";
+			const KernelTier activeTier = GetKernelTier();
+			const unsigned crossoverSize = 143;
+			_CRT_ALIGN(64) double firstParent[crossoverSize], secondParent[crossoverSize], child[crossoverSize];
+			_CRT_ALIGN(64) float floatFirst[crossoverSize], floatSecond[crossoverSize], floatChild[crossoverSize];
+			unsigned long long masks[(crossoverSize + 63)/64];
+			Randomizer crossoverRandom;
+			for (unsigned i = 0; i < crossoverSize; ++i)
+			{
+				firstParent[i] = floatFirst[i] = (float)i;
+				secondParent[i] = floatSecond[i] = -(float)i - 1;
+			}
+			for (unsigned i = 0; i < _countof(masks); ++i)
+			{
+				masks[i] = crossoverRandom.NextMask();
+			}
+			for (int tier = KernelSSE2; tier <= GetSupportedKernelTier(); ++tier)
+			{
+				SetKernelTier((KernelTier)tier);
+				Crossover(firstParent, secondParent, child, crossoverSize, masks);
+				Crossover(floatFirst, floatSecond, floatChild, crossoverSize, masks);
+				for (unsigned i = 0; i < crossoverSize; ++i)
+				{
+					const double expectedChild = ((masks[i/64] >> (i % 64)) & 1) ? secondParent[i] : firstParent[i];
+					if (child[i] != expectedChild || floatChild[i] != (float)expectedChild)
+						throw std::string("Wrong crossover");
+				}
+			}
+			SetKernelTier(activeTier);
+
+			//Each weight comes from one of the parents, about half from each:
+			Layer<input, output> firstLayer(InitializeForGenetic), secondLayer(InitializeForGenetic);
+			Layer<input, output> childLayer(firstLayer, secondLayer, crossoverRandom);
+			unsigned fromFirst = 0;
+			for (unsigned i = 0; i < output; ++i)
+			{
+				for (unsigned j = 0; j <= input; ++j)
+				{
+					const double weight = childLayer.GetWeight(j, i);
+					if (weight == firstLayer.GetWeight(j, i))
+						++fromFirst;
+					else if (weight != secondLayer.GetWeight(j, i))
+						throw std::string("The weight is not from a parent");
+				}
+			}
+			if (fromFirst < output*(input + 1)*4/10 || fromFirst > output*(input + 1)*6/10)
+				throw std::string("Unbalanced crossover");
+
+			//The children are created by several threads:
+			const int savedThreads = omp_get_max_threads();
+			omp_set_num_threads(4);
+			Population<XorNetType> xorPopulation(2000, 0.05);
+			const double firstError = xorPopulation.Train(xorInputMatrix, xorExpectedMatrix, 0.3, true);
+			double error = firstError;
+			for (int i = 0; i < 30; ++i)
+			{
+				error = xorPopulation.Train(xorInputMatrix, xorExpectedMatrix, 0.3, true);
+			}
+			omp_set_num_threads(savedThreads);
+			if (error >= firstError)
+				throw std::string("Not improving");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Verifying the counter-based random streams...";
+			//The known answer of Philox4x32-10 for the counter and the key of zeroes:
+			const unsigned zeroes[PhiloxCounterWords] = { 0, 0, 0, 0 };
+			unsigned block[PhiloxCounterWords];
+			PhiloxBlock(zeroes, zeroes, block);
+			if (block[0] != 0x6627e8d5 || block[1] != 0xe169c58d || block[2] != 0xbc57ac4c || block[3] != 0x9b00dbd8)
+				throw std::string("Wrong Philox block");
+
+			//All the tiers generate the numbers of the scalar blocks, counted from the position of the stream:
+			const KernelTier activeTier = GetKernelTier();
+			const unsigned uniformCount = 77;
+			double uniforms[uniformCount];
+			float floatUniforms[uniformCount];
+			Randomizer streamRandom(12345, 3, 1);
+			streamRandom.Skip(5);
+			const unsigned streamKey[2] = { 12345, 0 };
+			for (int tier = KernelSSE2; tier <= GetSupportedKernelTier(); ++tier)
+			{
+				SetKernelTier((KernelTier)tier);
+				streamRandom.FillUniformAt(0, uniforms, uniformCount);
+				streamRandom.FillUniformAt(0, floatUniforms, uniformCount);
+				for (unsigned i = 0; i < uniformCount; ++i)
+				{
+					const unsigned counter[PhiloxCounterWords] = { 5 + i/4, 0, 3, 1 };
+					PhiloxBlock(counter, streamKey, block);
+					if (uniforms[i] != PhiloxUniform(block[i % 4]) || floatUniforms[i] != PhiloxUniformFloat(block[i % 4]))
+						throw std::string("Wrong uniform numbers");
+				}
+			}
+			SetKernelTier(activeTier);
+
+			//The same (seed, individual, layer) is the same stream, the scalar draws continue after the bulk ones:
+			Randomizer sameRandom(12345, 3, 1), otherLayerRandom(12345, 3, 2);
+			sameRandom.FillUniform(uniforms, 21);
+			streamRandom.SetStream(3, 1);
+			streamRandom.Skip(PhiloxBlocks(21));
+			if (sameRandom.NextMask() != streamRandom.NextMask() || sameRandom.BiasNext() == otherLayerRandom.BiasNext())
+				throw std::string("Wrong streams");
+			double sum = 0;
+			const unsigned sampleCount = 100000;
+			for (unsigned i = 0; i < sampleCount; ++i)
+			{
+				const double value = sameRandom.BiasNext();
+				if (value <= 0 || value >= 1)
+					throw std::string("Out of range");
+				sum += value;
+			}
+			if (fabs(sum/sampleCount - 0.5) > 0.01)
+				throw std::string("Not uniform");
+
+			//The rows of the large layers are initialized and mutated by several threads, with the results of one:
+			typedef Net<input, Net<400, Net<output>>> StreamNetType;
+			const int savedThreads = omp_get_max_threads();
+			Randomizer netRandom(7, 0);
+			StreamNetType firstNet(InitializeForGenetic, NULL, &netRandom);
+			netRandom.SetStream(0, 0);
+			StreamNetType secondNet(InitializeForGenetic, NULL, &netRandom);
+			if (!firstNet.IsSame(secondNet))
+				throw std::string("Different initial weights");
+			omp_set_num_threads(1);
+			netRandom.SetStream(0, 0, 1);
+			firstNet.Mutate(0.1, netRandom);
+			omp_set_num_threads(4);
+			netRandom.SetStream(0, 0, 1);
+			secondNet.Mutate(0.1, netRandom);
+			if (!firstNet.IsSame(secondNet))
+				throw std::string("The mutation depends on the threads");
+
+			//A population with the same seed trains the same way with any number of threads:
+			typedef Net<input, Net<31, Net<output>>> SeededNetType;
+			const unsigned seededRows = 50;
+			AlignedMatrix<input> seededInput(seededRows);
+			AlignedMatrix<output> seededExpected(seededRows);
+			for (unsigned i = 0; i < seededRows; ++i)
+			{
+				for (unsigned j = 0; j < input; ++j)
+					seededInput.GetRow(i)[j] = ((i + j) % 11)*0.1;
+				for (unsigned j = 0; j < output; ++j)
+					seededExpected.GetRow(i)[j] = ((i % output) == j) ? 0.9 : 0.1;
+			}
+			double seededErrors[2];
+			Population<SeededNetType>* seededPopulations[2];
+			for (unsigned p = 0; p < 2; ++p)
+			{
+				omp_set_num_threads(p ? 4 : 1);
+				seededPopulations[p] = new Population<SeededNetType>(40, 0.25, 99);
+				for (int i = 0; i < 3; ++i)
+				{
+					seededErrors[p] = seededPopulations[p]->Train(seededInput, seededExpected, 0.1, true);
+				}
+			}
+			omp_set_num_threads(savedThreads);
+			const bool sameBest = seededPopulations[0]->Best().IsSame(seededPopulations[1]->Best());
+			delete seededPopulations[0];
+			delete seededPopulations[1];
+			if (seededErrors[0] != seededErrors[1] || !sameBest)
+				throw std::string("The population depends on the threads");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test racing evaluation..." << endl;
+			typedef Net<input, Net<31, Net<output>>> RacingNetType;
+			const unsigned racingRows = 1000;
+			AlignedMatrix<input> racingInput(racingRows);
+			AlignedMatrix<output> racingExpected(racingRows);
+			for (unsigned i = 0; i < racingRows; ++i)
+			{
+				for (unsigned j = 0; j < input; ++j)
+					racingInput.GetRow(i)[j] = ((i*7 + j) % 13)*0.08;
+				for (unsigned j = 0; j < output; ++j)
+					racingExpected.GetRow(i)[j] = ((i % output) == j) ? 0.9 : 0.1;
+			}
+			//Stopping only the provably hopeless individuals keeps the survivors of the full evaluation:
+			Population<RacingNetType> fullPopulation(100, 0.1, 5), provablePopulation(100, 0.1, 5), statisticalPopulation(100, 0.1, 5);
+			provablePopulation.SetRacing(64);
+			statisticalPopulation.SetRacing(64, 0.99);
+			double rows[2] = { 0, 0 }, totalRows = 0, firstError = 0, statisticalError = 0;
+			for (int i = 0; i < 5; ++i)
+			{
+				const double fullError = fullPopulation.Train(racingInput, racingExpected, 0.1, true);
+				const double provableError = provablePopulation.Train(racingInput, racingExpected, 0.1, true);
+				statisticalError = statisticalPopulation.Train(racingInput, racingExpected, 0.1, true);
+				if (fullError != provableError || !fullPopulation.Best().IsSame(provablePopulation.Best()))
+					throw std::string("Different survivors");
+				if (!i)
+				{
+					firstError = statisticalError;
+					continue;
+				}
+				rows[0] += provablePopulation.GetLastRacingReport().Rows;
+				rows[1] += statisticalPopulation.GetLastRacingReport().Rows;
+				totalRows += provablePopulation.GetLastRacingReport().TotalRows;
+			}
+			cout << "   Rows evaluated: provable " << 100*rows[0]/totalRows << "%; 99% confidence " << 100*rows[1]/totalRows << "%" << endl;
+			if (rows[0] >= totalRows || rows[1] > rows[0])
+				throw std::string("Not skipping rows");
+			if (statisticalError > firstError)
+				throw std::string("Not improving");
+			//A changing input evaluates the whole population, without racing against the cutoff of other rows:
+			Population<RacingNetType> dynamicPopulation(100, 0.1, 7), dynamicRacingPopulation(100, 0.1, 7);
+			dynamicRacingPopulation.SetRacing(64, 0.9);
+			for (int i = 0; i < 3; ++i)
+			{
+				//Every other generation the expected outputs are inverted:
+				AlignedMatrix<output> dynamicExpected(racingRows);
+				for (unsigned r = 0; r < racingRows; ++r)
+					for (unsigned j = 0; j < output; ++j)
+						dynamicExpected.GetRow(r)[j] = (i % 2) ? 1 - racingExpected.GetRow(r)[j] : racingExpected.GetRow(r)[j];
+				if (dynamicPopulation.Train(racingInput, dynamicExpected, 0.1, false) != 
+					dynamicRacingPopulation.Train(racingInput, dynamicExpected, 0.1, false) ||
+					!dynamicPopulation.Best().IsSame(dynamicRacingPopulation.Best()))
+					throw std::string("Racing with a changing input");
+			}
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test minibatch fitness..." << endl;
+			typedef Net<input, Net<31, Net<output>>> MinibatchNetType;
+			const unsigned minibatchRows = 4096;
+			AlignedMatrix<input> minibatchInput(minibatchRows);
+			AlignedMatrix<output> minibatchExpected(minibatchRows);
+			for (unsigned i = 0; i < minibatchRows; ++i)
+			{
+				for (unsigned j = 0; j < input; ++j)
+					minibatchInput.GetRow(i)[j] = ((i*5 + j) % 17)*0.06;
+				for (unsigned j = 0; j < output; ++j)
+					minibatchExpected.GetRow(i)[j] = ((i % output) == j) ? 0.9 : 0.1;
+			}
+			Population<MinibatchNetType> minibatchPopulation(100, 0.1, 3), racingPopulation(100, 0.1, 3);
+			minibatchPopulation.SetMinibatch(256);
+			//The minibatches don't race:
+			racingPopulation.SetMinibatch(256);
+			racingPopulation.SetRacing(64, 0.9);
+			Workspace<MinibatchNetType> minibatchWorkspace;
+			double firstError = 0, error = 0;
+			Timer t;
+			const unsigned minibatchGenerations = 20;
+			for (unsigned i = 0; i < minibatchGenerations; ++i)
+			{
+				const double minibatchError = minibatchPopulation.Train(minibatchInput, minibatchExpected, 0.1, false);
+				if (racingPopulation.Train(minibatchInput, minibatchExpected, 0.1, false) != minibatchError || 
+					!racingPopulation.Best().IsSame(minibatchPopulation.Best()))
+					throw std::string("Racing the minibatches");
+				//The error of the best individual on all the rows:
+				error = minibatchPopulation.Best().SumBatchError(minibatchInput, minibatchExpected, minibatchWorkspace)/minibatchRows;
+				if (!i)
+					firstError = error;
+			}
+			cout << "   " << minibatchGenerations/t.Seconds() << " generations/s; error on all the rows: " << firstError << " -> " << error << endl;
+			if (error >= firstError)
+				throw std::string("Not improving");
+			cout << "Succeeded." << endl;
+		}
+		{
+			cout << "Test steady-state generations..." << endl;
+			typedef Net<input, Net<31, Net<output>>> SteadyStateNetType;
+			const unsigned steadyStateRows = 512;
+			AlignedMatrix<input> steadyStateInput(steadyStateRows);
+			AlignedMatrix<output> steadyStateExpected(steadyStateRows);
+			for (unsigned i = 0; i < steadyStateRows; ++i)
+			{
+				for (unsigned j = 0; j < input; ++j)
+					steadyStateInput.GetRow(i)[j] = ((i*5 + j) % 17)*0.06;
+				for (unsigned j = 0; j < output; ++j)
+					steadyStateExpected.GetRow(i)[j] = ((i % output) == j) ? 0.9 : 0.1;
+			}
+			const int savedThreads = omp_get_max_threads();
+			omp_set_num_threads(4);
+			Population<SteadyStateNetType> steadyStatePopulation(200, 0.1, 21);
+			const double firstError = steadyStatePopulation.TrainSteadyState(steadyStateInput, steadyStateExpected, 0.1, 1);
+			const double error = steadyStatePopulation.TrainSteadyState(steadyStateInput, steadyStateExpected, 0.1, 10);
+			omp_set_num_threads(savedThreads);
+			const SteadyStateReport& report = steadyStatePopulation.GetLastSteadyStateReport();
+			cout << "   " << report.Threads << " threads, " << report.GenerationsPerSecond << " generations/s, utilization " 
+				 << report.Utilization*100 << "%; error: " << firstError << " -> " << error << endl;
+			if (report.Children != 10*180 || report.Error != error || report.Utilization <= 0 || report.Utilization > 1.01)
+				throw std::string("Wrong report");
+			//The best individual is never replaced:
+			if (error > firstError)
+				throw std::string("Not improving");
+			//One child at a time in a small population, which tournaments often draw the best slot more than once:
+			Population<XorNetType> smallPopulation(6, 0.5, 5);
+			double bestError = smallPopulation.TrainSteadyState(xorInputMatrix, xorExpectedMatrix, 0.5, 0.34);
+			for (int i = 0; i < 300; ++i)
+			{
+				const double childError = smallPopulation.TrainSteadyState(xorInputMatrix, xorExpectedMatrix, 0.5, 0.34);
+				if (smallPopulation.GetLastSteadyStateReport().Children != 1 || childError > bestError)
+					throw std::string("The best individual was replaced");
+				bestError = childError;
+			}
+			cout << "Succeeded." << endl;
+		}
 	}
 	catch(string error)
 	{